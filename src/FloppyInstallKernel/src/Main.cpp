@@ -3,35 +3,750 @@
 #include "sal.h"
 #include "intrin.h"
 #include "physmem.h"
+#include "paging.h"
+#include "vmalloc.h"
+#include "kmap.h"
+#include "kheap.h"
+#include "idt.h"
+#include "acpi.h"
+#include "apic.h"
+#include "smp.h"
+#include "cpu.h"
+#include "ktime.h"
+#include "ktimer.h"
+#include "softirq.h"
+#include "thread.h"
+#include "task.h"
+#include "spinlock.h"
+#include "rcu.h"
+#include "ring.h"
+#include "sync.h"
+#include "async.h"
+#include "percpu.h"
+#include "idle.h"
+#include "arena.h"
+#include "kprintf.h"
 #include "vgatext.h"
+#include "serial.h"
 
 NOS_EXTERN_C
 
-static void mask_all_irqs()
+enum // constants
 {
-    enum // just some local constants
+    BootArenaChunkPages = 4,
+    InterruptCostIterations = 1000,
+    TimerBenchmarkCount = 20000,
+    PingPongIterations = 10000,
+    ParallelBenchmarkBytes = 16 * 1024 * 1024,
+    ParallelGrainPages = 16,
+    LockBenchmarkIterations = 200000,
+    LockGrain = 1000,
+    GracePeriodCount = 100,
+    RingSize = 1024,
+    RingMessages = 256 * 1024,
+    RingBatch = 32,
+    AsyncRequestCount = 4096,
+    AsyncStepsPerRequest = 4,
+    FakeDeviceLatencyNs = 1000000,
+    IdleWakeRounds = 50,
+    IdleSleepNs = 5000000,
+    KprintfBenchmarkLines = 40,
+};
+
+static void CountTimerExpiry(_Inout_ Timer* timer, _In_opt_ void* context)
+{
+    (void)timer;
+    (*(volatile uint32_t*)context)++;
+}
+
+static void BenchmarkTimers()
+{
+    // arming cost shouldn't depend on how many timers are already armed.
+    Timer* timers = (Timer*)vmAllocate(TimerBenchmarkCount * sizeof(Timer));
+    if (timers == nullptr)
+    {
+        return;
+    }
+
+    volatile uint32_t fired = 0;
+    uint32_t seed = 12345;
+
+    const uint64_t armStart = __rdtsc();
+    for (uint32_t i = 0; i < TimerBenchmarkCount; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+
+        timerSetup(&timers[i], CountTimerExpiry, (void*)&fired);
+        timerArm(&timers[i], (uint64_t)((seed >> 8) % 60000) * 1000000);
+    }
+    const uint64_t armCycles = __rdtsc() - armStart;
+
+    const uint64_t cancelStart = __rdtsc();
+    for (uint32_t i = 0; i < TimerBenchmarkCount; i++)
+    {
+        timerCancel(&timers[i]);
+    }
+    const uint64_t cancelCycles = __rdtsc() - cancelStart;
+
+    vmFree(timers);
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u timers: %llu ns per arm, %llu ns per cancel\n",
+        TimerBenchmarkCount,
+        ktimeCyclesToNs(armCycles) / TimerBenchmarkCount,
+        ktimeCyclesToNs(cancelCycles) / TimerBenchmarkCount
+    );
+
+    // nothing else is armed, so the processor sleeps until this fires.
+    Timer wakeup;
+    timerSetup(&wakeup, CountTimerExpiry, (void*)&fired);
+
+    const uint64_t sleepStart = ktimeNowNs();
+    timerArm(&wakeup, 100 * 1000000);
+
+    while (fired == 0)
+    {
+        // checked with interrupts disabled, so the timer can't fire between the check and the
+        // wait and leave the processor asleep until some other interrupt.
+        _disable();
+        if (fired == 0)
+        {
+            idleWait();
+        }
+        else
+        {
+            _enable();
+        }
+    }
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- 100ms timer fired after %llu us\n",
+        (ktimeNowNs() - sleepStart) / 1000
+    );
+
+    SoftirqStats softirqStats;
+    softirqGetStats(SOFTIRQ_Timer, &softirqStats);
+    kprintf(
+        vtKPrintfStream(),
+        "-- timer softirq: %u runs, max latency %llu ns, max run time %llu ns\n",
+        softirqStats.runCount,
+        ktimeCyclesToNs(softirqStats.maxLatencyCycles),
+        ktimeCyclesToNs(softirqStats.maxRunCycles)
+    );
+}
+
+static void PingPong(_In_opt_ void* context)
+{
+    for (uint32_t i = 0; i < PingPongIterations; i++)
+    {
+        threadYield();
+    }
+
+    *(volatile bool*)context = true;
+}
+
+static void BenchmarkThreads()
+{
+    // let anything that's already ready (the softirq worker) run until it blocks, so the boot
+    // thread and the new one are the only ready threads and every yield switches between them.
+    threadYield();
+
+    volatile bool finished = false;
+
+    ThreadStats before;
+    threadGetStats(&before);
+
+    const uint64_t start = __rdtsc();
+    if (threadCreate(PingPong, (void*)&finished) == nullptr)
+    {
+        return;
+    }
+
+    while (!finished)
+    {
+        threadYield();
+    }
+    const uint64_t cycles = __rdtsc() - start;
+
+    ThreadStats after;
+    threadGetStats(&after);
+    const uint32_t switches = after.switchCount - before.switchCount;
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u context switches: %llu cycles per switch (%u preempted since boot)\n",
+        switches,
+        (switches > 0) ? (cycles / switches) : 0,
+        after.preemptCount
+    );
+}
+
+typedef struct tag_SemaphorePingPong
+{
+    Semaphore ping;
+    Semaphore pong;
+} SemaphorePingPong;
+
+static void Pong(_In_opt_ void* context)
+{
+    SemaphorePingPong* pingPong = (SemaphorePingPong*)context;
+
+    for (uint32_t i = 0; i < PingPongIterations; i++)
+    {
+        semaphoreWait(&pingPong->ping);
+        semaphoreSignal(&pingPong->pong);
+    }
+}
+
+static void BenchmarkSemaphores()
+{
+    // the two threads take turns blocking on each other, so every wait blocks and every signal
+    // hands the count straight over.
+    SemaphorePingPong pingPong;
+    semaphoreSetup(&pingPong.ping, 0);
+    semaphoreSetup(&pingPong.pong, 0);
+
+    SyncStats before;
+    syncGetStats(&before);
+
+    const uint64_t start = __rdtsc();
+    if (threadCreate(Pong, &pingPong) == nullptr)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < PingPongIterations; i++)
+    {
+        semaphoreSignal(&pingPong.ping);
+        semaphoreWait(&pingPong.pong);
+    }
+    const uint64_t cycles = __rdtsc() - start;
+
+    SyncStats after;
+    syncGetStats(&after);
+    const uint32_t blocks = after.blockCount - before.blockCount;
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u semaphore round trips: %llu ns each, %u blocks, %u handoffs, wake avg %llu ns, "
+        "max %llu ns\n",
+        PingPongIterations,
+        ktimeCyclesToNs(cycles) / PingPongIterations,
+        blocks,
+        after.handoffCount - before.handoffCount,
+        (blocks > 0) ? ktimeCyclesToNs(after.wakeCycles - before.wakeCycles) / blocks : 0,
+        ktimeCyclesToNs(after.maxWakeCycles)
+    );
+}
+
+typedef struct tag_ChecksumJob
+{
+    const uint8_t* buffer;
+    volatile long sum;
+} ChecksumJob;
+
+static void ZeroPages(_In_opt_ void* context, uint32_t begin, uint32_t end)
+{
+    uint8_t* buffer = (uint8_t*)context;
+    memset(buffer + begin * NOS_PAGE_SIZE, 0, (end - begin) * NOS_PAGE_SIZE);
+}
+
+static void ChecksumPages(_In_opt_ void* context, uint32_t begin, uint32_t end)
+{
+    // a byte of each page holds its index, so the sum shows every page was visited exactly once.
+    ChecksumJob* job = (ChecksumJob*)context;
+
+    long pieceSum = 0;
+    for (uint32_t page = begin; page < end; page++)
+    {
+        const uint32_t* words = (const uint32_t*)(job->buffer + page * NOS_PAGE_SIZE);
+        for (uint32_t i = 0; i < NOS_PAGE_SIZE / sizeof(uint32_t); i++)
+        {
+            pieceSum += (long)words[i];
+        }
+    }
+
+    _InterlockedExchangeAdd(&job->sum, pieceSum);
+}
+
+static void BenchmarkParallelFor()
+{
+    uint8_t* buffer = (uint8_t*)vmAllocate(ParallelBenchmarkBytes);
+    if (buffer == nullptr)
+    {
+        return;
+    }
+
+    constexpr uint32_t pageCount = ParallelBenchmarkBytes / NOS_PAGE_SIZE;
+
+    const uint64_t serialStart = __rdtsc();
+    ZeroPages(buffer, 0, pageCount);
+    const uint64_t serialCycles = __rdtsc() - serialStart;
+
+    const uint64_t parallelStart = __rdtsc();
+    parallelFor(0, pageCount, ParallelGrainPages, ZeroPages, buffer);
+    const uint64_t parallelCycles = __rdtsc() - parallelStart;
+
+    for (uint32_t page = 0; page < pageCount; page++)
+    {
+        buffer[page * NOS_PAGE_SIZE] = (uint8_t)page;
+    }
+
+    ChecksumJob checksum;
+    checksum.buffer = buffer;
+    checksum.sum = 0;
+
+    parallelFor(0, pageCount, ParallelGrainPages, ChecksumPages, &checksum);
+
+    long expected = 0;
+    for (uint32_t page = 0; page < pageCount; page++)
+    {
+        expected += (uint8_t)page;
+    }
+
+    vmFree(buffer);
+
+    TaskStats taskStats;
+    taskGetStats(&taskStats);
+    kprintf(
+        vtKPrintfStream(),
+        "-- zeroed %u pages on %u processor(s): %llu cycles serial, %llu parallel, checksum %s\n",
+        pageCount,
+        cpuOnlineCount(),
+        serialCycles,
+        parallelCycles,
+        (checksum.sum == expected) ? "ok" : "BAD"
+    );
+    kprintf(
+        vtKPrintfStream(),
+        "   %u tasks spawned, %u stolen, %u run inline, %u wakeups\n",
+        taskStats.spawnCount,
+        taskStats.stealCount,
+        taskStats.inlineCount,
+        taskStats.wakeCount
+    );
+}
+
+typedef struct tag_LockJob
+{
+    TicketLock ticket;
+    McsLock mcs;
+    uint32_t count;
+} LockJob;
+
+static void CountWithTicketLock(_In_opt_ void* context, uint32_t begin, uint32_t end)
+{
+    LockJob* job = (LockJob*)context;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const bool enabled = ticketLockAcquireIrqSave(&job->ticket);
+        job->count++;
+        ticketLockReleaseIrqRestore(&job->ticket, enabled);
+    }
+}
+
+static void CountWithMcsLock(_In_opt_ void* context, uint32_t begin, uint32_t end)
+{
+    LockJob* job = (LockJob*)context;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        McsNode node;
+        const bool enabled = mcsLockAcquireIrqSave(&job->mcs, &node);
+        job->count++;
+        mcsLockReleaseIrqRestore(&job->mcs, &node, enabled);
+    }
+}
+
+static void BenchmarkLocks()
+{
+    // every processor hammers the same lock; the count shows none of the increments were lost.
+    LockJob job;
+    memset(&job, 0, sizeof(job));
+
+    const uint64_t ticketStart = __rdtsc();
+    parallelFor(0, LockBenchmarkIterations, LockGrain, CountWithTicketLock, &job);
+    const uint64_t ticketCycles = __rdtsc() - ticketStart;
+
+    const uint64_t mcsStart = __rdtsc();
+    parallelFor(0, LockBenchmarkIterations, LockGrain, CountWithMcsLock, &job);
+    const uint64_t mcsCycles = __rdtsc() - mcsStart;
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u contended acquires on %u processor(s): ticket %llu cycles, MCS %llu cycles, %s\n",
+        LockBenchmarkIterations,
+        cpuOnlineCount(),
+        ticketCycles / LockBenchmarkIterations,
+        mcsCycles / LockBenchmarkIterations,
+        (job.count == 2 * LockBenchmarkIterations) ? "ok" : "BAD"
+    );
+
+    lockProfilePrint(vtKPrintfStream());
+}
+
+static void BenchmarkRcu()
+{
+    // the other processors are busy or halted, so most of these are ended by the IPIs.
+    for (uint32_t i = 0; i < GracePeriodCount; i++)
+    {
+        rcuSynchronize();
+    }
+
+    RcuStats stats;
+    rcuGetStats(&stats);
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u RCU grace periods: avg %llu ns, max %llu ns, %u kicks\n",
+        stats.graceCount,
+        (stats.graceCount > 0) ? ktimeCyclesToNs(stats.waitCycles) / stats.graceCount : 0,
+        ktimeCyclesToNs(stats.maxWaitCycles),
+        stats.kickCount
+    );
+}
+
+extern "C++"
+{
+    template <class Ring>
+    static uint64_t RingRoundTrips(_Inout_ Ring* ring, uint32_t batch)
+    {
+        // push and pop on the same processor - what's measured is the cost of the index updates
+        // and locked instructions each message pays, not cache line transfers.
+        uint32_t messages[RingBatch];
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            messages[i] = i;
+        }
+
+        const uint64_t start = __rdtsc();
+        for (uint32_t sent = 0; sent < RingMessages; sent += batch)
+        {
+            if (!ring->Push(messages, batch))
+            {
+                return 0;
+            }
+
+            ring->Pop(messages, batch);
+        }
+
+        return (__rdtsc() - start) / RingMessages;
+    }
+}
+
+static void BenchmarkRings()
+{
+    static SpscRing<uint32_t, RingSize> spsc;
+    static MpscRing<uint32_t, RingSize> mpsc;
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- ring cycles per message, single/batched by %u: SPSC %llu/%llu, MPSC %llu/%llu\n",
+        RingBatch,
+        RingRoundTrips(&spsc, 1),
+        RingRoundTrips(&spsc, RingBatch),
+        RingRoundTrips(&mpsc, 1),
+        RingRoundTrips(&mpsc, RingBatch)
+    );
+}
+
+struct tag_FakeDevice;
+
+//! \brief  An operation made of several steps, each waiting for a (pretend) device interrupt.
+typedef struct tag_FakeIoRequest
+{
+    AsyncTask task;
+    AsyncCompletion completion;
+    struct tag_FakeIoRequest* nextSubmitted;
+    struct tag_FakeDevice* device;
+    uint32_t step;
+} FakeIoRequest;
+
+//! \brief  Completes everything submitted to it on a timer, the way a controller would with an
+//!         interrupt.
+typedef struct tag_FakeDevice
+{
+    Timer timer;
+    FakeIoRequest* submitted;
+    volatile long finishedCount;
+} FakeDevice;
+
+static void CompleteFakeIo(_Inout_ Timer* timer, _In_opt_ void* context)
+{
+    (void)timer;
+    FakeDevice* device = (FakeDevice*)context;
+
+    const bool enabled = idtDisableInterrupts();
+    FakeIoRequest* request = device->submitted;
+    device->submitted = nullptr;
+    idtRestoreInterrupts(enabled);
+
+    while (request != nullptr)
+    {
+        // the request may be resubmitted as soon as it's completed.
+        FakeIoRequest* next = request->nextSubmitted;
+        asyncComplete(&request->completion, (long)request->step);
+        request = next;
+    }
+}
+
+static void SubmitFakeIo(_Inout_ FakeIoRequest* request)
+{
+    FakeDevice* device = request->device;
+    asyncCompletionSetup(&request->completion);
+
+    const bool enabled = idtDisableInterrupts();
+    request->nextSubmitted = device->submitted;
+    device->submitted = request;
+
+    if (!timerIsArmed(&device->timer))
+    {
+        timerArm(&device->timer, FakeDeviceLatencyNs);
+    }
+    idtRestoreInterrupts(enabled);
+}
+
+static AsyncStatus FakeIo(_Inout_ AsyncTask* task)
+{
+    FakeIoRequest* request = (FakeIoRequest*)task->context;
+
+    ASYNC_BEGIN(task);
+
+    for (request->step = 0; request->step < AsyncStepsPerRequest; request->step++)
+    {
+        SubmitFakeIo(request);
+        ASYNC_AWAIT(task, &request->completion);
+    }
+
+    _InterlockedIncrement(&request->device->finishedCount);
+
+    ASYNC_END(task);
+}
+
+static void BenchmarkAsync()
+{
+    FakeIoRequest* requests = (FakeIoRequest*)vmAllocate(AsyncRequestCount * sizeof(FakeIoRequest));
+    if (requests == nullptr)
+    {
+        return;
+    }
+
+    FakeDevice device;
+    timerSetup(&device.timer, CompleteFakeIo, &device);
+    device.submitted = nullptr;
+    device.finishedCount = 0;
+
+    AsyncStats before;
+    asyncGetStats(&before);
+
+    const uint64_t start = ktimeNowNs();
+    for (uint32_t i = 0; i < AsyncRequestCount; i++)
+    {
+        requests[i].device = &device;
+        asyncStart(&requests[i].task, FakeIo, &requests[i]);
+    }
+
+    while (device.finishedCount < AsyncRequestCount)
+    {
+        // as in BenchmarkTimers, the last completion mustn't slip in between the check and the
+        // wait.
+        _disable();
+        if (device.finishedCount < AsyncRequestCount)
+        {
+            idleWait();
+        }
+        else
+        {
+            _enable();
+        }
+    }
+    const uint64_t elapsedNs = ktimeNowNs() - start;
+
+    vmFree(requests);
+
+    AsyncStats after;
+    asyncGetStats(&after);
+    const uint32_t resumes = after.resumeCount - before.resumeCount;
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u async requests of %u steps in %llu ms, %u bytes each (a thread stack is %u)\n",
+        AsyncRequestCount,
+        AsyncStepsPerRequest,
+        elapsedNs / 1000000,
+        (uint32_t)sizeof(FakeIoRequest),
+        THREAD_StackPages * NOS_PAGE_SIZE
+    );
+
+    kprintf(
+        vtKPrintfStream(),
+        "-- %u async resumes: avg %llu ns, max %llu ns after completion\n",
+        resumes,
+        (resumes > 0) ? ktimeCyclesToNs(after.resumeCycles - before.resumeCycles) / resumes : 0,
+        ktimeCyclesToNs(after.maxResumeCycles)
+    );
+}
+
+static void DoNothing(_In_opt_ void* context, uint32_t begin, uint32_t end)
+{
+    (void)context;
+    (void)begin;
+    (void)end;
+}
+
+static void BenchmarkIdle()
+{
+    // sleep long enough between rounds for the workers to give up spinning and idle, so each
+    // round's tasks have to wake them.
+    volatile uint32_t fired = 0;
+    Timer wakeup;
+    timerSetup(&wakeup, CountTimerExpiry, (void*)&fired);
+
+    for (uint32_t round = 0; round < IdleWakeRounds; round++)
+    {
+        parallelFor(0, CPU_MaxCount, 1, DoNothing, nullptr);
+
+        const uint32_t expected = fired + 1;
+        timerArm(&wakeup, IdleSleepNs);
+
+        while (fired != expected)
+        {
+            // the timer's softirq runs before idleWait returns, so this can't sleep through it.
+            _disable();
+            if (fired != expected)
+            {
+                idleWait();
+            }
+            else
+            {
+                _enable();
+            }
+        }
+    }
+
+    idlePrintReport(vtKPrintfStream());
+}
+
+static void SerialWriteChar(char ch)
+{
+    serialWrite(&ch, 1);
+}
+
+//! \brief  Prints lines to a stream, and gets its rate in characters per second.
+static uint64_t MeasureKprintf(_In_ const kprintf_stream* stream)
+{
+    // each line is 54 characters, whatever the values.
+    constexpr uint64_t lineChars = 6 * 9;
+    const uint64_t start = __rdtsc();
+
+    for (uint32_t line = 0; line < KprintfBenchmarkLines; line++)
     {
-        PIC1 = 0x20,         // IO base address for master PIC
-        PIC2 = 0xA0,         // IO base address for slave PIC
+        kprintf(
+            stream,
+            "%08x %08x %08x %08x %08x %08x\n",
+            line,
+            line * 3,
+            line * 5,
+            line * 7,
+            line * 11,
+            line * 13
+        );
+    }
+
+    const uint64_t ns = ktimeCyclesToNs(__rdtsc() - start);
+    return (ns > 0) ? (KprintfBenchmarkLines * lineChars * 1000000000ull) / ns : 0;
+}
+
+static void BenchmarkKprintf(bool serialAvailable)
+{
+    // the "before" streams only have write, so they get a character at a time as kprintf did
+    // before it buffered: the screen's cursor is moved for every character, and the UART's line
+    // status is polled for every one.
+    static const kprintf_stream vgaCharStream = { vtPrintChar, nullptr, nullptr };
+    static const kprintf_stream serialCharStream = { SerialWriteChar, nullptr, nullptr };
 
-        PIC1_COMMAND = PIC1,
-        PIC1_DATA = (PIC1 + 1),
+    const uint64_t vgaBefore = MeasureKprintf(&vgaCharStream);
+    const uint64_t vgaAfter = MeasureKprintf(vtKPrintfStream());
 
-        PIC2_COMMAND = PIC2,
-        PIC2_DATA = (PIC2 + 1),
-    };
+    kprintf(
+        vtKPrintfStream(),
+        "-- kprintf to VGA: %llu chars/s a character at a time, %llu chars/s buffered\n",
+        vgaBefore,
+        vgaAfter
+    );
 
-    __outbyte(PIC1_DATA, 0xFF);
-    __outbyte(PIC2_DATA, 0xFF);
+    if (serialAvailable)
+    {
+        const uint64_t serialBefore = MeasureKprintf(&serialCharStream);
+        const uint64_t serialAfter = MeasureKprintf(serialKPrintfStream());
+
+        kprintf(
+            vtKPrintfStream(),
+            "-- kprintf to COM1: %llu chars/s a character at a time, %llu chars/s buffered\n",
+            serialBefore,
+            serialAfter
+        );
+    }
+}
+
+static void PrintMemoryMap(_Inout_ Arena* arena, _In_ const MemoryMap* mmap)
+{
+    kprintf(vtKPrintfStream(), "Memory Map (%d entries):\n", mmap->count);
+
+    // the BIOS doesn't promise the entries are in order, so sort a copy by base address.
+    const MemMapEntry** sorted = (const MemMapEntry**)arenaAllocate(
+        arena,
+        mmap->count * sizeof(const MemMapEntry*)
+    );
+
+    if (sorted == nullptr)
+    {
+        vtPrintString("    (out of memory)\n");
+        return;
+    }
+
+    for (int i = 0; i < mmap->count; i++)
+    {
+        const MemMapEntry* entry = &(mmap->entries[i]);
+
+        int j = i;
+        while (j > 0 && sorted[j - 1]->base > entry->base)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+
+        sorted[j] = entry;
+    }
+
+    for (int i = 0; i < mmap->count; i++)
+    {
+        kprintf(
+            vtKPrintfStream(),
+            "%016llX - %016llX (%016llX) %d %08X\n",
+            sorted[i]->base,
+            (sorted[i]->base + sorted[i]->length),
+            sorted[i]->length,
+            sorted[i]->regionType,
+            sorted[i]->acpiExtAttributes
+        );
+    }
 }
 
 void kmain(_In_ MemoryMap* mmap)
 {
-    // mask all IRQs - since I don't have anything to remap IRQs 0-7 to other
-    // interrupts yet, these would raise interrupts that map to exception codes,
-    // and ultimately lead to one very confused developer and about a week of
-    // debugging spurious #DF exceptions with no exceptions leading up to it.
-    mask_all_irqs();
+    // remap the PICs before anything else - left alone, IRQs 0-7 raise interrupts that map to
+    // exception codes, and ultimately lead to one very confused developer and about a week of
+    // debugging spurious #DF exceptions with no exceptions leading up to it. Interrupts use
+    // per-CPU data, so that has to be set up first.
+    cpuInitialize(0);
+    idtInitialize();
+    rcuInitialize();
+    taskInitialize();
+    _enable();
 
     if (!nos_krt_init())
     {
@@ -44,21 +759,22 @@ void kmain(_In_ MemoryMap* mmap)
     vtEnableCursor();
 
     vtPrintString("In kmain\n");
-    kprintf(vtKPrintfStream(), "Memory Map (%d entries):\n", mmap->count);
 
-    for (int i = 0; i < mmap->count; i++)
+    const bool serialAvailable = serialInitialize();
+    if (!serialAvailable)
     {
-        kprintf(
-            vtKPrintfStream(),
-            "%016llX - %016llX (%016llX) %d %08X\n",
-            mmap->entries[i].base,
-            (mmap->entries[i].base + mmap->entries[i].length),
-            mmap->entries[i].length,
-            mmap->entries[i].regionType,
-            mmap->entries[i].acpiExtAttributes
-        );
+        vtPrintString("    no serial port found at COM1\n");
     }
 
+    uint64_t minEntryCycles;
+    uint64_t averageEntryCycles;
+    idtMeasureEntryCost(InterruptCostIterations, &minEntryCycles, &averageEntryCycles);
+    kprintf(
+        vtKPrintfStream(),
+        "    interrupt round trip = %llu cycles (%llu average)\n",
+        minEntryCycles,
+        averageEntryCycles
+    );
 
     vtPrintString("Initializing memory . . .\n");
 
@@ -67,6 +783,123 @@ void kmain(_In_ MemoryMap* mmap)
         vtPrintString("Failed to initialize memory.\n\n");
     }
 
+    vtPrintString("Enabling paging . . .\n");
+
+    bool timersAvailable = false;
+    bool threadsAvailable = false;
+
+    if (vmInitialize())
+    {
+        kprintf(
+            vtKPrintfStream(),
+            "    direct map = %p - %p\n",
+            (void*)VM_DirectMapBase,
+            (void*)(VM_DirectMapBase + vmDirectMapLimit())
+        );
+
+        if (!vmallocInitialize())
+        {
+            vtPrintString("Failed to initialize virtual allocations.\n\n");
+        }
+
+        if (!kmapInitialize())
+        {
+            vtPrintString("Failed to initialize temporary mappings.\n\n");
+        }
+
+        if (!kheapInitialize())
+        {
+            vtPrintString("Failed to initialize the kernel heap.\n\n");
+        }
+
+        if (acpiInitialize() && apicInitialize())
+        {
+            kprintf(
+                vtKPrintfStream(),
+                "    IRQs via %s, %u processor(s), LAPIC timer = %u ticks/ms\n",
+                idtGetIrqController()->name,
+                apicCpuCount(),
+                lapicTimerCalibrate()
+            );
+
+            kprintf(
+                vtKPrintfStream(),
+                "    %u of %u processor(s) online\n",
+                smpStartProcessors(taskRunWorker, nullptr),
+                apicCpuCount()
+            );
+        }
+        else
+        {
+            vtPrintString("    no APIC found, IRQs stay on the 8259 PICs\n");
+        }
+
+        if (ktimeInitialize())
+        {
+            kprintf(
+                vtKPrintfStream(),
+                "    TSC = %llu Hz (calibrated against the %s, %s)\n",
+                ktimeTscFrequency(),
+                ktimeCalibrationSource(),
+                ktimeTscIsInvariant() ? "invariant" : "not invariant"
+            );
+        }
+        else
+        {
+            vtPrintString("Failed to calibrate the clock.\n\n");
+        }
+
+        timersAvailable = timerInitialize();
+        if (!timersAvailable)
+        {
+            vtPrintString("Failed to initialize timers.\n\n");
+        }
+
+        asyncInitialize();
+
+        if (threadInitialize())
+        {
+            threadsAvailable = true;
+
+            if (timersAvailable)
+            {
+                threadEnablePreemption();
+            }
+
+            if (!softirqStartWorker())
+            {
+                vtPrintString("Failed to start the softirq worker.\n\n");
+            }
+        }
+        else
+        {
+            vtPrintString("Failed to initialize threads.\n\n");
+        }
+    }
+    else
+    {
+        vtPrintString("Failed to enable paging.\n\n");
+    }
+
+    // scratch space for boot-time parsing. Everything in here is released at once when the
+    // boot phase is over.
+    Arena bootArena;
+    arenaInitialize(&bootArena, BootArenaChunkPages);
+
+    PrintMemoryMap(&bootArena, mmap);
+
+    ArenaStats arenaStats;
+    arenaGetStats(&bootArena, &arenaStats);
+    kprintf(
+        vtKPrintfStream(),
+        "-- boot arena: %u bytes used, %u reserved, %u chunk(s)\n",
+        arenaStats.bytesUsed,
+        arenaStats.bytesReserved,
+        arenaStats.chunkCount
+    );
+
+    arenaDestroy(&bootArena);
+
     constexpr uint32_t cb = 10 * 1024;
     uint32_t numPages = 0;
 
@@ -80,8 +913,96 @@ void kmain(_In_ MemoryMap* mmap)
     vtPrintString("-- freed memory\n");
     __bochsbreak();
 
+    constexpr size_t vcb = 4 * 1024 * 1024;
+    void* vptr = vmAllocate(vcb);
+
+    kprintf(vtKPrintfStream(), "-- allocated %u virtually contiguous bytes at %p\n", vcb, vptr);
+    __bochsbreak();
+
+    vmFree(vptr);
+    vtPrintString("-- freed virtual memory\n");
+    __bochsbreak();
+
+    // only the pages that are touched get backed by memory.
+    constexpr size_t hcb = 64 * 1024 * 1024;
+    uint8_t* heap = (uint8_t*)kheapReserve(hcb);
+
+    if (heap != nullptr)
+    {
+        for (size_t offset = 0; offset < hcb; offset += hcb / 4)
+        {
+            heap[offset] = 1;
+        }
+
+        KheapStats heapStats;
+        kheapGetStats(&heapStats);
+        kprintf(
+            vtKPrintfStream(),
+            "-- reserved %u heap bytes at %p: %u of %u pages committed, %u faults (max %llu ns)\n",
+            hcb,
+            heap,
+            heapStats.committedPages,
+            heapStats.reservedPages,
+            heapStats.faultCount,
+            ktimeCyclesToNs(heapStats.maxFaultCycles)
+        );
+        __bochsbreak();
+
+        kheapRelease(heap);
+        vtPrintString("-- released heap reservation\n");
+        __bochsbreak();
+    }
+
+    if (timersAvailable)
+    {
+        BenchmarkTimers();
+        __bochsbreak();
+    }
+
+    if (threadsAvailable)
+    {
+        BenchmarkThreads();
+        __bochsbreak();
+
+        BenchmarkSemaphores();
+        __bochsbreak();
+    }
+
+    BenchmarkParallelFor();
+    __bochsbreak();
+
+    BenchmarkLocks();
+    __bochsbreak();
+
+    BenchmarkRcu();
+    __bochsbreak();
+
+    BenchmarkRings();
+    __bochsbreak();
+
+    if (timersAvailable)
+    {
+        BenchmarkAsync();
+        __bochsbreak();
+
+        BenchmarkIdle();
+        __bochsbreak();
+    }
+
+    BenchmarkKprintf(serialAvailable);
+    __bochsbreak();
+
+    percpuPrint(vtKPrintfStream());
+    __bochsbreak();
+
+    idtPrintReport(vtKPrintfStream());
+    __bochsbreak();
+
     vtPrintString("Hit end of kmain . . .\n");
     __bochsbreak();
+
+    // nothing left to do but handle interrupts (and run any threads they wake).
+    idleLoop();
 }
 
 NOS_END_EXTERN_C
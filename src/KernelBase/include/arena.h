@@ -0,0 +1,208 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines a region (arena) allocator for phase-scoped kernel data.
+//!
+//! \details
+//! An arena hands out memory by bumping a cursor through chunks of pages obtained from the
+//! physical memory manager. Individual allocations are never freed; instead the whole arena is
+//! rewound with arenaReset or released with arenaDestroy once the phase which owns the data
+//! (boot-time table parsing, a single request, etc.) is over.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Header placed at the start of every chunk owned by an arena.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_ArenaChunk
+{
+    struct tag_ArenaChunk* next;    //!< The next (older) chunk owned by the arena.
+    uint32_t pageCount;             //!< The number of pages in this chunk.
+    uint32_t padding;               //!< unused padding.
+} ArenaChunk;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Arena allocator state.
+//!
+//! \note   Treat the members as private; they are only exposed so arenaAllocate can be inlined.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Arena
+{
+    uintptr_t cursor;               //!< The next free byte in the current chunk.
+    uintptr_t limit;                //!< One past the last byte of the current chunk.
+    ArenaChunk* chunks;             //!< The chunks owned by the arena, most recent first.
+    uint32_t chunkPages;            //!< The default number of pages in a new chunk.
+    uint32_t resetCount;            //!< The number of times the arena has been reset.
+    size_t retiredBytes;            //!< Bytes used in chunks other than the current one.
+    size_t highWater;               //!< The most bytes in use at the time of any reset.
+} Arena;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Usage statistics of an arena.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_ArenaStats
+{
+    size_t bytesUsed;               //!< Bytes currently handed out (including alignment padding).
+    size_t bytesReserved;           //!< Bytes of pages currently owned by the arena.
+    size_t highWater;               //!< The most bytes ever in use at once.
+    uint32_t chunkCount;            //!< The number of chunks currently owned by the arena.
+    uint32_t resetCount;            //!< The number of times the arena has been reset.
+} ArenaStats;
+
+enum // constants
+{
+    ArenaDefaultAlignment = 8,      //!< Alignment used by arenaAllocate.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes an empty arena. No memory is taken until the first allocation.
+//!
+//! \param  arena       The arena to initialize.
+//! \param  chunkPages  The number of pages to request from the physical memory manager each
+//!                     time the arena runs out of space. Allocations larger than this get a
+//!                     chunk of their own.
+//-------------------------------------------------------------------------------------------------
+void arenaInitialize(_Out_ Arena* arena, uint32_t chunkPages);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allocates from a new chunk when the current one can't satisfy a request.
+//!
+//! \note   Use arenaAllocate or arenaAllocateAligned instead of calling this directly.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+void* arenaAllocateSlow(_Inout_ Arena* arena, size_t cb, size_t alignment);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allocates memory from an arena.
+//!
+//! \param  arena      The arena to allocate from.
+//! \param  cb         The number of bytes to allocate. A request for 0 bytes is given 1, so it
+//!                    still gets a pointer of its own.
+//! \param  alignment  The required alignment. Must be a power of 2 no larger than a page.
+//!
+//! \returns  A pointer to the allocated memory, or null if no more pages could be obtained.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+inline void* arenaAllocateAligned(_Inout_ Arena* arena, size_t cb, size_t alignment)
+{
+    // an empty arena's cursor and limit are both 0, which a 0 byte request would fit between.
+    if (cb == 0)
+    {
+        cb = 1;
+    }
+
+    uintptr_t ptr = (arena->cursor + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+
+    if (ptr >= arena->cursor
+        && ptr <= arena->limit
+        && cb <= arena->limit - ptr)
+    {
+        arena->cursor = ptr + cb;
+        return (void*)ptr;
+    }
+
+    return arenaAllocateSlow(arena, cb, alignment);
+}
+
+_Check_return_ _Success_(return != NULL)
+inline void* arenaAllocate(_Inout_ Arena* arena, size_t cb)
+{
+    return arenaAllocateAligned(arena, cb, ArenaDefaultAlignment);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases everything allocated from an arena, keeping its first chunk for reuse.
+//!
+//! \param  arena  The arena to reset.
+//-------------------------------------------------------------------------------------------------
+void arenaReset(_Inout_ Arena* arena);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases everything allocated from an arena and returns all of its pages.
+//!
+//! \param  arena  The arena to destroy. It may be reused without calling arenaInitialize again.
+//-------------------------------------------------------------------------------------------------
+void arenaDestroy(_Inout_ Arena* arena);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the usage statistics of an arena.
+//!
+//! \param       arena  The arena to query.
+//! \param[out]  stats  Receives the statistics.
+//-------------------------------------------------------------------------------------------------
+void arenaGetStats(_In_ const Arena* arena, _Out_ ArenaStats* stats);
+
+NOS_END_EXTERN_C
+
+
+#ifdef __cplusplus
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allocator adapter which places objects of type T in an arena.
+//!
+//! \details
+//! Follows the shape of a standard allocator so container templates can use it. Deallocation
+//! is a no-op; the memory is returned when the arena is reset or destroyed.
+//-------------------------------------------------------------------------------------------------
+template <class T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(_In_ ::Arena* arena)
+        : m_arena{ arena }
+    { }
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : m_arena{ other.Arena() }
+    { }
+
+
+    _Check_return_ _Success_(return != nullptr)
+    T* allocate(size_t count)
+    {
+        if (count > SIZE_MAX / sizeof(T))
+        {
+            return nullptr;
+        }
+
+        return static_cast<T*>(arenaAllocateAligned(m_arena, count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t count)
+    {
+        NOS_UNUSED_PARAM(ptr);
+        NOS_UNUSED_PARAM(count);
+    }
+
+
+    ::Arena* Arena() const
+    {
+        return m_arena;
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return m_arena == other.Arena();
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return m_arena != other.Arena();
+    }
+
+private:
+    ::Arena* m_arena;
+};
+
+#endif // __cplusplus
@@ -0,0 +1,195 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines stackless asynchronous tasks, for writing driver state machines as straight-line
+//!         code.
+//!
+//! \details
+//! A task is a function that can stop at an await and carry on from there when it's resumed. It
+//! has no stack of its own: between resumptions all it has is its AsyncTask (which records where
+//! to carry on) and whatever its context points to. So an outstanding operation costs a few dozen
+//! bytes rather than a thread stack.
+//!
+//! \code
+//! AsyncStatus ReadSector(_Inout_ AsyncTask* task)
+//! {
+//!     ReadRequest* request = (ReadRequest*)task->context;
+//!
+//!     ASYNC_BEGIN(task);
+//!     StartSeek(request);
+//!     ASYNC_AWAIT(task, &request->completion);
+//!     ...
+//!     ASYNC_END(task);
+//! }
+//! \endcode
+//!
+//! The macros are a switch on the resume point, so locals don't survive an await (keep anything
+//! that must in the context), and a task can't await from inside a switch of its own. Resume
+//! points are line numbers, so the code mustn't be compiled for Edit and Continue (/ZI), which
+//! makes __LINE__ a variable.
+//!
+//! Whatever completes an operation - normally an interrupt handler - calls asyncComplete. The
+//! task is queued on that processor, and resumed from a softirq on the way out of the interrupt.
+//! With no stack to stay with, a task runs on whichever processor completed its last await.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "katomic.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  What a task function returns.
+//-------------------------------------------------------------------------------------------------
+enum AsyncStatus
+{
+    ASYNC_Pending,          //!< The task is waiting, and will be resumed.
+    ASYNC_Done,             //!< The task has finished.
+};
+
+enum // constants
+{
+    ASYNC_Finished = 0xFFFFFFFF,    //!< The resume point of a finished task.
+};
+
+struct tag_AsyncTask;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The body of a task. Runs from a softirq (or asyncStart's caller), with interrupts
+//!         enabled.
+//-------------------------------------------------------------------------------------------------
+typedef AsyncStatus (*AsyncFunction)(_Inout_ struct tag_AsyncTask* task);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A task. The storage is owned by the caller, and must stay valid until it's finished.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_AsyncTask
+{
+    struct tag_AsyncTask* next;     //!< Next task in a processor's ready queue.
+    AsyncFunction function;
+    void* context;
+    uint32_t resumePoint;           //!< Where the function carries on from; 0 for the start.
+    uint64_t readyTsc;              //!< When the task was last queued to be resumed.
+} AsyncTask;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The completion of an operation, which one task at a time can await. Zeroed (or set up
+//!         with asyncCompletionSetup) it's incomplete.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_AsyncCompletion
+{
+    katomic<AsyncTask*> waiter;     //!< The waiting task, or ASYNC_CompletedMarker once complete.
+    long result;
+} AsyncCompletion;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Executor counters, summed over every processor. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_AsyncStats
+{
+    uint32_t startCount;            //!< Tasks started.
+    uint32_t finishCount;           //!< Tasks which have finished.
+    uint32_t resumeCount;           //!< Times a task carried on from an await or yield.
+    uint64_t resumeCycles;          //!< Total time from being queued to being resumed.
+    uint64_t maxResumeCycles;
+} AsyncStats;
+
+//! \brief  What a completion's waiter is set to once it's complete.
+#define ASYNC_CompletedMarker ((AsyncTask*)1)
+
+//! \brief  Starts a task function's body.
+#define ASYNC_BEGIN(task) \
+    switch ((task)->resumePoint) \
+    { \
+    case 0:
+
+//! \brief  Waits for a completion. Carries straight on if it has already completed.
+#define ASYNC_AWAIT(task, completion) \
+        (task)->resumePoint = __LINE__; \
+        if (!asyncSuspend((task), (completion))) \
+        { \
+            return ASYNC_Pending; \
+        } \
+    case __LINE__:
+
+//! \brief  Lets other ready tasks run, then carries on.
+#define ASYNC_YIELD(task) \
+        (task)->resumePoint = __LINE__; \
+        asyncReady(task); \
+        return ASYNC_Pending; \
+    case __LINE__:
+
+//! \brief  Ends a task function's body, finishing the task.
+#define ASYNC_END(task) \
+    } \
+    (task)->resumePoint = ASYNC_Finished; \
+    return ASYNC_Done
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up the executor's softirq. Requires softirqs.
+//-------------------------------------------------------------------------------------------------
+void asyncInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts a task, running it up to its first await in the caller.
+//!
+//! \param  task      The task's storage.
+//! \param  function  The task's body.
+//! \param  context   Passed to the body in task->context.
+//!
+//! \returns  ASYNC_Done if the task finished without waiting, or else ASYNC_Pending.
+//-------------------------------------------------------------------------------------------------
+AsyncStatus asyncStart(_Out_ AsyncTask* task, _In_ AsyncFunction function, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether a task has finished.
+//-------------------------------------------------------------------------------------------------
+inline bool asyncIsFinished(_In_ const AsyncTask* task)
+{
+    return (task->resumePoint == ASYNC_Finished);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a completion, incomplete. Also used to reuse one.
+//-------------------------------------------------------------------------------------------------
+void asyncCompletionSetup(_Out_ AsyncCompletion* completion);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Completes an operation, queueing the task waiting for it (if any) on this processor.
+//!         May be called from interrupt handlers, and from any processor.
+//!
+//! \param  completion  The operation's completion. Must not already be complete.
+//! \param  result      The result of the operation, for the task to read with asyncResult.
+//-------------------------------------------------------------------------------------------------
+void asyncComplete(_Inout_ AsyncCompletion* completion, long result);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the result a completion was completed with.
+//-------------------------------------------------------------------------------------------------
+inline long asyncResult(_In_ const AsyncCompletion* completion)
+{
+    return completion->result;
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Makes a task wait for a completion. Used by ASYNC_AWAIT.
+//!
+//! \returns  True if the completion had already completed (so the task should carry on), or
+//!           false if the task will be resumed once it does.
+//-------------------------------------------------------------------------------------------------
+_Check_return_
+bool asyncSuspend(_Inout_ AsyncTask* task, _Inout_ AsyncCompletion* completion);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Queues a task to be resumed on this processor. Used by ASYNC_YIELD and asyncComplete.
+//-------------------------------------------------------------------------------------------------
+void asyncReady(_Inout_ AsyncTask* task);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the executor counters.
+//-------------------------------------------------------------------------------------------------
+void asyncGetStats(_Out_ AsyncStats* stats);
+
+NOS_END_EXTERN_C
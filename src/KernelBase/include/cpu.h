@@ -0,0 +1,105 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines helpers for per-CPU data.
+//!
+//! \details
+//! Every processor has a CpuData block, and its own GDT entry for a data segment based at that
+//! block. Each processor loads its entry into fs, so finding the current processor's data is a
+//! single fs-relative load - no APIC ID lookup, and nothing to pass around.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "platform.h"
+#include "intrin.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    CPU_MaxCount = 8,       //!< The maximum number of processors the kernel supports.
+    CPU_CounterCount = 64,  //!< Per-CPU counter slots; see percpu.h.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A processor's own data.
+//-------------------------------------------------------------------------------------------------
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_CpuData
+{
+    struct tag_CpuData* self;   //!< The block's address, for code that needs a pointer to it.
+    uint32_t index;             //!< The processor's index, in [0, CPU_MaxCount).
+    uint32_t apicId;            //!< The processor's local APIC ID.
+    volatile bool online;       //!< Set once the processor is ready to take interrupts.
+    uint32_t preemptDisableCount;   //!< Non-zero while the running thread mustn't be switched.
+
+    //! The processor's values of the per-CPU counters, in cache lines of their own.
+    alignas(NOS_CACHE_LINE_SIZE) uint32_t counters[CPU_CounterCount];
+} CpuData;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Loads the kernel's GDT on this processor, and points fs at the processor's CpuData.
+//!         This has to come before anything that uses per-CPU data (including interrupts).
+//!
+//! \param  index  The processor's index. The boot processor is 0.
+//-------------------------------------------------------------------------------------------------
+void cpuInitialize(uint32_t index);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the data of the processor this code is running on.
+//-------------------------------------------------------------------------------------------------
+inline CpuData* cpuCurrentData(void)
+{
+    return (CpuData*)(uintptr_t)__readfsdword(offsetof(CpuData, self));
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the index of the processor this code is running on, in [0, CPU_MaxCount).
+//-------------------------------------------------------------------------------------------------
+inline uint32_t cpuCurrentIndex(void)
+{
+    return __readfsdword(offsetof(CpuData, index));
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Keeps the running thread on this processor until the matching cpuEnablePreemption.
+//!         Calls nest. Interrupts are still taken, but don't switch threads on their way out.
+//-------------------------------------------------------------------------------------------------
+inline void cpuDisablePreemption(void)
+{
+    // a single fs-relative instruction, so an interrupt can't split the update.
+    __incfsdword(offsetof(CpuData, preemptDisableCount));
+    _ReadWriteBarrier();
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Undoes a cpuDisablePreemption. A switch that was held off happens on the way out of
+//!         the next interrupt.
+//-------------------------------------------------------------------------------------------------
+inline void cpuEnablePreemption(void)
+{
+    _ReadWriteBarrier();
+    __addfsdword(offsetof(CpuData, preemptDisableCount), (unsigned long)-1);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether the running thread has preemption disabled.
+//-------------------------------------------------------------------------------------------------
+inline bool cpuPreemptionDisabled(void)
+{
+    return (__readfsdword(offsetof(CpuData, preemptDisableCount)) != 0);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a processor's data.
+//-------------------------------------------------------------------------------------------------
+CpuData* cpuGetData(uint32_t index);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of processors which are online.
+//-------------------------------------------------------------------------------------------------
+uint32_t cpuOnlineCount(void);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,78 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for idling processors.
+//!
+//! \details
+//! A processor with nothing to do waits in idleWait. If the processor supports it, that's mwait
+//! on a cache line of the processor's own, so another processor can wake it just by writing to
+//! the line (idleWake) - no IPI, and no interrupt to take on the other end. Otherwise it's hlt,
+//! and idleWake sends an IPI.
+//!
+//! Either way the processor stops executing instructions until it's needed, rather than spinning
+//! - which under an emulator means a host core isn't kept busy doing nothing.
+//!
+//! Each processor counts the time it spends idle, and how long it takes to get going again after
+//! idleWake.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "kprintf.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A processor's idle counters. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_IdleStats
+{
+    uint32_t idleCount;         //!< Times the processor waited.
+    uint32_t wakeCount;         //!< Waits ended by idleWake (rather than just an interrupt).
+    uint64_t idleCycles;        //!< Total time spent waiting.
+    uint64_t wakeCycles;        //!< Total time from idleWake to the processor running again.
+    uint64_t maxWakeCycles;
+} IdleStats;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether idle processors wait with mwait (or else with hlt).
+//-------------------------------------------------------------------------------------------------
+bool idleUsesMwait(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Waits for an interrupt or idleWake. Called with interrupts disabled, once the caller
+//!         has checked there's nothing to do.
+//!
+//! \note   Returns with interrupts enabled, and any interrupt that ended the wait handled.
+//-------------------------------------------------------------------------------------------------
+void idleWait(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Wakes a processor that's waiting in idleWait, or is about to. May be called from
+//!         interrupt handlers.
+//!
+//! \param  cpu     The processor to wake.
+//! \param  vector  The IPI to send if a write to its line won't do. Its handler just needs to
+//!                 acknowledge it.
+//-------------------------------------------------------------------------------------------------
+void idleWake(uint32_t cpu, uint32_t vector);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs this processor's softirqs and idles, forever. For code which has nothing left to
+//!         do but handle interrupts.
+//-------------------------------------------------------------------------------------------------
+void idleLoop(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a processor's idle counters.
+//-------------------------------------------------------------------------------------------------
+void idleGetStats(uint32_t cpu, _Out_ IdleStats* stats);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Prints each processor's idle counters, with its idle time as a share of the time since
+//!         it first idled.
+//-------------------------------------------------------------------------------------------------
+void idlePrintReport(_In_ const kprintf_stream* stream);
+
+NOS_END_EXTERN_C
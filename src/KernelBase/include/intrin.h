@@ -59,6 +59,7 @@ inline cpuid_result cpuidex(int function, int subfunction)
 
 
 INTRIN_X86_X64(void __bochsbreak(void));
+INTRIN_X86_X64(void __enable_and_halt(void));     // sti; hlt, with nothing in between.
 
 // standard library functions which undergo intrinsic replacement by the compiler.
 // see: https://docs.microsoft.com/en-us/cpp/preprocessor/intrinsic?view=vs-2017
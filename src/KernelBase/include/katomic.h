@@ -0,0 +1,387 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines freestanding atomic variables and memory ordering, in the style of <atomic>.
+//!
+//! \details
+//! The orderings mean what they do in C++11, mapped onto x86's memory model: loads aren't
+//! reordered with other loads, stores aren't reordered with other stores, and locked instructions
+//! are full barriers. So
+//!
+//! - acquire loads and release stores are plain moves, which only need the compiler held back,
+//! - sequentially consistent stores use xchg, so they can't pass a later load,
+//! - read-modify-write operations are locked instructions, whatever order is asked for.
+//!
+//! 64-bit values on 32-bit x86 are loaded and stored with cmpxchg8b, since two moves could tear.
+//! That makes a 64-bit load a locked write (of the value it read): it takes the cache line
+//! exclusively like a store would, so polling one from many processors costs more than polling a
+//! smaller value. It's also why the value is mutable, so a const katomic can still be loaded.
+//!
+//! Only integers, enums, bools and pointers fit; fetch_add and friends are for integers only.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+#include "sal.h"
+
+#ifdef __cplusplus
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The ordering an atomic operation imposes on the memory accesses around it.
+//-------------------------------------------------------------------------------------------------
+enum class memory_order
+{
+    relaxed,    //!< Only the operation itself is atomic.
+    acquire,    //!< Later accesses can't move before it.
+    release,    //!< Earlier accesses can't move after it.
+    acq_rel,    //!< Both acquire and release.
+    seq_cst,    //!< acq_rel, and all seq_cst operations appear in a single total order.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Tells the processor it's in a spin-wait loop. pause saves power, and stops the loop
+//!         from flooding the pipeline with speculative loads which have to be thrown away (at
+//!         some cost) once the awaited store arrives.
+//-------------------------------------------------------------------------------------------------
+inline void cpu_relax()
+{
+    _mm_pause();
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Keeps the compiler from moving memory accesses across this point. The processor may
+//!         still reorder them.
+//-------------------------------------------------------------------------------------------------
+inline void atomic_signal_fence(memory_order order)
+{
+    (void)order;
+    _ReadWriteBarrier();
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Orders the memory accesses before this point with the ones after it.
+//-------------------------------------------------------------------------------------------------
+inline void atomic_thread_fence(memory_order order)
+{
+    if (order == memory_order::seq_cst)
+    {
+        // a locked instruction on the stack is a full barrier, and cheaper than mfence (which
+        // also waits for non-temporal stores, and needs SSE2).
+        volatile long fence = 0;
+        _InterlockedOr(&fence, 0);
+    }
+    else if (order != memory_order::relaxed)
+    {
+        _ReadWriteBarrier();
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The intrinsics for one size of value. R is the integer type the intrinsics take.
+//-------------------------------------------------------------------------------------------------
+template <size_t Size>
+struct KAtomicOps;
+
+template <>
+struct KAtomicOps<1>
+{
+    typedef char R;
+
+    static R Load(volatile R* p) { return *p; }
+    static void Store(volatile R* p, R value) { *p = value; }
+    static R Exchange(volatile R* p, R value) { return _InterlockedExchange8(p, value); }
+    static R CompareExchange(volatile R* p, R value, R comparand)
+        { return _InterlockedCompareExchange8(p, value, comparand); }
+    static R FetchAdd(volatile R* p, R value) { return _InterlockedExchangeAdd8(p, value); }
+    static R FetchAnd(volatile R* p, R value) { return _InterlockedAnd8(p, value); }
+    static R FetchOr(volatile R* p, R value) { return _InterlockedOr8(p, value); }
+    static R FetchXor(volatile R* p, R value) { return _InterlockedXor8(p, value); }
+};
+
+template <>
+struct KAtomicOps<2>
+{
+    typedef short R;
+
+    static R Load(volatile R* p) { return *p; }
+    static void Store(volatile R* p, R value) { *p = value; }
+    static R Exchange(volatile R* p, R value) { return _InterlockedExchange16(p, value); }
+    static R CompareExchange(volatile R* p, R value, R comparand)
+        { return _InterlockedCompareExchange16(p, value, comparand); }
+    static R FetchAdd(volatile R* p, R value) { return _InterlockedExchangeAdd16(p, value); }
+    static R FetchAnd(volatile R* p, R value) { return _InterlockedAnd16(p, value); }
+    static R FetchOr(volatile R* p, R value) { return _InterlockedOr16(p, value); }
+    static R FetchXor(volatile R* p, R value) { return _InterlockedXor16(p, value); }
+};
+
+template <>
+struct KAtomicOps<4>
+{
+    typedef long R;
+
+    static R Load(volatile R* p) { return *p; }
+    static void Store(volatile R* p, R value) { *p = value; }
+    static R Exchange(volatile R* p, R value) { return _InterlockedExchange(p, value); }
+    static R CompareExchange(volatile R* p, R value, R comparand)
+        { return _InterlockedCompareExchange(p, value, comparand); }
+    static R FetchAdd(volatile R* p, R value) { return _InterlockedExchangeAdd(p, value); }
+    static R FetchAnd(volatile R* p, R value) { return _InterlockedAnd(p, value); }
+    static R FetchOr(volatile R* p, R value) { return _InterlockedOr(p, value); }
+    static R FetchXor(volatile R* p, R value) { return _InterlockedXor(p, value); }
+};
+
+template <>
+struct KAtomicOps<8>
+{
+    typedef __int64 R;
+
+    //FUTURE: x64 can use plain moves and the 64-bit intrinsics for all of these.
+    static R Load(volatile R* p)
+    {
+        // a compare exchange which (almost) never matches just reads the value atomically. When it
+        // does match, it writes back the 0 that was already there.
+        return _InterlockedCompareExchange64(p, 0, 0);
+    }
+
+    static void Store(volatile R* p, R value)
+    {
+        Exchange(p, value);
+    }
+
+    static R Exchange(volatile R* p, R value)
+    {
+        R current = *p;
+        for (;;)
+        {
+            const R previous = _InterlockedCompareExchange64(p, value, current);
+            if (previous == current)
+            {
+                return previous;
+            }
+
+            current = previous;
+        }
+    }
+
+    static R CompareExchange(volatile R* p, R value, R comparand)
+        { return _InterlockedCompareExchange64(p, value, comparand); }
+
+    static R FetchAdd(volatile R* p, R value)
+    {
+        R current = *p;
+        for (;;)
+        {
+            const R previous = _InterlockedCompareExchange64(p, current + value, current);
+            if (previous == current)
+            {
+                return previous;
+            }
+
+            current = previous;
+        }
+    }
+
+    static R FetchAnd(volatile R* p, R value)
+    {
+        R current = *p;
+        for (;;)
+        {
+            const R previous = _InterlockedCompareExchange64(p, current & value, current);
+            if (previous == current)
+            {
+                return previous;
+            }
+
+            current = previous;
+        }
+    }
+
+    static R FetchOr(volatile R* p, R value)
+    {
+        R current = *p;
+        for (;;)
+        {
+            const R previous = _InterlockedCompareExchange64(p, current | value, current);
+            if (previous == current)
+            {
+                return previous;
+            }
+
+            current = previous;
+        }
+    }
+
+    static R FetchXor(volatile R* p, R value)
+    {
+        R current = *p;
+        for (;;)
+        {
+            const R previous = _InterlockedCompareExchange64(p, current ^ value, current);
+            if (previous == current)
+            {
+                return previous;
+            }
+
+            current = previous;
+        }
+    }
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A value of type T which can be accessed from many processors at once.
+//!
+//! \details
+//! Like std::atomic, it's constant-initialized, so it works as a global before constructors run.
+//! Zeroed memory holds a katomic of 0 (or null, or false).
+//-------------------------------------------------------------------------------------------------
+template <class T>
+class katomic
+{
+    typedef KAtomicOps<sizeof(T)> Ops;
+    typedef typename Ops::R R;
+
+public:
+    constexpr katomic()
+        : m_value{}
+    { }
+
+    constexpr katomic(T value)
+        : m_value{ value }
+    { }
+
+    katomic(const katomic&) = delete;
+    katomic& operator=(const katomic&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Reads the value. May be relaxed, acquire or seq_cst.
+    //---------------------------------------------------------------------------------------------
+    T load(memory_order order = memory_order::seq_cst) const
+    {
+        (void)order;
+
+        // a seq_cst load is a plain load too, as the seq_cst stores are the ones with the fence.
+        const R value = Ops::Load(Rep());
+        _ReadWriteBarrier();
+        return FromRep(value);
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Writes the value. May be relaxed, release or seq_cst.
+    //---------------------------------------------------------------------------------------------
+    void store(T value, memory_order order = memory_order::seq_cst)
+    {
+        if (order == memory_order::seq_cst)
+        {
+            Ops::Exchange(Rep(), ToRep(value));
+            return;
+        }
+
+        _ReadWriteBarrier();
+        Ops::Store(Rep(), ToRep(value));
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Writes the value, and returns the one it replaced. Always seq_cst.
+    //---------------------------------------------------------------------------------------------
+    T exchange(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::Exchange(Rep(), ToRep(value)));
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Writes desired if the value is expected. Always seq_cst.
+    //!
+    //! \param  expected  The value to compare against. Receives the value seen on failure.
+    //! \param  desired   The value to write.
+    //!
+    //! \returns  True if desired was written, or false if the value wasn't expected.
+    //---------------------------------------------------------------------------------------------
+    bool compare_exchange(_Inout_ T& expected, T desired, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+
+        const R comparand = ToRep(expected);
+        const R previous = Ops::CompareExchange(Rep(), ToRep(desired), comparand);
+
+        if (previous == comparand)
+        {
+            return true;
+        }
+
+        expected = FromRep(previous);
+        return false;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  The arithmetic and bitwise read-modify-writes. Each returns the previous value, and
+    //!         is always seq_cst.
+    //---------------------------------------------------------------------------------------------
+    T fetch_add(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::FetchAdd(Rep(), ToRep(value)));
+    }
+
+    T fetch_sub(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::FetchAdd(Rep(), (R)(0 - ToRep(value))));
+    }
+
+    T fetch_and(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::FetchAnd(Rep(), ToRep(value)));
+    }
+
+    T fetch_or(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::FetchOr(Rep(), ToRep(value)));
+    }
+
+    T fetch_xor(T value, memory_order order = memory_order::seq_cst)
+    {
+        (void)order;
+        return FromRep(Ops::FetchXor(Rep(), ToRep(value)));
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  The address of the value, for code (or hardware) which waits on it directly.
+    //---------------------------------------------------------------------------------------------
+    const volatile void* address() const
+    {
+        return &m_value;
+    }
+
+private:
+    volatile R* Rep() const
+    {
+        return reinterpret_cast<volatile R*>(&m_value);
+    }
+
+    static R ToRep(T value)
+    {
+        R rep;
+        memcpy(&rep, &value, sizeof(rep));
+        return rep;
+    }
+
+    static T FromRep(R rep)
+    {
+        T value;
+        memcpy(&value, &rep, sizeof(value));
+        return value;
+    }
+
+    static_assert(sizeof(T) == sizeof(R), "katomic needs a value of 1, 2, 4 or 8 bytes");
+
+    alignas(sizeof(T)) mutable volatile T m_value;
+};
+
+#endif // __cplusplus
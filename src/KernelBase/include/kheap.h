@@ -0,0 +1,75 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for the demand-faulted kernel heap region.
+//!
+//! \details
+//! Reserving heap memory only sets aside addresses - no frames are allocated and nothing is
+//! mapped. Each page is backed by a zeroed frame the first time it's touched, from the page
+//! fault handler. Large reservations are therefore nearly free, and the memory actually used
+//! tracks what's been touched rather than what's been reserved.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Counters for the heap region.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_KheapStats
+{
+    uint32_t reservedPages;     //!< Pages currently reserved.
+    uint32_t committedPages;    //!< Pages currently backed by a frame.
+    uint32_t faultCount;        //!< Faults handled since boot.
+    uint32_t failedFaults;      //!< Faults in a reserved page which couldn't be backed.
+    uint64_t faultCycles;       //!< Total cycles spent handling faults.
+    uint64_t maxFaultCycles;    //!< Longest time spent handling a single fault, in cycles.
+} KheapStats;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes the heap region. Requires paging and the IDT to be set up.
+//!
+//! \returns  True on success, or false on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool kheapInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Reserves a range of the heap region. Its pages are backed when they're first touched.
+//!
+//! \param  cb  The number of bytes to reserve. This is rounded up to a whole number of pages.
+//!
+//! \returns  A pointer to the reserved range, or null if there isn't enough address space left.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+void* kheapReserve(size_t cb);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases a range reserved with kheapReserve, and frees whichever pages were backed.
+//!
+//! \param  ptr  The pointer returned by kheapReserve. May be null.
+//-------------------------------------------------------------------------------------------------
+void kheapRelease(_In_opt_ void* ptr);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Handles a page fault, if it's in a reserved page of the heap region.
+//!
+//! \param  address     The faulting address.
+//! \param  wasPresent  Whether the page was present (i.e. the fault was a protection violation).
+//!
+//! \returns  True if the page is now backed and the access can be retried, or false if the fault
+//!           is somebody else's problem.
+//-------------------------------------------------------------------------------------------------
+_Check_return_
+bool kheapHandleFault(uintptr_t address, bool wasPresent);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the heap region's counters.
+//-------------------------------------------------------------------------------------------------
+void kheapGetStats(_Out_ KheapStats* stats);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,75 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for temporary mappings of physical frames.
+//!
+//! \details
+//! Each processor owns a handful of fixed virtual pages (see VM_FixmapBase), which are used as a
+//! stack: kmapAtomic points the next free slot at a frame, and kunmapAtomic clears it again with
+//! a single invlpg. The slots are never shared between processors, so no lock and no TLB
+//! shootdown is needed, and an interrupt handler can use them as long as it releases its slots
+//! before returning.
+//!
+//! Frames inside the direct map don't need a slot at all, so they are returned from there. Only
+//! frames in high memory, above the direct map (from pmAllocateFrame, on machines with more than
+//! VM_DirectMapSize of memory), take a slot.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    KMAP_SlotsPerCpu = 16,      //!< The number of temporary mappings a processor can hold at once.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Reserves the page table for the temporary mapping slots. Requires paging to be enabled.
+//!
+//! \returns  True on success, or false on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool kmapInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Temporarily maps a physical frame.
+//!
+//! \param  frame  The physical address of the frame. Must be page-aligned.
+//!
+//! \returns  The virtual address of the frame, or null if the frame isn't aligned or this
+//!           processor has no free slots.
+//!
+//! \note   Mappings must be released with kunmapAtomic in the reverse order they were made, and
+//!         on the same processor. The thread isn't preempted while it holds one, and mustn't
+//!         block.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+void* kmapAtomic(uintptr_t frame);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases a mapping made with kmapAtomic.
+//!
+//! \param  ptr  The pointer returned by kmapAtomic.
+//-------------------------------------------------------------------------------------------------
+void kunmapAtomic(_In_ void* ptr);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Fills a physical frame with zeros.
+//!
+//! \returns  True on success, or false if the frame couldn't be mapped.
+//-------------------------------------------------------------------------------------------------
+_Success_(return != false)
+bool kmapZeroFrame(uintptr_t frame);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Copies the contents of one physical frame to another.
+//!
+//! \returns  True on success, or false if either frame couldn't be mapped.
+//-------------------------------------------------------------------------------------------------
+_Success_(return != false)
+bool kmapCopyFrame(uintptr_t destFrame, uintptr_t sourceFrame);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,49 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Kernel-mode new
+//!
+//! \details
+//! There is no global heap in the kernel, so only the placement forms of new and delete are
+//! provided. Types which need dynamic storage get it from a pool or an arena.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "kstddef.h"
+
+#ifdef __cplusplus
+
+// MSVC's <new> guards its placement new with these - define them so the two can coexist.
+#ifndef __PLACEMENT_NEW_INLINE
+#define __PLACEMENT_NEW_INLINE
+
+inline void* operator new(size_t cb, void* ptr) noexcept
+{
+    NOS_UNUSED_PARAM(cb);
+    return ptr;
+}
+
+inline void operator delete(void* ptr, void* place) noexcept
+{
+    NOS_UNUSED_PARAM(ptr);
+    NOS_UNUSED_PARAM(place);
+}
+
+#endif // __PLACEMENT_NEW_INLINE
+
+#ifndef __PLACEMENT_VEC_NEW_INLINE
+#define __PLACEMENT_VEC_NEW_INLINE
+
+inline void* operator new[](size_t cb, void* ptr) noexcept
+{
+    NOS_UNUSED_PARAM(cb);
+    return ptr;
+}
+
+inline void operator delete[](void* ptr, void* place) noexcept
+{
+    NOS_UNUSED_PARAM(ptr);
+    NOS_UNUSED_PARAM(place);
+}
+
+#endif // __PLACEMENT_VEC_NEW_INLINE
+
+#endif // __cplusplus
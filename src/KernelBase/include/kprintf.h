@@ -3,14 +3,22 @@
 //-------------------------------------------------------------------------------------------------
 #pragma once
 #include "nosbase.h"
+#include "kstddef.h"
 #include "kstdargs.h"
 #include "sal.h"
 
 NOS_EXTERN_C
 
+//-------------------------------------------------------------------------------------------------
+//! \brief  Where kprintf's output goes. kvprintf gathers output in a small buffer, and hands it
+//!         over a run at a time - to writeN if there is one, or else to write a character at a
+//!         time.
+//-------------------------------------------------------------------------------------------------
 typedef struct tag_kprintf_stream
 {
     void (*write)(char ch);
+    void (*writeN)(_In_reads_(count) const char* chars, size_t count);  //!< Optional.
+    void (*flush)(void);            //!< Optional; called once the whole output has been written.
 } kprintf_stream;
 
 
@@ -4,9 +4,21 @@
 //-------------------------------------------------------------------------------------------------
 #pragma once
 #include "nosbase.h"
+#include "kstdint.h"
 
 NOS_EXTERN_C
 
 int nos_krt_init(void);
 
+//! Bits of nos_cpu_features, detected by nos_krt_init.
+enum // nos_cpu_features
+{
+    nos_cpu_TSC = (1 << 0),             //!< rdtsc is supported.
+    nos_cpu_InvariantTSC = (1 << 1),    //!< The TSC ticks at a constant rate in every P/C-state.
+    nos_cpu_Mwait = (1 << 2),           //!< monitor/mwait are supported, and mwait can be woken by
+                                        //!< interrupts while they're disabled.
+};
+
+extern uint32_t nos_cpu_features;
+
 NOS_END_EXTERN_C
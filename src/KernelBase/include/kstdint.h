@@ -175,6 +175,8 @@ typedef int32_t     ptrdiff_t;
 typedef int32_t     __signed_size_t;
 typedef uint32_t    __unsigned_ptrdiff_t;
 
+#define SIZE_MAX    UINT32_MAX
+
 #elif NOS_PTR_SIZE == NOS_PTR_SIZE_64BIT
 
 typedef uint64_t    size_t;
@@ -183,6 +185,8 @@ typedef int64_t     ptrdiff_t;
 typedef int64_t     __signed_size_t;
 typedef uint64_t    __unsigned_ptrdiff_t;
 
+#define SIZE_MAX    UINT64_MAX
+
 #else
 #error Unsupported platform!
 #endif
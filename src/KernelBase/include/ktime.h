@@ -0,0 +1,58 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for the kernel's high-resolution monotonic clock.
+//!
+//! \details
+//! The clock counts processor timestamp counter (TSC) cycles, calibrated once at boot against a
+//! timer with a known rate. Reading it costs an rdtsc and a multiply, so it's cheap enough for
+//! benchmarks and latency counters in hot paths.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Calibrates the TSC and starts the clock at 0. Uses the HPET if ACPI has found one,
+//!         or the PIT otherwise.
+//!
+//! \returns  True on success, or false if the processor has no TSC.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool ktimeInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of nanoseconds since ktimeInitialize.
+//-------------------------------------------------------------------------------------------------
+uint64_t ktimeNowNs(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Converts a number of TSC cycles (such as the difference of two __rdtsc values) to
+//!         nanoseconds.
+//-------------------------------------------------------------------------------------------------
+uint64_t ktimeCyclesToNs(uint64_t cycles);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Converts a number of nanoseconds to TSC cycles.
+//-------------------------------------------------------------------------------------------------
+uint64_t ktimeNsToCycles(uint64_t ns);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the measured TSC frequency, in Hz.
+//-------------------------------------------------------------------------------------------------
+uint64_t ktimeTscFrequency(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether the TSC is invariant, and can be trusted across power state changes.
+//-------------------------------------------------------------------------------------------------
+bool ktimeTscIsInvariant(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the name of the timer the TSC was calibrated against.
+//-------------------------------------------------------------------------------------------------
+_Ret_z_
+const char* ktimeCalibrationSource(void);
+
+NOS_END_EXTERN_C
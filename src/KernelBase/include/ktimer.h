@@ -0,0 +1,105 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for kernel timers.
+//!
+//! \details
+//! Timers are kept on a hierarchical timing wheel, so arming and cancelling one takes constant
+//! time no matter how many are armed. There's no periodic tick: the hardware timer is programmed
+//! for the next deadline only, and stopped when no timers are armed.
+//!
+//! Each processor has a wheel of its own. A timer expires on the processor which armed it, and
+//! can be cancelled or rearmed from any processor.
+//!
+//! Timers have a resolution of TIMER_TickNs, and always fire at or after their deadline.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    TIMER_TickNs = 1000000,         //!< The resolution of timer deadlines (1ms).
+};
+
+struct tag_Timer;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Called when a timer expires. Runs from the timer softirq, with interrupts enabled.
+//!
+//! \param  timer    The timer which expired. It's no longer armed, so it may be rearmed.
+//! \param  context  The context passed to timerSetup.
+//-------------------------------------------------------------------------------------------------
+typedef void (*TimerCallback)(_Inout_ struct tag_Timer* timer, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A timer. The storage is owned by the caller, and must stay valid while it's armed.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Timer
+{
+    struct tag_Timer* next;     //!< Next timer in the same wheel slot.
+    struct tag_Timer* prev;     //!< Previous timer in the same wheel slot (null if not armed).
+    uint64_t expires;           //!< The tick the timer expires on.
+    uint32_t wheel;             //!< The processor whose wheel the timer was last armed on.
+    TimerCallback callback;
+    void* context;
+} Timer;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Counters for the timer subsystem.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_TimerStats
+{
+    uint32_t armedCount;        //!< Timers currently armed.
+    uint32_t firedCount;        //!< Timers which have expired since boot.
+    uint32_t interruptCount;    //!< Timer interrupts taken since boot.
+    uint32_t cascadeCount;      //!< Timers moved to a lower level of the wheel since boot.
+} TimerStats;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes the timer subsystem. Requires ktime, and the IDT (and APICs, if present).
+//!         Expired timers are handled from the SOFTIRQ_Timer softirq.
+//!
+//! \returns  True on success, or false if there's no usable timer interrupt.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool timerInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a timer. This must be done before it's armed for the first time.
+//-------------------------------------------------------------------------------------------------
+void timerSetup(_Out_ Timer* timer, _In_ TimerCallback callback, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Arms a timer, or moves its deadline if it's already armed.
+//!
+//! \param  timer    The timer to arm.
+//! \param  delayNs  How long from now the timer should expire, in nanoseconds.
+//-------------------------------------------------------------------------------------------------
+void timerArm(_Inout_ Timer* timer, uint64_t delayNs);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Disarms a timer.
+//!
+//! \returns  True if the timer was armed, or false if it had already expired (or was never armed).
+//-------------------------------------------------------------------------------------------------
+bool timerCancel(_Inout_ Timer* timer);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether a timer is armed.
+//-------------------------------------------------------------------------------------------------
+inline bool timerIsArmed(_In_ const Timer* timer)
+{
+    return (timer->prev != NULL);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the timer subsystem's counters.
+//-------------------------------------------------------------------------------------------------
+void timerGetStats(_Out_ TimerStats* stats);
+
+NOS_END_EXTERN_C
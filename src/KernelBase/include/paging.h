@@ -0,0 +1,113 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for virtual memory (paging) management.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "vmlayout.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Attributes of a virtual memory mapping.
+//-------------------------------------------------------------------------------------------------
+_Enum_is_bitflag_
+enum VmMapFlags
+{
+    VMF_None         = 0,
+    VMF_Writable     = (1 << 0),    //!< The mapping can be written.
+    VMF_User         = (1 << 1),    //!< The mapping can be accessed from user mode.
+    VMF_WriteThrough = (1 << 2),    //!< Writes go straight through the cache.
+    VMF_NoCache      = (1 << 3),    //!< The mapping isn't cached (device memory).
+    VMF_Global       = (1 << 4),    //!< The mapping is the same in every address space.
+
+    VMF_KernelData   = VMF_Writable | VMF_Global,
+    VMF_Device       = VMF_Writable | VMF_NoCache | VMF_Global,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Builds the kernel's page tables and enables paging.
+//!
+//! \details
+//! Physical memory (up to the size of the direct map) is mapped both at its own address and at
+//! VM_DirectMapBase, using large pages where the processor supports them. The first page is left
+//! unmapped so null pointer accesses fault.
+//!
+//! \returns  True on success, or false on failure. Paging is left disabled on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool vmInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Maps a range of physical pages to a range of virtual addresses.
+//!
+//! \param  virtualAddress   The page aligned virtual address to map at.
+//! \param  physicalAddress  The page aligned physical address to map.
+//! \param  pageCount        The number of pages to map.
+//! \param  flags            A combination of VmMapFlags values.
+//!
+//! \returns  True on success, or false if a page table couldn't be allocated or part of the
+//!           range is covered by a large page. On failure the range's mappings are left as
+//!           they were, including any that existed before the call.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool vmMap(
+    _In_ void* virtualAddress,
+    uintptr_t physicalAddress,
+    uint32_t pageCount,
+    uint32_t flags
+);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Removes the mappings of a range of virtual addresses.
+//!
+//! \details
+//! The TLB is flushed once for the whole range after all of the entries have been cleared;
+//! large ranges flush the entire TLB instead of invalidating page by page. The other processors
+//! flush theirs before this returns.
+//!
+//! \param  virtualAddress  The page aligned virtual address to unmap.
+//! \param  pageCount       The number of pages to unmap.
+//-------------------------------------------------------------------------------------------------
+void vmUnmap(_In_ void* virtualAddress, uint32_t pageCount);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Removes the mappings of a range of virtual addresses, and frees the frames they mapped
+//!         once no processor's TLB can still reach them.
+//!
+//! \param  virtualAddress  The page aligned virtual address to unmap.
+//! \param  pageCount       The number of pages to unmap.
+//!
+//! \returns  The number of frames freed.
+//-------------------------------------------------------------------------------------------------
+uint32_t vmUnmapAndFree(_In_ void* virtualAddress, uint32_t pageCount);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Looks up the physical address a virtual address is mapped to.
+//!
+//! \param       virtualAddress   The address to look up.
+//! \param[out]  physicalAddress  Receives the physical address.
+//!
+//! \returns  True if the address is mapped, or false otherwise.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool vmTranslate(_In_ const void* virtualAddress, _Out_ uintptr_t* physicalAddress);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the address of a physical address in the direct map.
+//!
+//! \returns  The direct mapped address, or null if the physical address is beyond the direct map.
+//-------------------------------------------------------------------------------------------------
+_Ret_maybenull_
+void* vmPhysToVirt(uintptr_t physicalAddress);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the amount of physical memory covered by the direct map.
+//-------------------------------------------------------------------------------------------------
+uintptr_t vmDirectMapLimit(void);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,95 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines per-CPU statistics counters.
+//!
+//! \details
+//! A counter has a slot in every processor's CpuData, so updating it is a single fs-relative add
+//! to a cache line no other processor writes: no locked instruction, and no line bouncing between
+//! processors however hot the counter is. The add is one instruction, so an interrupt can't split
+//! it. Reading a counter sums its slot across the processors.
+//!
+//! \code
+//! PERCPU_COUNTER(pmPagesAllocated);
+//! ...
+//! percpuAdd(&pmPagesAllocated, pageCount);
+//! \endcode
+//!
+//! PERCPU_COUNTER puts a pointer to the counter in the .pcpu$m section, which the linker places
+//! between krtinit's .pcpu$a and .pcpu$z markers; nos_krt_init gives each counter it finds there
+//! a slot. Until then (or if the slots run out) a counter uses slot 0, which is never read.
+//!
+//! The slots are 32 bits per processor, so counters are for events and pages rather than bytes.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "cpu.h"
+#include "kprintf.h"
+#include "intrin.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A per-CPU counter. Defined with PERCPU_COUNTER.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_PercpuCounter
+{
+    const char* name;
+    uint32_t slot;              //!< The counter's index in CpuData::counters; 0 if it has none.
+} PercpuCounter;
+
+#pragma section(".pcpu$m", long, read)
+
+//! \brief  Defines a counter, and registers it to be given a slot by nos_krt_init. Used at file
+//!         scope, with C linkage; the /include keeps whole program optimization from dropping the
+//!         registration, which nothing refers to.
+#define PERCPU_COUNTER(name) \
+    PercpuCounter name = { #name, 0 }; \
+    __declspec(allocate(".pcpu$m")) PercpuCounter* name##Registration = &name; \
+    __pragma(comment(linker, "/include:_" #name "Registration"))
+
+//! \brief  Declares a counter defined with PERCPU_COUNTER in another file.
+#define PERCPU_COUNTER_DECLARE(name) \
+    extern PercpuCounter name
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Adds to this processor's value of a counter. May be called from interrupt handlers.
+//-------------------------------------------------------------------------------------------------
+inline void percpuAdd(_In_ const PercpuCounter* counter, uint32_t value)
+{
+    __addfsdword(
+        (unsigned long)(offsetof(CpuData, counters) + counter->slot * sizeof(uint32_t)),
+        value
+    );
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Adds one to this processor's value of a counter. May be called from interrupt handlers.
+//-------------------------------------------------------------------------------------------------
+inline void percpuIncrement(_In_ const PercpuCounter* counter)
+{
+    __incfsdword((unsigned long)(offsetof(CpuData, counters) + counter->slot * sizeof(uint32_t)));
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gives a counter a slot. Called by nos_krt_init for every registered counter.
+//-------------------------------------------------------------------------------------------------
+void percpuRegisterCounter(_Inout_ PercpuCounter* counter);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a counter's total, summed over every processor. The processors' values are read
+//!         one at a time, so the total is only exact if the counter isn't changing.
+//!
+//! \returns  The total, or 0 if the counter has no slot.
+//-------------------------------------------------------------------------------------------------
+uint64_t percpuRead(_In_ const PercpuCounter* counter);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Prints every registered counter's total.
+//-------------------------------------------------------------------------------------------------
+void percpuPrint(_In_ const kprintf_stream* stream);
+
+NOS_END_EXTERN_C
@@ -96,7 +96,8 @@ void* pmAllocateBytes(
 );
 
 //-------------------------------------------------------------------------------------------------
-//! \brief  Allocates the given number of pages of contiguous physical memory.
+//! \brief  Allocates the given number of pages of contiguous physical memory. Only low memory
+//!         (inside the direct map) is used, so the result can be used as a pointer as is.
 //! 
 //! \param  pageCount  The number of pages to allocate.
 //! \param  hint       If not null, a position at which to try to allocate the
@@ -108,6 +109,17 @@ void* pmAllocateBytes(
 _Check_return_ _Success_(return != NULL)
 void* pmAllocatePages(uint32_t pageCount, _In_opt_ void* hint);
 
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allocates a single frame, from high memory (above the direct map) while there is any.
+//!         The frame has to be mapped, with vmMap or kmapAtomic, before it can be touched.
+//!
+//! \param  hint  If not 0, a frame to try first, so consecutive calls can get contiguous frames.
+//!
+//! \returns  The physical address of the frame, or 0 if there's no memory left.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != 0)
+uintptr_t pmAllocateFrame(uintptr_t hint);
+
 //-------------------------------------------------------------------------------------------------
 //! \brief  Frees the given number of pages at the given point in memory.
 //!
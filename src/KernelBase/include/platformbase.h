@@ -12,6 +12,8 @@
 //! | `NOS_PTR_SIZE`        | Provides the size of pointers (in bytes) of the target platform.  |
 //! | `NOS_PTR_USABLE_BITS` | Provides the number of bits that can be used in a pointer.        |
 //! | `NOS_PTR_MASK`        | Provides a mask of the usable bits in a pointer.                  |
+//! | `NOS_PAGE_SIZE`       | Provides the size (in bytes) of a page of memory.                 |
+//! | `NOS_CACHE_LINE_SIZE` | Provides the size (in bytes) of a data cache line.                |
 //-------------------------------------------------------------------------------------------------
 #pragma once
 
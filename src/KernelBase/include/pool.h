@@ -0,0 +1,418 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines fixed-size object pools for kernel objects.
+//!
+//! \details
+//! A pool hands out storage for objects of a single type from blocks of pages obtained from the
+//! physical memory manager. Free slots are threaded onto an intrusive free list, so allocating
+//! and freeing are both O(1) and never touch more than the slot itself.
+//!
+//! - `Pool<T, N>` holds at most N objects in a single contiguous block.
+//! - `GrowablePool<T>` takes another block whenever it runs out of free slots.
+//! - `PoolAllocated<T>` gives T class-specific operator new/delete backed by a GrowablePool.
+//!
+//! Pools are constant-initialized and don't take any pages until the first allocation, so they
+//! can be used as globals even though global constructors run before pmInitialize.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "knew.h"
+#include "physmem.h"
+#include "sal.h"
+
+#ifdef __cplusplus
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A free slot in a pool.
+//-------------------------------------------------------------------------------------------------
+struct PoolFreeNode
+{
+    PoolFreeNode* next;
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the distance between consecutive slots of a pool holding objects of type T.
+//-------------------------------------------------------------------------------------------------
+template <class T>
+constexpr size_t PoolSlotSize()
+{
+    constexpr size_t align = (alignof(T) > alignof(PoolFreeNode)) ? alignof(T) : alignof(PoolFreeNode);
+    constexpr size_t size = (sizeof(T) > sizeof(PoolFreeNode)) ? sizeof(T) : sizeof(PoolFreeNode);
+
+    return (size + (align - 1)) & ~(align - 1);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Threads the slots of a block onto a free list.
+//!
+//! \param  first      The first slot of the block.
+//! \param  slotSize   The distance between consecutive slots.
+//! \param  slotCount  The number of slots in the block.
+//! \param  tail       The free list to link the last slot to.
+//!
+//! \returns  The new head of the free list.
+//-------------------------------------------------------------------------------------------------
+inline PoolFreeNode* PoolThreadBlock(
+    _In_ void* first,
+    size_t slotSize,
+    size_t slotCount,
+    _In_opt_ PoolFreeNode* tail)
+{
+    uint8_t* slot = static_cast<uint8_t*>(first) + (slotCount - 1) * slotSize;
+    PoolFreeNode* head = tail;
+
+    for (size_t i = 0; i < slotCount; i++, slot -= slotSize)
+    {
+        PoolFreeNode* node = reinterpret_cast<PoolFreeNode*>(slot);
+        node->next = head;
+        head = node;
+    }
+
+    return head;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A pool of at most N objects of type T, stored in one contiguous block of pages.
+//-------------------------------------------------------------------------------------------------
+template <class T, size_t N>
+class Pool
+{
+    static_assert(N > 0, "Pool must have at least one slot");
+    static_assert(alignof(T) <= NOS_PAGE_SIZE, "Pool slots can't be aligned beyond a page");
+
+public:
+    constexpr Pool()
+        : m_block{ nullptr }
+        , m_freeList{ nullptr }
+        , m_count{ 0 }
+    { }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Allocates uninitialized storage for one object.
+    //!
+    //! \returns  The storage, or null if the pool is full or its block couldn't be allocated.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_ _Success_(return != nullptr)
+    T* Allocate()
+    {
+        if (m_freeList == nullptr
+            && (m_block != nullptr || !Reserve()))
+        {
+            return nullptr;
+        }
+
+        PoolFreeNode* node = m_freeList;
+        m_freeList = node->next;
+        m_count++;
+
+        return reinterpret_cast<T*>(node);
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Returns storage obtained from Allocate to the pool.
+    //---------------------------------------------------------------------------------------------
+    void Free(_In_ T* ptr)
+    {
+        //TODO: kassert(Contains(ptr));
+        PoolFreeNode* node = reinterpret_cast<PoolFreeNode*>(ptr);
+        node->next = m_freeList;
+        m_freeList = node;
+        m_count--;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Allocates and constructs an object.
+    //---------------------------------------------------------------------------------------------
+    template <class... Args>
+    _Check_return_ _Success_(return != nullptr)
+    T* New(Args&&... args)
+    {
+        void* storage = Allocate();
+        return (storage != nullptr)
+            ? new (storage) T(static_cast<Args&&>(args)...)
+            : nullptr;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Destroys an object created with New and returns its storage to the pool.
+    //---------------------------------------------------------------------------------------------
+    void Delete(_In_opt_ T* ptr)
+    {
+        if (ptr != nullptr)
+        {
+            ptr->~T();
+            Free(ptr);
+        }
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Returns the pool's pages to the physical memory manager. The pool must be empty.
+    //---------------------------------------------------------------------------------------------
+    void Release()
+    {
+        //TODO: kassert(m_count == 0);
+        if (m_block != nullptr)
+        {
+            pmFree(m_block, BlockPages);
+            m_block = nullptr;
+            m_freeList = nullptr;
+        }
+    }
+
+
+    bool Contains(_In_ const T* ptr) const
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(ptr);
+        const uint8_t* base = static_cast<const uint8_t*>(m_block);
+
+        return (m_block != nullptr)
+            && (p >= base)
+            && (p < base + N * SlotSize)
+            && ((p - base) % SlotSize) == 0;
+    }
+
+    size_t Count() const
+    {
+        return m_count;
+    }
+
+    static constexpr size_t Capacity()
+    {
+        return N;
+    }
+
+private:
+    static constexpr size_t SlotSize = PoolSlotSize<T>();
+    static constexpr uint32_t BlockPages = (uint32_t)((N * SlotSize + (NOS_PAGE_SIZE - 1)) / NOS_PAGE_SIZE);
+
+    bool Reserve()
+    {
+        m_block = pmAllocatePages(BlockPages, nullptr);
+        if (m_block == nullptr)
+        {
+            return false;
+        }
+
+        m_freeList = PoolThreadBlock(m_block, SlotSize, N, nullptr);
+        return true;
+    }
+
+    void* m_block;
+    PoolFreeNode* m_freeList;
+    size_t m_count;
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A pool of objects of type T which grows by BlockPages pages at a time.
+//!
+//! \details
+//! Each block starts with a cache line holding the link to the next block, so the slots in the
+//! block start on a cache line boundary. Blocks are only returned by Release.
+//-------------------------------------------------------------------------------------------------
+template <class T, uint32_t BlockPages = 1>
+class GrowablePool
+{
+    static_assert(BlockPages > 0, "GrowablePool blocks must have at least one page");
+
+public:
+    constexpr GrowablePool()
+        : m_blocks{ nullptr }
+        , m_freeList{ nullptr }
+        , m_count{ 0 }
+        , m_blockCount{ 0 }
+    { }
+
+    GrowablePool(const GrowablePool&) = delete;
+    GrowablePool& operator=(const GrowablePool&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Allocates uninitialized storage for one object.
+    //!
+    //! \returns  The storage, or null if the pool needed to grow and no pages were available.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_ _Success_(return != nullptr)
+    T* Allocate()
+    {
+        if (m_freeList == nullptr
+            && !Grow())
+        {
+            return nullptr;
+        }
+
+        PoolFreeNode* node = m_freeList;
+        m_freeList = node->next;
+        m_count++;
+
+        return reinterpret_cast<T*>(node);
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Returns storage obtained from Allocate to the pool.
+    //---------------------------------------------------------------------------------------------
+    void Free(_In_ T* ptr)
+    {
+        PoolFreeNode* node = reinterpret_cast<PoolFreeNode*>(ptr);
+        node->next = m_freeList;
+        m_freeList = node;
+        m_count--;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Allocates and constructs an object.
+    //---------------------------------------------------------------------------------------------
+    template <class... Args>
+    _Check_return_ _Success_(return != nullptr)
+    T* New(Args&&... args)
+    {
+        void* storage = Allocate();
+        return (storage != nullptr)
+            ? new (storage) T(static_cast<Args&&>(args)...)
+            : nullptr;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Destroys an object created with New and returns its storage to the pool.
+    //---------------------------------------------------------------------------------------------
+    void Delete(_In_opt_ T* ptr)
+    {
+        if (ptr != nullptr)
+        {
+            ptr->~T();
+            Free(ptr);
+        }
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Returns all of the pool's pages to the physical memory manager. The pool must be
+    //!         empty.
+    //---------------------------------------------------------------------------------------------
+    void Release()
+    {
+        //TODO: kassert(m_count == 0);
+        while (m_blocks != nullptr)
+        {
+            Block* next = m_blocks->next;
+            pmFree(m_blocks, BlockPages);
+            m_blocks = next;
+        }
+
+        m_freeList = nullptr;
+        m_blockCount = 0;
+    }
+
+
+    size_t Count() const
+    {
+        return m_count;
+    }
+
+    size_t BlockCount() const
+    {
+        return m_blockCount;
+    }
+
+    static constexpr size_t SlotsPerBlock()
+    {
+        return (BlockPages * NOS_PAGE_SIZE - sizeof(Block)) / PoolSlotSize<T>();
+    }
+
+private:
+    struct alignas(NOS_CACHE_LINE_SIZE) Block
+    {
+        Block* next;
+    };
+
+    bool Grow()
+    {
+        static_assert(alignof(T) <= NOS_CACHE_LINE_SIZE, "GrowablePool slots can't be aligned beyond a cache line");
+        static_assert(SlotsPerBlock() > 0, "GrowablePool blocks are too small to hold any objects");
+
+        Block* block = static_cast<Block*>(pmAllocatePages(BlockPages, nullptr));
+        if (block == nullptr)
+        {
+            return false;
+        }
+
+        block->next = m_blocks;
+        m_blocks = block;
+        m_blockCount++;
+
+        m_freeList = PoolThreadBlock(block + 1, PoolSlotSize<T>(), SlotsPerBlock(), m_freeList);
+        return true;
+    }
+
+    Block* m_blocks;
+    PoolFreeNode* m_freeList;
+    size_t m_count;
+    size_t m_blockCount;
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gives a class operator new and operator delete backed by a GrowablePool.
+//!
+//! \details
+//! Derive from this using the derived class as T:
+//!
+//!     class Thread : public PoolAllocated<Thread> { ... };
+//!
+//! operator new returns null when the pool is exhausted; since it's noexcept, the compiler skips
+//! the constructor in that case and the new-expression yields null. Classes further derived from
+//! T get null from operator new, since their objects don't fit in T's slots.
+//-------------------------------------------------------------------------------------------------
+template <class T, uint32_t BlockPages = 1>
+class PoolAllocated
+{
+public:
+    static void* operator new(size_t cb) noexcept
+    {
+        if (cb != sizeof(T))
+        {
+            return nullptr;
+        }
+
+        return s_pool.Allocate();
+    }
+
+    static void operator delete(void* ptr) noexcept
+    {
+        if (ptr != nullptr)
+        {
+            s_pool.Free(static_cast<T*>(ptr));
+        }
+    }
+
+    static void* operator new(size_t cb, void* ptr) noexcept
+    {
+        return ::operator new(cb, ptr);
+    }
+
+    static void operator delete(void* ptr, void* place) noexcept
+    {
+        ::operator delete(ptr, place);
+    }
+
+
+    static GrowablePool<T, BlockPages>& Pool()
+    {
+        return s_pool;
+    }
+
+private:
+    static GrowablePool<T, BlockPages> s_pool;
+};
+
+template <class T, uint32_t BlockPages>
+GrowablePool<T, BlockPages> PoolAllocated<T, BlockPages>::s_pool;
+
+#endif // __cplusplus
@@ -0,0 +1,82 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for quiescent-state-based reclamation (QSBR), a flavour of RCU.
+//!
+//! \details
+//! Read-mostly data is reached through a pointer. Readers load it (with acquire ordering) and use
+//! what it points to without taking locks or doing any locked instructions. A writer builds a new
+//! version, publishes it with a release store, and waits for a grace period (rcuSynchronize)
+//! before freeing or reusing the old one.
+//!
+//! A grace period ends once every other processor has passed through a quiescent state - a point
+//! where it can't be in the middle of a read. Each processor counts these in its own cache line:
+//!
+//! - switching threads,
+//! - returning from an outermost interrupt to code which had interrupts enabled.
+//!
+//! So readers are interrupt handlers, and code between rcuReadLock and rcuReadUnlock, which keeps
+//! interrupts (and with them, preemption) disabled. Processors which are halted or busy in code
+//! that doesn't switch threads get an IPI, whose return is a quiescent state.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "idt.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Grace period statistics, summed over every processor. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_RcuStats
+{
+    uint32_t graceCount;        //!< Grace periods waited for.
+    uint32_t kickCount;         //!< IPIs sent to processors which were slow to report.
+    uint64_t waitCycles;        //!< Total time spent waiting for grace periods.
+    uint64_t maxWaitCycles;
+} RcuStats;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Installs the handler for the IPIs sent to slow processors. Requires idtInitialize.
+//-------------------------------------------------------------------------------------------------
+void rcuInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts a read-side critical section outside of an interrupt handler.
+//!
+//! \returns  Whether interrupts were enabled, to pass to rcuReadUnlock.
+//-------------------------------------------------------------------------------------------------
+inline bool rcuReadLock(void)
+{
+    return idtDisableInterrupts();
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Ends a read-side critical section. Pointers read inside it mustn't be used after this.
+//-------------------------------------------------------------------------------------------------
+inline void rcuReadUnlock(bool enabled)
+{
+    idtRestoreInterrupts(enabled);
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Reports that the current processor isn't in a read-side critical section.
+//-------------------------------------------------------------------------------------------------
+void rcuQuiescentState(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Waits until every read-side critical section that was in progress when it was called
+//!         has ended. Anything unpublished before the call can be freed when it returns.
+//!
+//! \note   Mustn't be called from an interrupt handler or a read-side critical section, or with a
+//!         spinlock held which other processors might be spinning on.
+//-------------------------------------------------------------------------------------------------
+void rcuSynchronize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the grace period statistics.
+//-------------------------------------------------------------------------------------------------
+void rcuGetStats(_Out_ RcuStats* stats);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,296 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines lock-free bounded ring queues for passing messages between processors.
+//!
+//! \details
+//! - `SpscRing<T, N>` has one producer and one consumer. Each side keeps its own index in a cache
+//!   line of its own, plus a cached copy of the other side's. It only rereads the real one when
+//!   the cached copy says the ring is full (or empty), so in steady state the two processors each
+//!   touch only the slots themselves.
+//! - `MpscRing<T, N>` has any number of producers and one consumer. It's Dmitry Vyukov's bounded
+//!   queue: every slot has a sequence number saying whose turn it is, so producers only contend
+//!   on claiming slots, and the consumer needs no locked instructions at all.
+//!
+//! The batch operations claim or publish a whole run of slots with one index update, so the cost
+//! of the shared cache line is paid once per batch rather than once per message.
+//!
+//! N must be a power of 2. T is copied by assignment, so it should be small - a pointer, or a
+//! couple of words.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "katomic.h"
+#include "sal.h"
+
+#ifdef __cplusplus
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A single-producer, single-consumer ring of N items of type T.
+//-------------------------------------------------------------------------------------------------
+template <class T, uint32_t N>
+class SpscRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+
+public:
+    constexpr SpscRing()
+        : m_tail{ 0 }
+        , m_cachedHead{ 0 }
+        , m_head{ 0 }
+        , m_cachedTail{ 0 }
+        , m_items{}
+    { }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Adds items to the ring. Only called by the producer.
+    //!
+    //! \param  items  The items to add.
+    //! \param  count  The number of items.
+    //!
+    //! \returns  The number of items added, which is less than count if the ring filled up.
+    //---------------------------------------------------------------------------------------------
+    uint32_t Push(_In_reads_(count) const T* items, uint32_t count)
+    {
+        const uint32_t tail = m_tail.load(memory_order::relaxed);
+
+        if (N - (tail - m_cachedHead) < count)
+        {
+            m_cachedHead = m_head.load(memory_order::acquire);
+        }
+
+        const uint32_t space = N - (tail - m_cachedHead);
+        const uint32_t pushed = (count < space) ? count : space;
+
+        for (uint32_t i = 0; i < pushed; i++)
+        {
+            m_items[(tail + i) & (N - 1)] = items[i];
+        }
+
+        // the consumer sees the items before it sees the new tail.
+        m_tail.store(tail + pushed, memory_order::release);
+        return pushed;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Adds an item to the ring. Only called by the producer.
+    //!
+    //! \returns  True on success, or false if the ring is full.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_
+    bool Push(const T& item)
+    {
+        return Push(&item, 1) == 1;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Removes items from the ring, oldest first. Only called by the consumer.
+    //!
+    //! \param  items  Receives the items.
+    //! \param  max    The most items to remove.
+    //!
+    //! \returns  The number of items removed.
+    //---------------------------------------------------------------------------------------------
+    uint32_t Pop(_Out_writes_to_(max, return) T* items, uint32_t max)
+    {
+        const uint32_t head = m_head.load(memory_order::relaxed);
+
+        if (m_cachedTail - head < max)
+        {
+            m_cachedTail = m_tail.load(memory_order::acquire);
+        }
+
+        const uint32_t available = m_cachedTail - head;
+        const uint32_t popped = (max < available) ? max : available;
+
+        for (uint32_t i = 0; i < popped; i++)
+        {
+            items[i] = m_items[(head + i) & (N - 1)];
+        }
+
+        // the producer doesn't reuse the slots until the items have been copied out.
+        m_head.store(head + popped, memory_order::release);
+        return popped;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Removes the oldest item from the ring. Only called by the consumer.
+    //!
+    //! \returns  True on success, or false if the ring is empty.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_
+    bool Pop(_Out_ T* item)
+    {
+        return Pop(item, 1) == 1;
+    }
+
+private:
+    // the indexes count up forever; they wrap together, and only their differences are used.
+    alignas(NOS_CACHE_LINE_SIZE) katomic<uint32_t> m_tail;  //!< Written by the producer.
+    uint32_t m_cachedHead;                                  //!< The producer's copy of m_head.
+
+    alignas(NOS_CACHE_LINE_SIZE) katomic<uint32_t> m_head;  //!< Written by the consumer.
+    uint32_t m_cachedTail;                                  //!< The consumer's copy of m_tail.
+
+    alignas(NOS_CACHE_LINE_SIZE) T m_items[N];
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A multiple-producer, single-consumer ring of N items of type T.
+//-------------------------------------------------------------------------------------------------
+template <class T, uint32_t N>
+class MpscRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "MpscRing size must be a power of 2");
+
+    //! \brief  A slot. Its sequence number is the index it's free for, or one more once the item
+    //!         is in it. Only the lap is stored (the sequence less the slot's position), so that
+    //!         an all-zero ring is an empty one.
+    struct Cell
+    {
+        katomic<uint32_t> lap;
+        T item;
+    };
+
+public:
+    constexpr MpscRing()
+        : m_tail{ 0 }
+        , m_head{ 0 }
+        , m_cells{}
+    { }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Adds items to the ring, as one run. May be called by any processor.
+    //!
+    //! \param  items  The items to add.
+    //! \param  count  The number of items. At most N.
+    //!
+    //! \returns  True on success, or false (with nothing added) if there isn't room for them all.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_
+    bool Push(_In_reads_(count) const T* items, uint32_t count)
+    {
+        if (count == 0)
+        {
+            return true;
+        }
+
+        uint32_t tail = m_tail.load(memory_order::relaxed);
+
+        for (;;)
+        {
+            // the consumer frees slots in order, so if the last slot of the run is free, so are
+            // the ones before it.
+            const uint32_t index = tail + count - 1;
+            const int32_t difference = (int32_t)(Sequence(index) - index);
+
+            if (difference == 0)
+            {
+                if (m_tail.compare_exchange(tail, tail + count))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                // another producer claimed the slots first.
+                tail = m_tail.load(memory_order::relaxed);
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            Cell* cell = &m_cells[(tail + i) & (N - 1)];
+            cell->item = items[i];
+            SetSequence(tail + i, tail + i + 1);
+        }
+
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Adds an item to the ring. May be called by any processor.
+    //!
+    //! \returns  True on success, or false if the ring is full.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_
+    bool Push(const T& item)
+    {
+        return Push(&item, 1);
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Removes items from the ring, oldest first. Only called by the consumer.
+    //!
+    //! \param  items  Receives the items.
+    //! \param  max    The most items to remove.
+    //!
+    //! \returns  The number of items removed. This stops early at a slot which has been claimed
+    //!           by a producer that hasn't finished filling it in.
+    //---------------------------------------------------------------------------------------------
+    uint32_t Pop(_Out_writes_to_(max, return) T* items, uint32_t max)
+    {
+        uint32_t head = m_head;
+        uint32_t popped = 0;
+
+        while (popped < max)
+        {
+            if (Sequence(head) != head + 1)
+            {
+                break;
+            }
+
+            items[popped++] = m_cells[head & (N - 1)].item;
+
+            // hand the slot to the producer which will claim it on the next lap.
+            SetSequence(head, head + N);
+            head++;
+        }
+
+        m_head = head;
+        return popped;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Removes the oldest item from the ring. Only called by the consumer.
+    //!
+    //! \returns  True on success, or false if the ring is empty.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_
+    bool Pop(_Out_ T* item)
+    {
+        return Pop(item, 1) == 1;
+    }
+
+private:
+    uint32_t Sequence(uint32_t index) const
+    {
+        return m_cells[index & (N - 1)].lap.load(memory_order::acquire) + (index & (N - 1));
+    }
+
+    void SetSequence(uint32_t index, uint32_t sequence)
+    {
+        m_cells[index & (N - 1)].lap.store(sequence - (index & (N - 1)), memory_order::release);
+    }
+
+    alignas(NOS_CACHE_LINE_SIZE) katomic<uint32_t> m_tail;  //!< The next index to claim.
+    alignas(NOS_CACHE_LINE_SIZE) uint32_t m_head;           //!< Only used by the consumer.
+    alignas(NOS_CACHE_LINE_SIZE) Cell m_cells[N];
+};
+
+#endif // __cplusplus
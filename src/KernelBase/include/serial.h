@@ -0,0 +1,44 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines an interface to the first serial port (COM1), for kernel output.
+//!
+//! \details
+//! Output is polled: a writer waits for the UART's transmit FIFO to empty, then fills it. Writing
+//! a run of characters at once polls once per FIFO's worth rather than once per character.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "kprintf.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    SERIAL_Com1Port = 0x3F8,        //!< The first of COM1's IO ports.
+    SERIAL_BaudRate = 115200,
+    SERIAL_FifoSize = 16,           //!< The transmit FIFO of a 16550A.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up COM1 for 8N1 at SERIAL_BaudRate, with its FIFOs on and its interrupts off.
+//!
+//! \returns  True on success, or false if there's no working UART there. Output is then dropped.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool serialInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Writes characters to COM1, turning each "\n" into "\r\n".
+//-------------------------------------------------------------------------------------------------
+void serialWrite(_In_reads_(count) const char* chars, size_t count);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a kprintf stream which writes to COM1.
+//-------------------------------------------------------------------------------------------------
+const kprintf_stream* serialKPrintfStream(void);
+
+NOS_END_EXTERN_C
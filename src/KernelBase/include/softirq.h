@@ -0,0 +1,116 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for deferred interrupt work (softirqs).
+//!
+//! \details
+//! An interrupt handler should only do what can't wait, and raise a softirq for the rest. Each
+//! processor has a bitmap of pending softirqs, which is drained when the outermost interrupt
+//! returns - with interrupts enabled, so other interrupts aren't held up by the deferred work.
+//!
+//! Draining is bounded by a time budget. Whatever is still pending when the budget runs out is
+//! handed to the deferral hook (normally the worker thread), or left for the next interrupt.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The sources of deferred work. Lower numbers run first.
+//-------------------------------------------------------------------------------------------------
+enum SoftirqSource
+{
+    SOFTIRQ_Timer,          //!< Expired kernel timers.
+    SOFTIRQ_Async,          //!< Asynchronous tasks ready to be resumed.
+    SOFTIRQ_Work,           //!< General deferred work.
+
+    SOFTIRQ_SourceCount
+};
+
+enum // constants
+{
+    SOFTIRQ_BudgetUs = 2000,        //!< Longest time spent draining on an interrupt's exit.
+    SOFTIRQ_MaxRestarts = 8,        //!< Most passes over the bitmap on an interrupt's exit.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs deferred work. Runs with interrupts enabled.
+//!
+//! \param  context  The context passed to softirqRegister.
+//-------------------------------------------------------------------------------------------------
+typedef void (*SoftirqHandler)(_In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Called when work is still pending after the drain budget ran out.
+//-------------------------------------------------------------------------------------------------
+typedef void (*SoftirqDeferHook)(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Counters for a softirq source. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_SoftirqStats
+{
+    uint32_t raiseCount;        //!< Times the source was raised (while not already pending).
+    uint32_t runCount;          //!< Times the handler ran.
+    uint64_t latencyCycles;     //!< Total time from being raised to the handler starting.
+    uint64_t maxLatencyCycles;
+    uint64_t runCycles;         //!< Total time spent in the handler.
+    uint64_t maxRunCycles;
+} SoftirqStats;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets the handler for a source.
+//-------------------------------------------------------------------------------------------------
+void softirqRegister(uint32_t source, _In_ SoftirqHandler handler, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Marks a source as pending on this processor. Can be called from interrupt handlers.
+//-------------------------------------------------------------------------------------------------
+void softirqRaise(uint32_t source);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs this processor's pending softirqs, within the budget. Called by the interrupt
+//!         dispatcher on the way out of the outermost interrupt, with interrupts disabled.
+//!
+//! \note   Interrupts are enabled while the handlers run, and disabled again on return.
+//-------------------------------------------------------------------------------------------------
+void softirqDrain(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs this processor's pending softirqs until there are none left, for use by a worker
+//!         (or the idle loop) outside of interrupt context.
+//!
+//! \note   The calling thread isn't preempted while the handlers run.
+//-------------------------------------------------------------------------------------------------
+void softirqRunPending(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether this processor has softirqs pending.
+//-------------------------------------------------------------------------------------------------
+bool softirqIsPending(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets the function called when the drain budget runs out with work still pending.
+//-------------------------------------------------------------------------------------------------
+void softirqSetDeferHook(_In_opt_ SoftirqDeferHook hook);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts a worker thread for the calling processor, which runs whatever the drain budget
+//!         left pending there, and makes waking it the deferral hook. Requires threads.
+//!
+//! \note   Processors without threads run taskRunWorker, which drains their softirqs itself.
+//!
+//! \returns  True on success, or false on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool softirqStartWorker(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the counters for a source, summed over every processor.
+//-------------------------------------------------------------------------------------------------
+void softirqGetStats(uint32_t source, _Out_ SoftirqStats* stats);
+
+NOS_END_EXTERN_C
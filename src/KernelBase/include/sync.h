@@ -0,0 +1,208 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the blocking synchronization primitives: wait queues, mutexes, semaphores,
+//!         condition variables and events.
+//!
+//! \details
+//! Each primitive has a word which the uncontended paths update with a single locked instruction,
+//! and a wait queue (a spinlock and a FIFO list of waiters on their own stacks) for the rest. A
+//! thread that can't have what it wants spins briefly - only while it's worth it, such as while a
+//! mutex's owner is running on another processor - then queues itself and blocks.
+//!
+//! Releasing hands the mutex (or semaphore count) straight to the first waiter instead of putting
+//! it back for anyone to take, so a waiter can't lose it to a thread which never had to wait, and
+//! waiters are served in order.
+//!
+//! The time from a waiter being woken to it running again is measured; see syncGetStats.
+//!
+//! Everything here is zeroed to set it up (a zeroed semaphore has a count of 0, and a zeroed event
+//! is clear), or with the Setup functions. None of the waits may be used from interrupt handlers;
+//! semaphoreSignal, condSignal, condBroadcast, eventSet and waitQueueWake may be.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "spinlock.h"
+#include "katomic.h"
+#include "thread.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    SYNC_SpinCount = 1000,      //!< Most times a waiter polls before blocking.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A thread waiting in a wait queue. Lives on the waiting thread's stack.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_WaitEntry
+{
+    struct tag_WaitEntry* next;
+    Thread* thread;             //!< The waiter, or null on a processor without threads.
+    katomic<bool> woken;        //!< Set by the waker; the waiter keeps blocking until it is.
+    uint64_t wakeTsc;           //!< When the waiter was woken.
+} WaitEntry;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A FIFO list of waiting threads.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_WaitQueue
+{
+    TicketLock lock;
+    WaitEntry* head;
+    WaitEntry* tail;
+} WaitQueue;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A mutex. Must be released by the thread which acquired it.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Mutex
+{
+    katomic<long> state;        //!< 0 if free, 1 if owned, 2 if owned and there may be waiters.
+    Thread* volatile owner;
+    WaitQueue waiters;
+} Mutex;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A counting semaphore.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Semaphore
+{
+    katomic<long> count;
+    WaitQueue waiters;
+} Semaphore;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A condition variable, used with a Mutex.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_CondVar
+{
+    WaitQueue waiters;
+} CondVar;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A manual-reset event: once set, it releases every waiter until it's reset.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Event
+{
+    katomic<long> set;
+    WaitQueue waiters;
+} Event;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Blocking counters, summed over every processor. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_SyncStats
+{
+    uint32_t spinCount;         //!< Waits which were satisfied while spinning.
+    uint32_t blockCount;        //!< Waits which blocked.
+    uint32_t handoffCount;      //!< Mutexes and semaphore counts handed straight to a waiter.
+    uint64_t wakeCycles;        //!< Total time from being woken to running, over every block.
+    uint64_t maxWakeCycles;
+} SyncStats;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Blocks until woken with waitQueueWake, unless the value at address has changed from
+//!         expected. The value is checked with the queue locked, so a waker which changes it and
+//!         then calls waitQueueWake can't be missed.
+//!
+//! \returns  True if the thread blocked and was woken, or false if the value had changed.
+//-------------------------------------------------------------------------------------------------
+bool waitQueueWaitIf(_Inout_ WaitQueue* queue, _In_ const volatile long* address, long expected);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Wakes up to count threads waiting in a queue, oldest first.
+//!
+//! \returns  The number of threads woken.
+//-------------------------------------------------------------------------------------------------
+uint32_t waitQueueWake(_Inout_ WaitQueue* queue, uint32_t count);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a mutex, free.
+//-------------------------------------------------------------------------------------------------
+void mutexSetup(_Out_ Mutex* mutex);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Acquires a mutex, blocking until it's free.
+//-------------------------------------------------------------------------------------------------
+void mutexAcquire(_Inout_ Mutex* mutex);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Acquires a mutex if it's free.
+//!
+//! \returns  True if the mutex was acquired.
+//-------------------------------------------------------------------------------------------------
+_Check_return_
+bool mutexTryAcquire(_Inout_ Mutex* mutex);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases a mutex, handing it to the first waiter if there is one.
+//-------------------------------------------------------------------------------------------------
+void mutexRelease(_Inout_ Mutex* mutex);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a semaphore with an initial count.
+//-------------------------------------------------------------------------------------------------
+void semaphoreSetup(_Out_ Semaphore* semaphore, uint32_t count);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Takes one from a semaphore's count, blocking until it's above 0.
+//-------------------------------------------------------------------------------------------------
+void semaphoreWait(_Inout_ Semaphore* semaphore);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Adds one to a semaphore's count - or hands it straight to the first waiter.
+//-------------------------------------------------------------------------------------------------
+void semaphoreSignal(_Inout_ Semaphore* semaphore);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a condition variable.
+//-------------------------------------------------------------------------------------------------
+void condSetup(_Out_ CondVar* cond);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Releases a mutex and blocks until the condition variable is signalled, then acquires
+//!         the mutex again. Wakeups can't be missed in between, but the condition should still be
+//!         checked in a loop.
+//-------------------------------------------------------------------------------------------------
+void condWait(_Inout_ CondVar* cond, _Inout_ Mutex* mutex);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Wakes the oldest thread waiting on a condition variable.
+//-------------------------------------------------------------------------------------------------
+void condSignal(_Inout_ CondVar* cond);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Wakes every thread waiting on a condition variable.
+//-------------------------------------------------------------------------------------------------
+void condBroadcast(_Inout_ CondVar* cond);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up an event.
+//-------------------------------------------------------------------------------------------------
+void eventSetup(_Out_ Event* event, bool set);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Blocks until an event is set.
+//-------------------------------------------------------------------------------------------------
+void eventWait(_Inout_ Event* event);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets an event, waking every thread waiting for it.
+//-------------------------------------------------------------------------------------------------
+void eventSet(_Inout_ Event* event);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Clears an event, so threads wait for it again.
+//-------------------------------------------------------------------------------------------------
+void eventReset(_Inout_ Event* event);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the blocking counters.
+//-------------------------------------------------------------------------------------------------
+void syncGetStats(_Out_ SyncStats* stats);
+
+NOS_END_EXTERN_C
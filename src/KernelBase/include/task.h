@@ -0,0 +1,137 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for the work-stealing task scheduler.
+//!
+//! \details
+//! Tasks are small units of work which may run on any processor. Each processor has a Chase-Lev
+//! deque: it pushes and pops its own tasks at the bottom (newest first, while their data is still
+//! in its cache), and processors with nothing to do steal from the top of someone else's (oldest
+//! first - which, for recursively split work, is the biggest piece).
+//!
+//! The application processors run taskRunWorker. Other code takes part by waiting: taskWait runs
+//! tasks until the ones it's waiting for are done, instead of sleeping.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    TASK_DequeSize = 1024,      //!< Most tasks waiting on one processor. Must be a power of 2.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The body of a task.
+//!
+//! \param  context  The context passed to taskSetup.
+//-------------------------------------------------------------------------------------------------
+typedef void (*TaskFunction)(_In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A set of tasks that can be waited for together.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_TaskGroup
+{
+    volatile long pending;      //!< Tasks spawned into the group which haven't finished.
+} TaskGroup;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A task. The storage is owned by the caller, and must stay valid until the task's group
+//!         has been waited for.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_Task
+{
+    TaskFunction function;
+    void* context;
+    TaskGroup* group;
+} Task;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The body of a parallelFor.
+//!
+//! \param  context  The context passed to parallelFor.
+//! \param  begin    The first index to process.
+//! \param  end      One past the last index to process.
+//-------------------------------------------------------------------------------------------------
+typedef void (*ParallelForBody)(_In_opt_ void* context, uint32_t begin, uint32_t end);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Counters for the task scheduler, summed over every processor.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_TaskStats
+{
+    uint32_t spawnCount;        //!< Tasks spawned.
+    uint32_t inlineCount;       //!< Tasks run straight away because their deque was full.
+    uint32_t stealCount;        //!< Tasks run by a processor other than the one they were spawned on.
+    uint32_t wakeCount;         //!< Idle processors woken up for new work.
+} TaskStats;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes the task scheduler. Requires the IDT.
+//-------------------------------------------------------------------------------------------------
+void taskInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs tasks on this processor forever, along with any softirqs left pending on it.
+//!         Pass this to smpStartProcessors.
+//-------------------------------------------------------------------------------------------------
+void taskRunWorker(_In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a group with no pending tasks.
+//-------------------------------------------------------------------------------------------------
+inline void taskGroupSetup(_Out_ TaskGroup* group)
+{
+    group->pending = 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets up a task.
+//-------------------------------------------------------------------------------------------------
+inline void taskSetup(_Out_ Task* task, _In_ TaskFunction function, _In_opt_ void* context)
+{
+    task->function = function;
+    task->context = context;
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Makes a task available to run, on this processor or any other.
+//!
+//! \param  group  The group to add the task to.
+//! \param  task   The task. It mustn't already be pending.
+//-------------------------------------------------------------------------------------------------
+void taskSpawn(_Inout_ TaskGroup* group, _Inout_ Task* task);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs tasks until every task spawned into a group has finished.
+//-------------------------------------------------------------------------------------------------
+void taskWait(_Inout_ TaskGroup* group);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs body over [begin, end), split into pieces of at most grain indices that run in
+//!         parallel. Returns when every piece is done.
+//!
+//! \param  begin    The first index.
+//! \param  end      One past the last index.
+//! \param  grain    The most indices body is given at once. Pieces are split in half until they
+//!                  fit, so neighbouring indices tend to run on the same processor.
+//! \param  body     The function run on each piece.
+//! \param  context  Passed to body.
+//-------------------------------------------------------------------------------------------------
+void parallelFor(
+    uint32_t begin,
+    uint32_t end,
+    uint32_t grain,
+    _In_ ParallelForBody body,
+    _In_opt_ void* context
+);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the task scheduler's counters.
+//-------------------------------------------------------------------------------------------------
+void taskGetStats(_Out_ TaskStats* stats);
+
+NOS_END_EXTERN_C
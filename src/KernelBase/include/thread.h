@@ -0,0 +1,152 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for kernel threads.
+//!
+//! \details
+//! Each thread has its own stack, taken straight from the physical memory manager. Switching
+//! between threads only saves the registers a function call preserves anyway - everything else
+//! is already on the stack of the function that asked to switch.
+//!
+//! Each processor has a FIFO run queue per priority, and a bitmap of which queues are occupied, so
+//! the next thread to run is found with a single bit scan however many threads there are. When
+//! nothing is ready, the processor's idle thread halts until an interrupt makes something ready.
+//!
+//! Once preemption is enabled, a thread that runs for a whole time slice goes to the back of its
+//! queue, and a thread woken with a higher priority than the running one takes over as soon as
+//! the current interrupt returns. Threads that block before their slice is up (waiting for I/O)
+//! get a small priority boost when they're woken, which they lose again by using whole slices.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    THREAD_StackPages = 2,      //!< Size of a thread's stack, in pages.
+
+    THREAD_PriorityCount = 32,  //!< Priorities are in [0, THREAD_PriorityCount); higher runs first.
+    THREAD_DefaultPriority = 16,
+    THREAD_MaxBoost = 4,        //!< Most a thread's priority is raised for blocking.
+    THREAD_SliceMs = 10,        //!< How long a thread runs before others of its priority get a turn.
+};
+
+typedef struct tag_Thread Thread;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The body of a thread. The thread exits when this returns.
+//!
+//! \param  context  The context passed to threadCreate.
+//-------------------------------------------------------------------------------------------------
+typedef void (*ThreadFunction)(_In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Thread counters, summed over every processor.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_ThreadStats
+{
+    uint32_t createdCount;      //!< Threads created with threadCreate.
+    uint32_t exitedCount;       //!< Threads which have exited (and been reaped).
+    uint32_t switchCount;       //!< Context switches.
+    uint32_t preemptCount;      //!< Context switches forced on a thread on interrupt exit.
+} ThreadStats;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes threading, turning the code that calls it into the processor's first
+//!         thread. Requires the physical memory manager.
+//!
+//! \returns  True on success, or false on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool threadInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts time slicing. Until then, threads only switch when they yield, block or exit.
+//!         Requires timers.
+//-------------------------------------------------------------------------------------------------
+void threadEnablePreemption(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Creates a thread with THREAD_DefaultPriority, and puts it at the back of the run queue.
+//!         The thread runs on the calling processor, which must have called threadInitialize.
+//!
+//! \param  function  The function the thread runs.
+//! \param  context   Passed to the function.
+//!
+//! \returns  The thread, or null if there wasn't enough memory for it.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+Thread* threadCreate(_In_ ThreadFunction function, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Lets the next ready thread of the same or a higher priority run. Returns immediately if
+//!         there isn't one.
+//-------------------------------------------------------------------------------------------------
+void threadYield(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Ends the current thread. Its stack is freed once another thread is running.
+//-------------------------------------------------------------------------------------------------
+void threadExit(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Stops running the current thread until threadWake is called for it.
+//!
+//! \note   To avoid missing a wakeup, disable interrupts, check the condition being waited for,
+//!         and only then call this. Interrupts are still disabled when it returns.
+//-------------------------------------------------------------------------------------------------
+void threadBlock(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Makes a blocked thread ready again. Does nothing if the thread isn't blocked. May be
+//!         called from interrupt handlers, and from any processor: a thread on another processor
+//!         is handed to it with an IPI.
+//!
+//! \note   If the thread has a higher priority than the caller, it runs straight away - unless
+//!         this is called from an interrupt or with interrupts disabled, in which case it runs
+//!         when the outermost interrupt returns (or the caller yields or blocks).
+//-------------------------------------------------------------------------------------------------
+void threadWake(_In_ Thread* thread);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets a thread's base priority. If this leaves a ready thread with a higher priority than
+//!         the running one, the switch happens on the next interrupt exit.
+//-------------------------------------------------------------------------------------------------
+void threadSetPriority(_Inout_ Thread* thread, uint32_t priority);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a thread's base priority.
+//-------------------------------------------------------------------------------------------------
+uint32_t threadGetPriority(_In_ const Thread* thread);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Switches threads if the running one's slice is up or a higher priority one was woken.
+//!         Called by the interrupt dispatcher on the way out of the outermost interrupt. Does
+//!         nothing while preemption is disabled (see cpuDisablePreemption).
+//-------------------------------------------------------------------------------------------------
+void threadPreemptIfNeeded(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the thread running on this processor.
+//-------------------------------------------------------------------------------------------------
+Thread* threadCurrent(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether a thread is running on a processor right now (rather than ready, blocked
+//!         or exited).
+//-------------------------------------------------------------------------------------------------
+bool threadIsRunning(_In_ const Thread* thread);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets a thread's ID. IDs are never reused.
+//-------------------------------------------------------------------------------------------------
+uint32_t threadId(_In_ const Thread* thread);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the thread counters.
+//-------------------------------------------------------------------------------------------------
+void threadGetStats(_Out_ ThreadStats* stats);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,73 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for virtually contiguous kernel allocations.
+//!
+//! \details
+//! Large buffers don't need physically contiguous memory. These allocations are backed by
+//! individual frames from wherever the physical memory manager has them, mapped back to back in
+//! a window of kernel virtual addresses reserved for them, so they succeed as long as enough
+//! memory is free - no matter how fragmented it is.
+//!
+//! The same window is used for mapping devices' memory, since that needs addresses but no frames.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Initializes the virtually contiguous allocator. Requires paging to be enabled.
+//!
+//! \returns  True on success, or false on failure.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool vmallocInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allocates virtually contiguous memory.
+//!
+//! \param  cb  The number of bytes to allocate. This is rounded up to a whole number of pages.
+//!
+//! \returns  A pointer to the allocated memory, or null if no memory was requested or there
+//!           isn't enough free memory or address space to satisfy the request.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+void* vmAllocate(size_t cb);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Frees memory allocated with vmAllocate.
+//!
+//! \param  ptr  The pointer returned by vmAllocate. May be null.
+//-------------------------------------------------------------------------------------------------
+void vmFree(_In_opt_ void* ptr);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Maps device memory (or any other physical range) into the vmAllocate window, uncached.
+//!
+//! \param  physicalAddress  The base of the physical range. Doesn't need to be page-aligned.
+//! \param  cb               The size of the physical range, in bytes.
+//!
+//! \returns  The virtual address of physicalAddress, or null if the range couldn't be mapped.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+void* vmMapIo(uintptr_t physicalAddress, size_t cb);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Unmaps a range mapped with vmMapIo.
+//!
+//! \param  ptr  The pointer returned by vmMapIo. May be null.
+//!
+//! \note   Don't pass these to vmFree; it would hand the device's frames to the physical memory
+//!         manager.
+//-------------------------------------------------------------------------------------------------
+void vmUnmapIo(_In_opt_ void* ptr);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of pages currently allocated with vmAllocate or mapped with vmMapIo.
+//-------------------------------------------------------------------------------------------------
+uint32_t vmAllocatedPages(void);
+
+NOS_END_EXTERN_C
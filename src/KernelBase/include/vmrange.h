@@ -0,0 +1,128 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines an allocator of page-granular ranges within a window of virtual addresses.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "platform.h"
+#include "spinlock.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "sal.h"
+
+#ifdef __cplusplus
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Hands out ranges of pages within a fixed window of virtual addresses.
+//!
+//! \details
+//! The window is tracked with two bitmaps: one marking reserved pages, and one marking the first
+//! page of each range. The range's length is recovered from the bitmaps when it's freed, so
+//! callers don't need to remember it. Each range is followed by a guard page which is never
+//! handed out (marked with only its start bit set), so running off the end of a range faults
+//! instead of corrupting its neighbor.
+//!
+//! Only addresses are handed out; mapping memory behind them is up to the caller.
+//-------------------------------------------------------------------------------------------------
+class VirtualRangeAllocator
+{
+public:
+    constexpr VirtualRangeAllocator()
+        : m_base{ 0 }
+        , m_pageCount{ 0 }
+        , m_reserved{ nullptr }
+        , m_starts{ nullptr }
+        , m_bitmapPages{ 0 }
+        , m_nextSearch{ 0 }
+        , m_reservedCount{ 0 }
+        , m_lock{}
+    { }
+
+    VirtualRangeAllocator(const VirtualRangeAllocator&) = delete;
+    VirtualRangeAllocator& operator=(const VirtualRangeAllocator&) = delete;
+
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Sets up the allocator to manage a window of virtual addresses.
+    //!
+    //! \param  base  The page aligned base of the window.
+    //! \param  size  The size of the window, in bytes.
+    //!
+    //! \returns  True on success, or false if the bitmaps couldn't be allocated.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_ _Success_(return != false)
+    bool Initialize(uintptr_t base, uintptr_t size);
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Reserves a range of pages. Safe to call from any processor or interrupt handler.
+    //!
+    //! \param  pageCount  The number of usable pages in the range.
+    //!
+    //! \returns  The base of the range, or 0 if there's no free range big enough.
+    //---------------------------------------------------------------------------------------------
+    _Check_return_ _Success_(return != 0)
+    uintptr_t Allocate(uint32_t pageCount);
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Releases a range of pages.
+    //!
+    //! \param  address  The base of the range, as returned by Allocate.
+    //!
+    //! \returns  The number of usable pages in the range, or 0 if address isn't the base of a
+    //!           range.
+    //---------------------------------------------------------------------------------------------
+    uint32_t Free(uintptr_t address);
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Gets the number of usable pages in a range, so it can be unmapped before it's
+    //!         freed.
+    //!
+    //! \param  address  The base of the range, as returned by Allocate.
+    //!
+    //! \returns  The number of usable pages in the range, or 0 if address isn't the base of a
+    //!           range.
+    //---------------------------------------------------------------------------------------------
+    uint32_t RangePages(uintptr_t address);
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Gets whether an address is inside a usable page of a reserved range.
+    //---------------------------------------------------------------------------------------------
+    bool IsReserved(uintptr_t address) const;
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Gets whether an address is inside the window managed by this allocator.
+    //---------------------------------------------------------------------------------------------
+    bool Contains(uintptr_t address) const
+    {
+        return address >= m_base
+            && (address - m_base) / NOS_PAGE_SIZE < m_pageCount;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Gets the number of usable pages reserved.
+    //---------------------------------------------------------------------------------------------
+    uint32_t ReservedPages() const
+    {
+        return m_reservedCount;
+    }
+
+private:
+    uintptr_t AllocateLocked(uint32_t pageCount);
+    uint32_t FreeLocked(uintptr_t address);
+    uint32_t CountLocked(uintptr_t address) const;
+    bool TestBit(const uint32_t* bitmap, uint32_t page) const;
+    void SetBit(uint32_t* bitmap, uint32_t page);
+    void ClearBit(uint32_t* bitmap, uint32_t page);
+    uint32_t FindFree(uint32_t start, uint32_t end, uint32_t pageCount) const;
+
+    uintptr_t m_base;           //!< Base of the window.
+    uint32_t m_pageCount;       //!< Number of pages in the window.
+    uint32_t* m_reserved;       //!< Bit set for every reserved page.
+    uint32_t* m_starts;         //!< Bit set for the first page of every range and every guard.
+    uint32_t m_bitmapPages;     //!< Number of pages in each bitmap.
+    uint32_t m_nextSearch;      //!< Page to start the next search at.
+    uint32_t m_reservedCount;   //!< Number of reserved pages.
+    TicketLock m_lock;          //!< Guards everything above once Initialize is done.
+};
+
+#endif // __cplusplus
@@ -8,3 +8,8 @@
 #define NOS_PTR_SIZE            NOS_PTR_SIZE_64BIT
 
 #define NOS_PTR_USABLE_BITS     48
+
+#define NOS_PAGE_SIZE           4096
+
+#define NOS_CACHE_LINE_SIZE     64
+
@@ -0,0 +1,48 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for locating ACPI tables.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The header shared by every ACPI system description table.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_AcpiTableHeader
+{
+    char signature[4];
+    uint32_t length;            //!< The length of the whole table, including this header.
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} AcpiTableHeader;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Finds the root system description table. Requires vmalloc to be initialized.
+//!
+//! \returns  True on success, or false if there's no valid RSDP or RSDT.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool acpiInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Finds a table by its signature.
+//!
+//! \param  signature  The table's four character signature (such as "APIC" for the MADT).
+//!
+//! \returns  A pointer to the table, which stays mapped forever, or null if there's no such
+//!           table or its checksum is wrong.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+const AcpiTableHeader* acpiFindTable(_In_reads_(4) const char* signature);
+
+NOS_END_EXTERN_C
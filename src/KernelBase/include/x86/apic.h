@@ -0,0 +1,104 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for the local APIC and IO APIC.
+//!
+//! \details
+//! The APICs are found through the ACPI MADT. Once they're initialized, legacy IRQs are routed
+//! through the IO APIC and acknowledged with a single write to the local APIC, instead of the
+//! port I/O the 8259 PICs need.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "idt.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Finds the APICs, enables the boot processor's local APIC, and routes legacy IRQs
+//!         through the IO APIC. Requires ACPI and vmalloc to be initialized.
+//!
+//! \returns  True on success, or false if there are no usable APICs (the PICs stay in use).
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != false)
+bool apicInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of usable processors listed in the MADT.
+//-------------------------------------------------------------------------------------------------
+uint32_t apicCpuCount(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the local APIC ID of a processor, by index. The boot processor is index 0.
+//-------------------------------------------------------------------------------------------------
+uint32_t apicCpuApicId(uint32_t cpu);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the local APIC ID of the processor this code is running on.
+//-------------------------------------------------------------------------------------------------
+uint32_t lapicCurrentId(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Signals the end of an interrupt delivered by the local APIC.
+//-------------------------------------------------------------------------------------------------
+void lapicEndOfInterrupt(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Enables the local APIC of the processor this code is running on, with its timer
+//!         masked. apicInitialize does this for the boot processor.
+//-------------------------------------------------------------------------------------------------
+void lapicInitializeProcessor(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sends an interrupt to another processor, and waits for it to be accepted.
+//!
+//! \param  apicId  The local APIC ID of the processor.
+//! \param  vector  The vector to raise on it.
+//-------------------------------------------------------------------------------------------------
+void lapicSendIpi(uint32_t apicId, uint32_t vector);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sends an INIT IPI, which resets a processor into its wait-for-startup state.
+//-------------------------------------------------------------------------------------------------
+void lapicSendInit(uint32_t apicId);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sends a startup IPI, which starts a processor waiting after INIT in real mode.
+//!
+//! \param  apicId  The local APIC ID of the processor.
+//! \param  page    The physical page number (below 1 MiB) the processor starts executing at.
+//-------------------------------------------------------------------------------------------------
+void lapicSendStartup(uint32_t apicId, uint32_t page);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Measures the local APIC timer's rate against the PIT.
+//!
+//! \returns  The number of timer ticks per millisecond, or 0 if there's no local APIC.
+//-------------------------------------------------------------------------------------------------
+uint32_t lapicTimerCalibrate(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of timer ticks per millisecond measured by lapicTimerCalibrate.
+//-------------------------------------------------------------------------------------------------
+uint32_t lapicTimerTicksPerMs(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Sets the function called when the local APIC timer fires. The EOI is taken care of.
+//-------------------------------------------------------------------------------------------------
+void lapicTimerSetHandler(_In_opt_ InterruptHandler handler, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts the local APIC timer.
+//!
+//! \param  ticks     The number of timer ticks until it fires.
+//! \param  periodic  If true, the timer keeps firing every ticks ticks. Otherwise it fires once.
+//-------------------------------------------------------------------------------------------------
+void lapicTimerStart(uint32_t ticks, bool periodic);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Stops the local APIC timer.
+//-------------------------------------------------------------------------------------------------
+void lapicTimerStop(void);
+
+NOS_END_EXTERN_C
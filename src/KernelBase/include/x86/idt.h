@@ -0,0 +1,254 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for x86 interrupt handling.
+//!
+//! \details
+//! Every vector has an entry stub (in isr.asm) which saves the registers C code may clobber and
+//! calls a common dispatcher. The dispatcher counts the interrupt and calls whichever handler is
+//! registered for the vector. Legacy IRQs are raised at IDT_IrqBase, and are masked and
+//! acknowledged through the current IrqController (the 8259 PICs to begin with).
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "intrin.h"
+#include "kprintf.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    IDT_VectorCount = 256,          //!< The number of entries in the IDT.
+    IDT_ExceptionCount = 32,        //!< The number of vectors reserved for processor exceptions.
+    IDT_PageFault = 14,             //!< The page fault (#PF) vector.
+    IDT_IrqBase = 0x20,             //!< The vector raised for IRQ 0.
+    IDT_IrqCount = 16,              //!< The number of (legacy ISA) IRQs.
+    IDT_LapicTimerVector = 0xE0,    //!< Raised by the local APIC timer.
+    IDT_SelfTestVector = 0xF0,      //!< Software interrupt used to measure entry costs.
+    IDT_TaskWakeVector = 0xF1,      //!< IPI sent to wake a processor waiting for tasks.
+    IDT_RcuKickVector = 0xF2,       //!< IPI sent to a processor holding up an RCU grace period.
+    IDT_TlbShootdownVector = 0xF3,  //!< IPI sent to flush a removed mapping from a TLB.
+    IDT_ThreadWakeVector = 0xF4,    //!< IPI sent to wake a thread on its own processor.
+    IDT_LapicSpuriousVector = 0xFF, //!< Raised by the local APIC for spurious interrupts.
+
+    IDT_HistogramBuckets = 32,      //!< Buckets in a handler time histogram (one per power of 2).
+};
+
+enum EflagsBits : uint32_t
+{
+    EFLAGS_IF = (1u << 9),      //!< Maskable interrupts are enabled.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Bits of the error code pushed for a page fault.
+//-------------------------------------------------------------------------------------------------
+enum PageFaultErrorBits : uint32_t
+{
+    PF_Present = (1u << 0),     //!< The page was present (a protection violation).
+    PF_Write   = (1u << 1),     //!< The access was a write.
+    PF_User    = (1u << 2),     //!< The access came from user mode.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The state saved by an interrupt entry stub, in the order it's on the stack.
+//!
+//! \note   Only the registers a C function may clobber are saved. The rest still hold their
+//!         values from the interrupted code, and the handler preserves them as usual.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_InterruptFrame
+{
+    // pushed by the stub
+    uint64_t entryTsc;      //!< The TSC when the stub was entered.
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+    uint32_t vector;
+    uint32_t errorCode;     //!< The exception's error code, or 0 if it doesn't push one.
+
+    // pushed by the processor
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} InterruptFrame;
+
+typedef void (*InterruptEntry)(void);     //!< An entry stub (not callable from C).
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Counters for a vector. Times are in TSC cycles.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_IdtVectorStats
+{
+    uint32_t count;                 //!< Times the vector was dispatched.
+    uint32_t maxNesting;            //!< Most interrupts in progress when the vector arrived.
+    uint64_t latencyCycles;         //!< Total time from the entry stub to the handler.
+    uint64_t maxLatencyCycles;
+    uint64_t handlerCycles;         //!< Total time spent in the handler.
+    uint64_t maxHandlerCycles;
+
+    //! Handler times, bucketed by their highest set bit (bucket n counts [2^n, 2^(n+1)) cycles).
+    uint32_t histogram[IDT_HistogramBuckets];
+} IdtVectorStats;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Handles an interrupt. Runs with interrupts disabled.
+//!
+//! \param  frame    The interrupted state.
+//! \param  context  The context passed when the handler was registered.
+//-------------------------------------------------------------------------------------------------
+typedef void (*InterruptHandler)(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  The operations needed to deliver IRQs, so the interrupt controller can be swapped out.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_IrqController
+{
+    const char* name;
+
+    void (*mask)(uint32_t irq);             //!< Stops an IRQ from being raised.
+    void (*unmask)(uint32_t irq);           //!< Allows an IRQ to be raised.
+    bool (*isSpurious)(uint32_t irq);       //!< Checks whether a raised IRQ should be dropped.
+    void (*endOfInterrupt)(uint32_t irq);   //!< Acknowledges an IRQ once it's been handled.
+
+    //! Routes an IRQ to a processor (by index). Returns false if the controller can't.
+    bool (*setAffinity)(uint32_t irq, uint32_t cpu);
+} IrqController;
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Disables maskable interrupts.
+//!
+//! \returns  Whether interrupts were enabled before, to pass to idtRestoreInterrupts.
+//-------------------------------------------------------------------------------------------------
+inline bool idtDisableInterrupts(void)
+{
+    const bool enabled = (__readeflags() & EFLAGS_IF) != 0;
+    _disable();
+    return enabled;
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Re-enables maskable interrupts if they were enabled before idtDisableInterrupts.
+//-------------------------------------------------------------------------------------------------
+inline void idtRestoreInterrupts(bool enabled)
+{
+    if (enabled)
+    {
+        _enable();
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Installs the kernel's IDT and remaps the legacy PICs, with every IRQ masked. The PICs
+//!         are used as the IRQ controller until something else takes over.
+//!
+//! \note   Interrupts are left disabled.
+//-------------------------------------------------------------------------------------------------
+void idtInitialize(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Loads the IDT built by idtInitialize on this processor, for the processors started
+//!         after the boot processor.
+//-------------------------------------------------------------------------------------------------
+void idtInitializeProcessor(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Registers the handler for a vector, replacing any previous one. Once it returns, the
+//!         previous handler isn't running anywhere and won't be called again.
+//!
+//! \param  vector   The vector to handle.
+//! \param  handler  The handler, or null to remove the current one.
+//! \param  context  Passed to the handler.
+//!
+//! \note   Waits for an RCU grace period, so it mustn't be called from an interrupt handler.
+//-------------------------------------------------------------------------------------------------
+void idtRegisterHandler(uint32_t vector, _In_opt_ InterruptHandler handler, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Registers the handler for a legacy IRQ and unmasks it.
+//!
+//! \param  irq      The IRQ to handle.
+//! \param  handler  The handler. It doesn't need to send an EOI.
+//! \param  context  Passed to the handler.
+//-------------------------------------------------------------------------------------------------
+void idtRegisterIrqHandler(uint32_t irq, _In_ InterruptHandler handler, _In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Masks a legacy IRQ and removes its handler.
+//-------------------------------------------------------------------------------------------------
+void idtUnregisterIrqHandler(uint32_t irq);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Routes a legacy IRQ to a processor.
+//!
+//! \returns  True on success, or false if the IRQ controller can't route IRQs.
+//-------------------------------------------------------------------------------------------------
+_Success_(return != false)
+bool idtSetIrqAffinity(uint32_t irq, uint32_t cpu);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Switches to a different IRQ controller.
+//!
+//! \details
+//! Every IRQ is masked on the old controller, and the IRQs with handlers are unmasked on the new
+//! one, so nothing is lost in the switch.
+//-------------------------------------------------------------------------------------------------
+void idtSetIrqController(_In_ const IrqController* controller);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the IRQ controller in use.
+//-------------------------------------------------------------------------------------------------
+const IrqController* idtGetIrqController(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of times a vector has been dispatched.
+//-------------------------------------------------------------------------------------------------
+uint32_t idtGetVectorCount(uint32_t vector);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the number of spurious legacy IRQs which were dropped.
+//-------------------------------------------------------------------------------------------------
+uint32_t idtGetSpuriousCount(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether this processor is running an interrupt handler (or the softirqs drained
+//!         on the way out of one).
+//-------------------------------------------------------------------------------------------------
+bool idtInInterrupt(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the counters for a vector.
+//-------------------------------------------------------------------------------------------------
+void idtGetVectorStats(uint32_t vector, _Out_ IdtVectorStats* stats);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Clears every vector's counters, to start a fresh measurement.
+//-------------------------------------------------------------------------------------------------
+void idtResetStats(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Prints a summary line for every vector that has been dispatched: how often, entry
+//!         latency, handler time, and the deepest nesting it was seen at.
+//-------------------------------------------------------------------------------------------------
+void idtPrintReport(_In_ const kprintf_stream* stream);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Prints one vector's counters, including its handler time histogram.
+//-------------------------------------------------------------------------------------------------
+void idtPrintVectorStats(_In_ const kprintf_stream* stream, uint32_t vector);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Measures the round trip cost of an interrupt through an entry stub and the dispatcher,
+//!         by raising IDT_SelfTestVector with a handler that does nothing.
+//!
+//! \param  iterations     The number of interrupts to raise.
+//! \param  minCycles      Receives the cheapest round trip, in cycles.
+//! \param  averageCycles  Receives the average round trip, in cycles.
+//-------------------------------------------------------------------------------------------------
+void idtMeasureEntryCost(
+    uint32_t iterations,
+    _Out_ uint64_t* minCycles,
+    _Out_ uint64_t* averageCycles
+);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,47 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the x86 page table format, for code which manipulates entries directly.
+//!
+//! \note   Most code should use the interface in paging.h instead.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+typedef uint32_t pte_t;     //!< A page directory or page table entry.
+
+enum PageEntryBits : uint32_t
+{
+    PE_Present      = (1u << 0),
+    PE_Writable     = (1u << 1),
+    PE_User         = (1u << 2),
+    PE_WriteThrough = (1u << 3),
+    PE_NoCache      = (1u << 4),
+    PE_Accessed     = (1u << 5),
+    PE_Dirty        = (1u << 6),
+    PE_LargePage    = (1u << 7),        //!< (page directory entries only)
+    PE_Global       = (1u << 8),
+
+    PE_FrameMask      = 0xFFFFF000u,
+    PE_LargeFrameMask = 0xFFC00000u,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the page table entry which maps a virtual address.
+//!
+//! \param  virtualAddress  The address to look up.
+//! \param  create          If true, a page table is allocated if there isn't one already.
+//!
+//! \returns  A pointer to the entry, or null if there's no page table (and create is false or
+//!           one couldn't be allocated), or the address is covered by a large page.
+//!
+//! \note   The caller is responsible for invalidating the TLB after changing the entry.
+//-------------------------------------------------------------------------------------------------
+_Check_return_ _Success_(return != NULL)
+pte_t* vmGetPageTableEntry(uintptr_t virtualAddress, bool create);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,58 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for the legacy 8259 programmable interrupt controllers.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "idt.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    PIC_IrqCount = 16,          //!< The number of IRQs handled by the master and slave together.
+    PIC_CascadeIrq = 2,         //!< The master's input the slave is wired to.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Remaps the PICs so their IRQs raise consecutive vectors, and masks every IRQ.
+//!
+//! \param  vectorBase  The vector raised for IRQ 0. Must be a multiple of 8.
+//-------------------------------------------------------------------------------------------------
+void picInitialize(uint32_t vectorBase);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Stops an IRQ from being raised.
+//-------------------------------------------------------------------------------------------------
+void picMask(uint32_t irq);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Allows an IRQ to be raised.
+//-------------------------------------------------------------------------------------------------
+void picUnmask(uint32_t irq);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Checks whether an IRQ is spurious (raised by noise, with nothing actually in service).
+//!
+//! \details
+//! Only IRQs 7 and 15 can be spurious. A spurious IRQ must not get an EOI - except that the
+//! master still needs one for a spurious IRQ 15, since it really did see its cascade input.
+//! This function takes care of that.
+//-------------------------------------------------------------------------------------------------
+_Check_return_
+bool picIsSpurious(uint32_t irq);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Signals the end of an IRQ's handler, so the PICs deliver further IRQs.
+//-------------------------------------------------------------------------------------------------
+void picEndOfInterrupt(uint32_t irq);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the PICs' implementation of the IRQ controller operations.
+//-------------------------------------------------------------------------------------------------
+const IrqController* picGetController(void);
+
+NOS_END_EXTERN_C
@@ -0,0 +1,46 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines helpers for using the 8254 programmable interval timer as a reference clock.
+//!
+//! \details
+//! Channel 2 is used, since its output can be polled (through port 0x61) without taking an
+//! interrupt. This makes it a good reference for calibrating other timers.
+//!
+//! Channel 0 (wired to IRQ 0) can also be used as a one-shot interrupt source.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    PIT_Frequency = 1193182,        //!< The PIT's input clock, in Hz.
+    PIT_MaxCountdownUs = 54000,     //!< The longest countdown the 16-bit counter can time.
+    PIT_Irq = 0,                    //!< The IRQ raised by channel 0.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts counting down.
+//!
+//! \param  microseconds  The length of the countdown. At most PIT_MaxCountdownUs.
+//-------------------------------------------------------------------------------------------------
+void pitStartCountdown(uint32_t microseconds);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets whether the countdown started with pitStartCountdown has finished.
+//-------------------------------------------------------------------------------------------------
+_Check_return_
+bool pitCountdownExpired(void);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Raises PIT_Irq once, after a delay.
+//!
+//! \param  microseconds  The delay. Clamped to PIT_MaxCountdownUs.
+//-------------------------------------------------------------------------------------------------
+void pitStartIrqCountdown(uint32_t microseconds);
+
+NOS_END_EXTERN_C
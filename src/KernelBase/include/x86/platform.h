@@ -9,3 +9,7 @@
 
 #define NOS_PTR_USABLE_BITS     32
 
+#define NOS_PAGE_SIZE           4096
+
+#define NOS_CACHE_LINE_SIZE     64
+
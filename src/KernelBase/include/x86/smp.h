@@ -0,0 +1,44 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the interface for starting the application processors.
+//!
+//! \details
+//! Processors other than the boot processor wait in real mode until they're sent INIT and startup
+//! IPIs. Each one starts in a small trampoline copied into a page below 1 MiB, which switches to
+//! protected mode with paging on (reusing the boot processor's page directory), moves onto a
+//! stack of its own and calls into the kernel. There it loads the kernel's GDT and IDT, points fs
+//! at its per-CPU data, and enables its local APIC before it reports that it's online.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "sal.h"
+
+NOS_EXTERN_C
+
+enum // constants
+{
+    SMP_StackPages = 2,     //!< Size of an application processor's initial stack, in pages.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Runs on an application processor once it's online, with interrupts enabled. If it
+//!         returns, the processor halts until its next interrupt, forever.
+//!
+//! \param  context  The context passed to smpStartProcessors.
+//-------------------------------------------------------------------------------------------------
+typedef void (*SmpEntry)(_In_opt_ void* context);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Starts every processor listed in the MADT, one at a time. Requires the APICs, and
+//!         paging to be enabled. Stops at the first processor which fails to come online, since
+//!         it may still start later on the shared trampoline.
+//!
+//! \param  entry    Run on each application processor once it's online. May be null.
+//! \param  context  Passed to entry.
+//!
+//! \returns  The number of processors online, including the boot processor.
+//-------------------------------------------------------------------------------------------------
+uint32_t smpStartProcessors(_In_opt_ SmpEntry entry, _In_opt_ void* context);
+
+NOS_END_EXTERN_C
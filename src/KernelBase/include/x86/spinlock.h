@@ -0,0 +1,455 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the spinning locks: ticket locks, MCS queue locks and reader-writer locks.
+//!
+//! \details
+//! Ticket and MCS locks hand the lock over in arrival order, so no processor can be starved.
+//! Reader-writer locks only guarantee that waiting writers as a whole get in ahead of new readers.
+//!
+//! - Ticket locks are the smallest and cheapest when uncontended. Every waiter spins on the same
+//!   word, though, so each release costs a cache miss on every waiting processor.
+//! - MCS locks queue their waiters, each spinning on its own node, so a release only disturbs the
+//!   next waiter. The node lives on the acquirer's stack until the lock is released.
+//! - Reader-writer locks let any number of readers in together. A waiting writer keeps new readers
+//!   out, so readers can't starve writers. Writers race each other for the lock with a compare
+//!   and exchange, though, so with several waiting an unlucky one can keep being overtaken.
+//!
+//! Acquiring a lock doesn't stop the holder from being interrupted or preempted, and a thread
+//! spinning on a lock held by a thread it preempted on the same processor spins forever. So unless
+//! interrupts are already disabled, take locks with the IrqSave variants. Locks are unlocked when
+//! zeroed.
+//!
+//! With NOS_LOCK_PROFILING set to 1, every place a lock is acquired keeps counts of acquires and
+//! contended acquires, the cycles spent spinning and the longest hold; see lockProfilePrint.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "nosbase.h"
+#include "kstdint.h"
+#include "kprintf.h"
+#include "idt.h"
+#include "katomic.h"
+#include "intrin.h"
+#include "sal.h"
+
+#ifndef NOS_LOCK_PROFILING
+#define NOS_LOCK_PROFILING      0
+#endif
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Statistics for one place in the code which acquires a lock. Only updated when
+//!         NOS_LOCK_PROFILING is set.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_LockSite
+{
+    const char* file;
+    uint32_t line;
+    volatile long registered;           //!< Set once the site is on the list lockProfilePrint reads.
+    struct tag_LockSite* next;
+    volatile long acquireCount;
+    volatile long contendedCount;       //!< Acquires which had to wait.
+    volatile __int64 spinCycles;        //!< Total cycles spent waiting.
+    uint64_t maxHoldCycles;             //!< Longest time from acquire to release.
+} LockSite;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A ticket lock: acquirers take a number, and wait for it to be served.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_TicketLock
+{
+    volatile long next;                 //!< The next ticket to hand out.
+    volatile long owner;                //!< The ticket being served.
+#if NOS_LOCK_PROFILING
+    LockSite* site;
+    uint64_t acquiredTsc;
+#endif
+} TicketLock;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  An acquirer's place in an MCS lock's queue. Must stay valid until the lock is released.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_McsNode
+{
+    struct tag_McsNode* volatile next;  //!< The waiter queued behind this one.
+    volatile long waiting;              //!< Cleared by the previous holder to hand over the lock.
+} McsNode;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  An MCS queue lock.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_McsLock
+{
+    McsNode* volatile tail;             //!< The last node in the queue, or null when unlocked.
+#if NOS_LOCK_PROFILING
+    LockSite* site;
+    uint64_t acquiredTsc;
+#endif
+} McsLock;
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  A reader-writer spinlock.
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_RwSpinLock
+{
+    volatile long state;                //!< RWLOCK_* bits, plus RWLOCK_Reader per reader.
+#if NOS_LOCK_PROFILING
+    LockSite* site;
+    uint64_t acquiredTsc;
+#endif
+} RwSpinLock;
+
+enum // constants
+{
+    RWLOCK_Writer = 0x1,                //!< Set while a writer holds the lock.
+    RWLOCK_WriterWaiting = 0x2,         //!< Set while a writer waits; keeps new readers out.
+    RWLOCK_Reader = 0x4,                //!< Added to the state for each reader.
+};
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Gets the LockSite for the place it's written, or null when profiling is disabled.
+//-------------------------------------------------------------------------------------------------
+#if NOS_LOCK_PROFILING
+#define LOCK_SITE()     ([]() -> LockSite* {                                            \
+                            static LockSite site = { __FILE__, __LINE__ };              \
+                            return &site;                                               \
+                        }())
+#else
+#define LOCK_SITE()     nullptr
+#endif
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Records an acquire for a site. Called with the lock held.
+//-------------------------------------------------------------------------------------------------
+void lockProfileAcquired(_Inout_ LockSite* site, uint64_t spinCycles, bool contended);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Records a release for a site. Called with the lock still held.
+//-------------------------------------------------------------------------------------------------
+void lockProfileReleased(_Inout_ LockSite* site, uint64_t holdCycles);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Prints the statistics of every lock site which has been used, or a note that profiling
+//!         is disabled.
+//-------------------------------------------------------------------------------------------------
+void lockProfilePrint(_In_ const kprintf_stream* stream);
+
+//-------------------------------------------------------------------------------------------------
+//! \brief  Clears the statistics of every lock site which has been used.
+//-------------------------------------------------------------------------------------------------
+void lockProfileReset(void);
+
+
+//-------------------------------------------------------------------------------------------------
+// profiling helpers - these compile away when profiling is disabled.
+//-------------------------------------------------------------------------------------------------
+inline uint64_t lockSpinStart(void)
+{
+#if NOS_LOCK_PROFILING
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+inline void lockNoteAcquired(
+    _Inout_opt_ LockSite** heldSite,
+    _Inout_opt_ uint64_t* acquiredTsc,
+    _Inout_opt_ LockSite* site,
+    uint64_t spinStart,
+    bool contended)
+{
+#if NOS_LOCK_PROFILING
+    *acquiredTsc = __rdtsc();
+    *heldSite = site;
+    lockProfileAcquired(site, *acquiredTsc - spinStart, contended);
+#else
+    (void)heldSite;
+    (void)acquiredTsc;
+    (void)site;
+    (void)spinStart;
+    (void)contended;
+#endif
+}
+
+inline void lockNoteReleasing(_In_opt_ LockSite* heldSite, uint64_t acquiredTsc)
+{
+#if NOS_LOCK_PROFILING
+    lockProfileReleased(heldSite, __rdtsc() - acquiredTsc);
+#else
+    (void)heldSite;
+    (void)acquiredTsc;
+#endif
+}
+
+#if NOS_LOCK_PROFILING
+#define LOCK_HELD_SITE(lock)    (&(lock)->site)
+#define LOCK_HELD_TSC(lock)     (&(lock)->acquiredTsc)
+#define LOCK_HELD(lock)         (lock)->site, (lock)->acquiredTsc
+#else
+#define LOCK_HELD_SITE(lock)    nullptr
+#define LOCK_HELD_TSC(lock)     nullptr
+#define LOCK_HELD(lock)         nullptr, 0
+#endif
+
+
+//-------------------------------------------------------------------------------------------------
+// ticket locks
+//-------------------------------------------------------------------------------------------------
+inline void ticketLockAcquireAt(_Inout_ TicketLock* lock, _Inout_opt_ LockSite* site)
+{
+    const long ticket = _InterlockedExchangeAdd(&lock->next, 1);
+    const uint64_t spinStart = lockSpinStart();
+    const bool contended = (lock->owner != ticket);
+
+    while (lock->owner != ticket)
+    {
+        cpu_relax();
+    }
+
+    // loads aren't reordered with older loads, so only the compiler needs holding back.
+    _ReadWriteBarrier();
+    lockNoteAcquired(LOCK_HELD_SITE(lock), LOCK_HELD_TSC(lock), site, spinStart, contended);
+}
+
+_Check_return_
+inline bool ticketLockTryAcquireAt(_Inout_ TicketLock* lock, _Inout_opt_ LockSite* site)
+{
+    // only take a ticket if it would be served right away.
+    const long owner = lock->owner;
+    if (_InterlockedCompareExchange(&lock->next, owner + 1, owner) != owner)
+    {
+        return false;
+    }
+
+    lockNoteAcquired(LOCK_HELD_SITE(lock), LOCK_HELD_TSC(lock), site, lockSpinStart(), false);
+    return true;
+}
+
+inline void ticketLockRelease(_Inout_ TicketLock* lock)
+{
+    lockNoteReleasing(LOCK_HELD(lock));
+
+    // only the holder writes owner, and stores aren't reordered with older stores.
+    _ReadWriteBarrier();
+    lock->owner = lock->owner + 1;
+}
+
+_Check_return_
+inline bool ticketLockAcquireIrqSaveAt(_Inout_ TicketLock* lock, _Inout_opt_ LockSite* site)
+{
+    const bool enabled = idtDisableInterrupts();
+    ticketLockAcquireAt(lock, site);
+    return enabled;
+}
+
+inline void ticketLockReleaseIrqRestore(_Inout_ TicketLock* lock, bool enabled)
+{
+    ticketLockRelease(lock);
+    idtRestoreInterrupts(enabled);
+}
+
+//! \brief  Acquires a ticket lock, spinning until it's free.
+#define ticketLockAcquire(lock)         ticketLockAcquireAt((lock), LOCK_SITE())
+
+//! \brief  Acquires a ticket lock if it's free. Returns whether it was acquired.
+#define ticketLockTryAcquire(lock)      ticketLockTryAcquireAt((lock), LOCK_SITE())
+
+//! \brief  Disables interrupts and acquires a ticket lock. Returns whether interrupts were
+//!         enabled, to pass to ticketLockReleaseIrqRestore.
+#define ticketLockAcquireIrqSave(lock)  ticketLockAcquireIrqSaveAt((lock), LOCK_SITE())
+
+
+//-------------------------------------------------------------------------------------------------
+// MCS locks
+//-------------------------------------------------------------------------------------------------
+inline void mcsLockAcquireAt(_Inout_ McsLock* lock, _Out_ McsNode* node, _Inout_opt_ LockSite* site)
+{
+    node->next = nullptr;
+    node->waiting = 1;
+
+    McsNode* prev = (McsNode*)_InterlockedExchangePointer((void* volatile*)&lock->tail, node);
+    const uint64_t spinStart = lockSpinStart();
+
+    if (prev != nullptr)
+    {
+        // queue behind the previous tail; it hands the lock over by clearing waiting.
+        prev->next = node;
+
+        while (node->waiting != 0)
+        {
+            cpu_relax();
+        }
+    }
+
+    _ReadWriteBarrier();
+    lockNoteAcquired(LOCK_HELD_SITE(lock), LOCK_HELD_TSC(lock), site, spinStart, prev != nullptr);
+}
+
+inline void mcsLockRelease(_Inout_ McsLock* lock, _Inout_ McsNode* node)
+{
+    lockNoteReleasing(LOCK_HELD(lock));
+    _ReadWriteBarrier();
+
+    McsNode* next = node->next;
+
+    if (next == nullptr)
+    {
+        // nobody queued: empty the queue, unless someone has swapped themselves in as the tail
+        // and just hasn't linked up yet.
+        if (_InterlockedCompareExchangePointer((void* volatile*)&lock->tail, nullptr, node) == node)
+        {
+            return;
+        }
+
+        while ((next = node->next) == nullptr)
+        {
+            cpu_relax();
+        }
+    }
+
+    next->waiting = 0;
+}
+
+_Check_return_
+inline bool mcsLockAcquireIrqSaveAt(
+    _Inout_ McsLock* lock,
+    _Out_ McsNode* node,
+    _Inout_opt_ LockSite* site)
+{
+    const bool enabled = idtDisableInterrupts();
+    mcsLockAcquireAt(lock, node, site);
+    return enabled;
+}
+
+inline void mcsLockReleaseIrqRestore(_Inout_ McsLock* lock, _Inout_ McsNode* node, bool enabled)
+{
+    mcsLockRelease(lock, node);
+    idtRestoreInterrupts(enabled);
+}
+
+//! \brief  Acquires an MCS lock, queueing on node until it's free.
+#define mcsLockAcquire(lock, node)          mcsLockAcquireAt((lock), (node), LOCK_SITE())
+
+//! \brief  Disables interrupts and acquires an MCS lock. Returns whether interrupts were enabled,
+//!         to pass to mcsLockReleaseIrqRestore.
+#define mcsLockAcquireIrqSave(lock, node)   mcsLockAcquireIrqSaveAt((lock), (node), LOCK_SITE())
+
+
+//-------------------------------------------------------------------------------------------------
+// reader-writer locks
+//-------------------------------------------------------------------------------------------------
+inline void rwLockAcquireReadAt(_Inout_ RwSpinLock* lock, _Inout_opt_ LockSite* site)
+{
+    const uint64_t spinStart = lockSpinStart();
+    bool contended = false;
+
+    for (;;)
+    {
+        const long state = lock->state;
+
+        if ((state & (RWLOCK_Writer | RWLOCK_WriterWaiting)) == 0)
+        {
+            if (_InterlockedCompareExchange(&lock->state, state + RWLOCK_Reader, state) == state)
+            {
+                break;
+            }
+        }
+
+        contended = true;
+        cpu_relax();
+    }
+
+    // readers share the lock, so only the counts are kept; the hold time is a writer's.
+#if NOS_LOCK_PROFILING
+    lockProfileAcquired(site, __rdtsc() - spinStart, contended);
+#else
+    (void)site;
+    (void)spinStart;
+    (void)contended;
+#endif
+}
+
+inline void rwLockReleaseRead(_Inout_ RwSpinLock* lock)
+{
+    _InterlockedExchangeAdd(&lock->state, -RWLOCK_Reader);
+}
+
+inline void rwLockAcquireWriteAt(_Inout_ RwSpinLock* lock, _Inout_opt_ LockSite* site)
+{
+    const uint64_t spinStart = lockSpinStart();
+    bool contended = false;
+
+    for (;;)
+    {
+        const long state = lock->state;
+
+        // taking the lock clears the waiting bit; any other waiting writer sets it again.
+        if ((state & ~RWLOCK_WriterWaiting) == 0)
+        {
+            if (_InterlockedCompareExchange(&lock->state, RWLOCK_Writer, state) == state)
+            {
+                break;
+            }
+        }
+        else if ((state & RWLOCK_WriterWaiting) == 0)
+        {
+            _InterlockedOr(&lock->state, RWLOCK_WriterWaiting);
+        }
+
+        contended = true;
+        cpu_relax();
+    }
+
+    lockNoteAcquired(LOCK_HELD_SITE(lock), LOCK_HELD_TSC(lock), site, spinStart, contended);
+}
+
+inline void rwLockReleaseWrite(_Inout_ RwSpinLock* lock)
+{
+    lockNoteReleasing(LOCK_HELD(lock));
+    _InterlockedAnd(&lock->state, ~RWLOCK_Writer);
+}
+
+_Check_return_
+inline bool rwLockAcquireReadIrqSaveAt(_Inout_ RwSpinLock* lock, _Inout_opt_ LockSite* site)
+{
+    const bool enabled = idtDisableInterrupts();
+    rwLockAcquireReadAt(lock, site);
+    return enabled;
+}
+
+inline void rwLockReleaseReadIrqRestore(_Inout_ RwSpinLock* lock, bool enabled)
+{
+    rwLockReleaseRead(lock);
+    idtRestoreInterrupts(enabled);
+}
+
+_Check_return_
+inline bool rwLockAcquireWriteIrqSaveAt(_Inout_ RwSpinLock* lock, _Inout_opt_ LockSite* site)
+{
+    const bool enabled = idtDisableInterrupts();
+    rwLockAcquireWriteAt(lock, site);
+    return enabled;
+}
+
+inline void rwLockReleaseWriteIrqRestore(_Inout_ RwSpinLock* lock, bool enabled)
+{
+    rwLockReleaseWrite(lock);
+    idtRestoreInterrupts(enabled);
+}
+
+//! \brief  Acquires a reader-writer lock for reading.
+#define rwLockAcquireRead(lock)             rwLockAcquireReadAt((lock), LOCK_SITE())
+
+//! \brief  Acquires a reader-writer lock for writing.
+#define rwLockAcquireWrite(lock)            rwLockAcquireWriteAt((lock), LOCK_SITE())
+
+//! \brief  Disables interrupts and acquires a reader-writer lock for reading. Returns whether
+//!         interrupts were enabled, to pass to rwLockReleaseReadIrqRestore.
+#define rwLockAcquireReadIrqSave(lock)      rwLockAcquireReadIrqSaveAt((lock), LOCK_SITE())
+
+//! \brief  Disables interrupts and acquires a reader-writer lock for writing. Returns whether
+//!         interrupts were enabled, to pass to rwLockReleaseWriteIrqRestore.
+#define rwLockAcquireWriteIrqSave(lock)     rwLockAcquireWriteIrqSaveAt((lock), LOCK_SITE())
+
+NOS_END_EXTERN_C
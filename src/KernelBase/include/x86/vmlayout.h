@@ -0,0 +1,37 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Defines the layout of the kernel's virtual address space on x86.
+//!
+//! \details
+//! |   Range                       | Contents                                                  |
+//! |-------------------------------|-----------------------------------------------------------|
+//! | `00000000` - `00000FFF`       | Not mapped, so null pointer accesses fault.               |
+//! | `00001000` - direct map limit | Identity map of physical memory.                          |
+//! | `C0000000` - `DFFFFFFF`       | Direct map of physical memory (the kernel's higher half). |
+//! | `E0000000` - `EFFFFFFF`       | Virtually contiguous allocations (vmAllocate).            |
+//! | `F0000000` - `FFBFFFFF`       | Demand-faulted kernel heap (kheapReserve).                |
+//! | `FFC00000` - `FFFFFFFF`       | Fixed per-CPU temporary mapping slots (kmapAtomic).       |
+//!
+//! The kernel is still linked at (and runs from) its physical load address, so the identity map
+//! stays in place alongside the direct map. All pointers handed out by the physical memory
+//! manager remain valid, since pmAllocatePages only uses the memory that fits in the direct map.
+//! Memory above that is only handed out as frames (pmAllocateFrame), and reached through vmMap
+//! or the kmapAtomic slots.
+//-------------------------------------------------------------------------------------------------
+#pragma once
+#include "kstdint.h"
+
+enum VmLayout : uintptr_t
+{
+    VM_DirectMapBase = 0xC0000000,      //!< Base of the direct map of physical memory.
+    VM_DirectMapSize = 0x20000000,      //!< Maximum amount of physical memory that is mapped.
+
+    VM_VmallocBase   = 0xE0000000,      //!< Base of the virtually contiguous allocation window.
+    VM_VmallocSize   = 0x10000000,      //!< Size of the virtually contiguous allocation window.
+
+    VM_HeapBase      = 0xF0000000,      //!< Base of the demand-faulted heap region.
+    VM_HeapSize      = 0x0FC00000,      //!< Size of the demand-faulted heap region.
+
+    VM_FixmapBase    = 0xFFC00000,      //!< Base of the temporary mapping slots.
+    VM_FixmapSize    = 0x00400000,      //!< Size of the slots window (one page table's worth).
+};
@@ -0,0 +1,214 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the arena allocator.
+//-------------------------------------------------------------------------------------------------
+#include "arena.h"
+#include "physmem.h"
+#include "kstddef.h"
+#include "kstdint.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static uintptr_t ChunkBase(_In_ const ArenaChunk* chunk);
+static uintptr_t ChunkEnd(_In_ const ArenaChunk* chunk);
+static size_t CurrentChunkUsed(_In_ const Arena* arena);
+
+_Check_return_ _Success_(return != nullptr)
+static ArenaChunk* AllocateChunk(uint32_t pageCount);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void arenaInitialize(Arena* arena, uint32_t chunkPages)
+{
+    arena->cursor = 0;
+    arena->limit = 0;
+    arena->chunks = nullptr;
+    arena->chunkPages = MAX(chunkPages, 1u);
+    arena->resetCount = 0;
+    arena->retiredBytes = 0;
+    arena->highWater = 0;
+}
+
+_Use_decl_annotations_
+void* arenaAllocateSlow(Arena* arena, size_t cb, size_t alignment)
+{
+    const size_t pageSize = (size_t)pmPageSize();
+    const size_t defaultCapacity = arena->chunkPages * pageSize - sizeof(ArenaChunk);
+
+    // worst case, the chunk's data start needs (alignment - 1) bytes of padding.
+    if (cb > SIZE_MAX - sizeof(ArenaChunk) - alignment)
+    {
+        return nullptr;
+    }
+
+    const size_t required = cb + (alignment - 1);
+
+    if (required > defaultCapacity)
+    {
+        // too big for a regular chunk - give it a chunk of its own, and link it in behind the
+        // current chunk so the current chunk's remaining space isn't wasted.
+        const size_t pages = (sizeof(ArenaChunk) + required + pageSize - 1) / pageSize;
+        if (pages > UINT32_MAX)
+        {
+            return nullptr;
+        }
+
+        ArenaChunk* chunk = AllocateChunk((uint32_t)pages);
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+
+        uintptr_t ptr = (ChunkBase(chunk) + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+
+        if (arena->chunks != nullptr)
+        {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        else
+        {
+            // no current chunk yet, so this one becomes current. It's full, so the next small
+            // allocation will move on to a regular chunk.
+            chunk->next = nullptr;
+            arena->chunks = chunk;
+            arena->limit = ChunkEnd(chunk);
+            arena->cursor = ptr + cb;
+            return (void*)ptr;
+        }
+
+        arena->retiredBytes += (ptr + cb) - ChunkBase(chunk);
+        return (void*)ptr;
+    }
+
+    ArenaChunk* chunk = AllocateChunk(arena->chunkPages);
+    if (chunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (arena->chunks != nullptr)
+    {
+        arena->retiredBytes += CurrentChunkUsed(arena);
+    }
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->cursor = ChunkBase(chunk);
+    arena->limit = ChunkEnd(chunk);
+
+    uintptr_t ptr = (arena->cursor + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+    arena->cursor = ptr + cb;
+    return (void*)ptr;
+}
+
+_Use_decl_annotations_
+void arenaReset(Arena* arena)
+{
+    if (arena->chunks == nullptr)
+    {
+        return;
+    }
+
+    const size_t used = arena->retiredBytes + CurrentChunkUsed(arena);
+    arena->highWater = MAX(arena->highWater, used);
+    arena->resetCount++;
+
+    // keep the oldest chunk around, since the arena is likely to need it again.
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk->next != nullptr)
+    {
+        ArenaChunk* next = chunk->next;
+        pmFree(chunk, chunk->pageCount);
+        chunk = next;
+    }
+
+    arena->chunks = chunk;
+    arena->cursor = ChunkBase(chunk);
+    arena->limit = ChunkEnd(chunk);
+    arena->retiredBytes = 0;
+}
+
+_Use_decl_annotations_
+void arenaDestroy(Arena* arena)
+{
+    arenaReset(arena);
+
+    if (arena->chunks != nullptr)
+    {
+        pmFree(arena->chunks, arena->chunks->pageCount);
+    }
+
+    arena->chunks = nullptr;
+    arena->cursor = 0;
+    arena->limit = 0;
+}
+
+_Use_decl_annotations_
+void arenaGetStats(const Arena* arena, ArenaStats* stats)
+{
+    stats->bytesUsed = 0;
+    stats->bytesReserved = 0;
+    stats->chunkCount = 0;
+    stats->resetCount = arena->resetCount;
+
+    if (arena->chunks != nullptr)
+    {
+        stats->bytesUsed = arena->retiredBytes + CurrentChunkUsed(arena);
+    }
+
+    for (const ArenaChunk* chunk = arena->chunks;
+        chunk != nullptr;
+        chunk = chunk->next)
+    {
+        stats->bytesReserved += chunk->pageCount * (size_t)pmPageSize();
+        stats->chunkCount++;
+    }
+
+    stats->highWater = MAX(arena->highWater, stats->bytesUsed);
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+uintptr_t ChunkBase(const ArenaChunk* chunk)
+{
+    return (uintptr_t)(chunk + 1);
+}
+
+_Use_decl_annotations_
+uintptr_t ChunkEnd(const ArenaChunk* chunk)
+{
+    return (uintptr_t)chunk + chunk->pageCount * (uintptr_t)pmPageSize();
+}
+
+_Use_decl_annotations_
+size_t CurrentChunkUsed(const Arena* arena)
+{
+    return arena->cursor - ChunkBase(arena->chunks);
+}
+
+_Use_decl_annotations_
+ArenaChunk* AllocateChunk(uint32_t pageCount)
+{
+    ArenaChunk* chunk = (ArenaChunk*)pmAllocatePages(pageCount, nullptr);
+
+    if (chunk != nullptr)
+    {
+        chunk->next = nullptr;
+        chunk->pageCount = pageCount;
+        chunk->padding = 0;
+    }
+
+    return chunk;
+}
+
+NOS_END_EXTERN_C
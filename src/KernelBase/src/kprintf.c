@@ -16,6 +16,7 @@ static const char UpperDigits[] = { '0','1','2','3','4','5','6','7','8','9', 'A'
 enum //constants
 {
     IntegerBufLen = 64,
+    OutputBufLen = 128,         //!< Output gathered before it's handed to the stream.
 };
 
 
@@ -93,6 +94,14 @@ typedef long double floatmax_t;
 #endif // NOS_FLOAT_SUPPORT
 
 
+typedef struct tag_output_buffer
+{
+    const kprintf_stream* stream;
+    size_t length;
+    char data[OutputBufLen];
+} output_buffer;
+
+
 //-------------------------------------------------------------------------------------------------
 // format_spec interactions
 //-------------------------------------------------------------------------------------------------
@@ -668,33 +677,86 @@ static char* unsigned_to_string(
 }
 
 
-inline void write_chars(_In_ const kprintf_stream* stream, char ch, int count)
+//-------------------------------------------------------------------------------------------------
+// output buffering
+//-------------------------------------------------------------------------------------------------
+static void output_flush(_Inout_ output_buffer* out)
 {
-    for (int i = 0; i < count; i++)
+    if (out->length == 0)
+    {
+        return;
+    }
+
+    if (out->stream->writeN != NULL)
+    {
+        out->stream->writeN(out->data, out->length);
+    }
+    else
     {
-        stream->write(ch);
+        for (size_t i = 0; i < out->length; i++)
+        {
+            out->stream->write(out->data[i]);
+        }
     }
+
+    out->length = 0;
 }
 
-inline void write_string_length(_In_ const kprintf_stream* stream, _In_z_ const char* psz, int length)
+inline void output_char(_Inout_ output_buffer* out, char ch)
 {
-    for (int i = 0;
-         *psz != 0 && i < length;
-         i++, psz++)
+    if (out->length == OutputBufLen)
     {
-        stream->write(*psz);
+        output_flush(out);
     }
+
+    out->data[out->length++] = ch;
 }
 
-inline void write_string(_In_ const kprintf_stream* stream, _In_z_ const char* psz)
+static void output_chars(_Inout_ output_buffer* out, _In_reads_(count) const char* chars, size_t count)
 {
-    for (; *psz != 0; psz++)
+    while (count > 0)
     {
-        stream->write(*psz);
+        if (out->length == OutputBufLen)
+        {
+            output_flush(out);
+        }
+
+        const size_t space = OutputBufLen - out->length;
+        const size_t chunk = (count < space) ? count : space;
+
+        memcpy(out->data + out->length, chars, chunk);
+        out->length += chunk;
+        chars += chunk;
+        count -= chunk;
     }
 }
 
-static void output_string(_In_ const kprintf_stream* stream, _In_ const char* psz, _In_ const format_spec* spec)
+
+inline void write_chars(_Inout_ output_buffer* out, char ch, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        output_char(out, ch);
+    }
+}
+
+inline void write_string_length(_Inout_ output_buffer* out, _In_z_ const char* psz, int length)
+{
+    int available = 0;
+    while (available < length && psz[available] != 0)
+    {
+        available++;
+    }
+
+    output_chars(out, psz, (size_t)available);
+}
+
+inline void write_string(_Inout_ output_buffer* out, _In_z_ const char* psz)
+{
+    output_chars(out, psz, strlen(psz));
+}
+
+static void output_string(_Inout_ output_buffer* out, _In_ const char* psz, _In_ const format_spec* spec)
 {
     const int len = (int)strlen(psz);
 
@@ -707,27 +769,27 @@ static void output_string(_In_ const kprintf_stream* stream, _In_ const char* ps
     if (padSize > 0
         && !has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 
-    write_string_length(stream, psz, valueLen);
+    write_string_length(out, psz, valueLen);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
 //-------------------------------------------------------------------------------------------------
 // printing functions
 //-------------------------------------------------------------------------------------------------
-static void format_percent(_In_ const kprintf_stream* stream)
+static void format_percent(_Inout_ output_buffer* out)
 {
-    stream->write('%');
+    output_char(out, '%');
 }
 
-static void format_character(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_character(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
 #if NOS_PRINTF_WCHAR_SUPPORT
 
@@ -744,11 +806,11 @@ static void format_character(_In_ const kprintf_stream* stream, _In_ const forma
         buffer[0] = (char)va_arg(*ap, int);
         buffer[1] = 0;
 
-        output_string(stream, buffer, spec);
+        output_string(out, buffer, spec);
     }
 }
 
-static void format_string(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_string(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
 #if NOS_PRINTF_WCHAR_SUPPORT
 
@@ -762,11 +824,11 @@ static void format_string(_In_ const kprintf_stream* stream, _In_ const format_s
 
     {
         const char* psz = va_arg(*ap, char*);
-        output_string(stream, psz, spec);
+        output_string(out, psz, spec);
     }
 }
 
-static void format_decimal(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_decimal(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
     const int width         = get_format_padding(spec, ap, 0);
     const int precision     = get_format_precision(spec, ap, 1);    /// The default precision is 1
@@ -813,36 +875,36 @@ static void format_decimal(_In_ const kprintf_stream* stream, _In_ const format_
         {
             if (printSign)
             {
-                stream->write(sign);
+                output_char(out, sign);
             }
 
-            write_chars(stream, '0', padSize);
+            write_chars(out, '0', padSize);
         }
         else
         {
-            stream->write(' ');
+            output_char(out, ' ');
 
             if (printSign)
             {
-                stream->write(sign);
+                output_char(out, sign);
             }
         }
     }
     else if (printSign)
     {
-        stream->write(sign);
+        output_char(out, sign);
     }
 
-    write_string(stream, pszValue);
+    write_string(out, pszValue);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
-static void format_octal(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_octal(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
     const int width         = get_format_padding(spec, ap, 0);
     const int precision     = get_format_precision(spec, ap, 1);    /// The default precision is 1
@@ -882,41 +944,41 @@ static void format_octal(_In_ const kprintf_stream* stream, _In_ const format_sp
             if (printBase)
             {
                 // base indicator
-                stream->write('0');
+                output_char(out, '0');
             }
 
             // zero padding
-            write_chars(stream, '0', padSize);
+            write_chars(out, '0', padSize);
         }
         else
         {
             // space padding
-            write_chars(stream, ' ', padSize);
+            write_chars(out, ' ', padSize);
 
             /// (see alternative form flag above)
             if (printBase)
             {
                 // base indicator
-                stream->write('0');
+                output_char(out, '0');
             }
         }
     }
     else if (printBase)
     {
         /// (see alternative form flag above)
-        stream->write('0');
+        output_char(out, '0');
     }
 
-    write_string(stream, pszValue);
+    write_string(out, pszValue);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
-static void format_hex(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_hex(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
     const int width         = get_format_padding(spec, ap, 0);
     const int precision     = get_format_precision(spec, ap, 1);    /// The default precision is 1
@@ -957,43 +1019,43 @@ static void format_hex(_In_ const kprintf_stream* stream, _In_ const format_spec
             if (printBase)
             {
                 // base indicator
-                stream->write('0');
-                stream->write(x);
+                output_char(out, '0');
+                output_char(out, x);
             }
 
             // zero padding
-            write_chars(stream, '0', padSize);
+            write_chars(out, '0', padSize);
         }
         else
         {
             // space padding
-            write_chars(stream, ' ', padSize);
+            write_chars(out, ' ', padSize);
 
             if (printBase)
             {
                 // base indicator
-                stream->write('0');
-                stream->write(x);
+                output_char(out, '0');
+                output_char(out, x);
             }
         }
     }
     else if (printBase)
     {
         // base indicator
-        stream->write('0');
-        stream->write(x);
+        output_char(out, '0');
+        output_char(out, x);
     }
 
-    write_string(stream, pszValue);
+    write_string(out, pszValue);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
-static void format_unsigned(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_unsigned(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
     const int width         = get_format_padding(spec, ap, 0);
     const int precision     = get_format_precision(spec, ap, 1);    /// The default precision is 1
@@ -1026,25 +1088,25 @@ static void format_unsigned(_In_ const kprintf_stream* stream, _In_ const format
             && precision_kind(spec) == PK_Default)
         {
             // zero padding
-            write_chars(stream, '0', padSize);
+            write_chars(out, '0', padSize);
         }
         else
         {
             // space padding
-            write_chars(stream, ' ', padSize);
+            write_chars(out, ' ', padSize);
         }
     }
 
-    write_string(stream, pszValue);
+    write_string(out, pszValue);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
-static void format_pointer(_In_ const kprintf_stream* stream, _In_ const format_spec* spec, _In_ va_list* ap)
+static void format_pointer(_Inout_ output_buffer* out, _In_ const format_spec* spec, _In_ va_list* ap)
 {
     const int width = get_format_padding(spec, ap, 0);
 
@@ -1072,15 +1134,15 @@ static void format_pointer(_In_ const kprintf_stream* stream, _In_ const format_
     if (padSize > 0
         && !has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 
-    write_string(stream, pszVal);
+    write_string(out, pszVal);
 
     if (padSize > 0
         && has_flag(spec, FF_LeftJustify))
     {
-        write_chars(stream, ' ', padSize);
+        write_chars(out, ' ', padSize);
     }
 }
 
@@ -1104,20 +1166,27 @@ _Use_decl_annotations_
 void kvprintf(const kprintf_stream* stream, const char* fmt, va_list args)
 {
     if (stream == NULL
-        || stream->write == NULL)
+        || (stream->write == NULL && stream->writeN == NULL))
     {
         //TODO: kassert(false)
         return;
     }
 
+    // the output is gathered here and handed over in runs, rather than a call per character.
+    output_buffer out;
+    out.stream = stream;
+    out.length = 0;
+
     while (*fmt != 0)
     {
+        const char* literal = fmt;
         while (*fmt != '%' && *fmt != 0)
         {
-            stream->write(*fmt);
             fmt++;
         }
 
+        output_chars(&out, literal, (size_t)(fmt - literal));
+
         if (*fmt == '%')
         {
             format_spec spec;
@@ -1158,32 +1227,32 @@ void kvprintf(const kprintf_stream* stream, const char* fmt, va_list args)
             switch (spec.type)
             {
             case FT_Percent:             // %%
-                format_percent(stream);
+                format_percent(&out);
                 break;
 
             case FT_Character:           // %c
-                format_character(stream, &spec, &args);
+                format_character(&out, &spec, &args);
                 break;
 
             case FT_String:              // %s
-                format_string(stream, &spec, &args);
+                format_string(&out, &spec, &args);
                 break;
 
             case FT_Decimal:             // %d, %i
-                format_decimal(stream, &spec, &args);
+                format_decimal(&out, &spec, &args);
                 break;
 
             case FT_OctalInt:            // %o
-                format_octal(stream, &spec, &args);
+                format_octal(&out, &spec, &args);
                 break;
 
             case FT_HexLower:            // %x
             case FT_HexUpper:            // %X
-                format_hex(stream, &spec, &args);
+                format_hex(&out, &spec, &args);
                 break;
 
             case FT_Unsigned:            // %u
-                format_unsigned(stream, &spec, &args);
+                format_unsigned(&out, &spec, &args);
                 break;
 
 #if NOS_FLOAT_SUPPORT
@@ -1201,7 +1270,7 @@ void kvprintf(const kprintf_stream* stream, const char* fmt, va_list args)
                 break;
 
             case FT_Pointer:             // %p
-                format_pointer(stream, &spec, &args);
+                format_pointer(&out, &spec, &args);
                 break;
 
             default:
@@ -1211,4 +1280,11 @@ void kvprintf(const kprintf_stream* stream, const char* fmt, va_list args)
             }
         }
     }
+
+    output_flush(&out);
+
+    if (stream->flush != NULL)
+    {
+        stream->flush();
+    }
 }
@@ -13,13 +13,23 @@ typedef _Bool   bool;
 #pragma section(".CRT$XCA",    long, read) // First C++ Initializer
 #pragma section(".CRT$XCZ",    long, read) // Last C++ Initializer
 
+// per-CPU counter registrations (see percpu.h) go in .pcpu$m, between these two.
+#pragma section(".pcpu$a",     long, read) // First per-CPU counter
+#pragma section(".pcpu$z",     long, read) // Last per-CPU counter
+
 typedef int (__cdecl *CInitializerFn)();
 typedef void (__cdecl *CppInitializerFn)();
 
+// from percpu.h, which is C++ only
+typedef struct tag_PercpuCounter PercpuCounter;
+void percpuRegisterCounter(PercpuCounter* counter);
+
 __declspec(allocate(".CRT$XIA")) CInitializerFn __xi_a[] = { NULL };     // C initializers (first)
 __declspec(allocate(".CRT$XIZ")) CInitializerFn __xi_z[] = { NULL };     // C initializers (last)
 __declspec(allocate(".CRT$XCA")) CppInitializerFn __xc_a[] = { NULL };   // C++ initializers (first)
 __declspec(allocate(".CRT$XCZ")) CppInitializerFn __xc_z[] = { NULL };   // C++ initializers (last)
+__declspec(allocate(".pcpu$a")) PercpuCounter* __pcpu_a[] = { NULL };    // per-CPU counters (first)
+__declspec(allocate(".pcpu$z")) PercpuCounter* __pcpu_z[] = { NULL };    // per-CPU counters (last)
 
 // MSVC isa availability/favoring
 enum // constants
@@ -41,6 +51,8 @@ uint32_t __isa_available;
 uint32_t __isa_enabled;
 uint32_t __favor;
 
+uint32_t nos_cpu_features;
+
 
 static bool run_global_ctors()
 {
@@ -80,6 +92,20 @@ static bool run_global_ctors()
     return (result == 0);
 }
 
+static void register_percpu_counters()
+{
+    // the linker may pad between contributions to the section, so skip any nulls.
+    for (PercpuCounter** counter = __pcpu_a;
+        counter < __pcpu_z;
+        counter++)
+    {
+        if (*counter != NULL)
+        {
+            percpuRegisterCounter(*counter);
+        }
+    }
+}
+
 static void init_isa_descriptors()
 {
     cpuid_result result;
@@ -148,11 +174,59 @@ static void init_isa_descriptors()
 #endif // NOS_FLOAT_SUPPORT
 }
 
+static void init_cpu_features()
+{
+    cpuid_result result;
+    uint32_t maxFunction;
+
+    nos_cpu_features = 0;
+
+    result = cpuid(0x00);
+    maxFunction = result.eax;
+
+    result = cpuid(0x01);
+    // edx bit
+    //  4 = TSC
+    if ((result.edx & 0x00000010) != 0)
+    {
+        nos_cpu_features |= nos_cpu_TSC;
+    }
+
+    // ecx bit
+    //  3 = MONITOR/MWAIT
+    if ((result.ecx & 0x00000008) != 0
+        && maxFunction >= 0x05)
+    {
+        result = cpuid(0x05);
+        // ecx bit
+        //  0 = MWAIT extensions are enumerated
+        //  1 = interrupts break MWAIT even when disabled
+        if ((result.ecx & 0x00000003) == 0x00000003)
+        {
+            nos_cpu_features |= nos_cpu_Mwait;
+        }
+    }
+
+    result = cpuid((int)0x80000000);
+    if (result.eax >= 0x80000007)
+    {
+        result = cpuid((int)0x80000007);
+        // edx bit
+        //  8 = invariant TSC
+        if ((result.edx & 0x00000100) != 0)
+        {
+            nos_cpu_features |= nos_cpu_InvariantTSC;
+        }
+    }
+}
+
 int nos_krt_init()
 {
     if (run_global_ctors())
     {
+        register_percpu_counters();
         init_isa_descriptors();
+        init_cpu_features();
         return true;
     }
 
@@ -0,0 +1,78 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the per-CPU counter registry.
+//-------------------------------------------------------------------------------------------------
+#include "percpu.h"
+#include "cpu.h"
+#include "kprintf.h"
+#include "kstddef.h"
+#include "kstdint.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static PercpuCounter* g_counters[CPU_CounterCount];     //!< The counter in each slot.
+static uint32_t g_nextSlot = 1;                         //!< Slot 0 is for unregistered counters.
+static uint32_t g_droppedCount;                         //!< Counters there was no slot for.
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void percpuRegisterCounter(PercpuCounter* counter)
+{
+    // registration happens once, on the boot processor, before anything else can run.
+    if (counter->slot != 0)
+    {
+        return;
+    }
+
+    if (g_nextSlot == CPU_CounterCount)
+    {
+        g_droppedCount++;
+        return;
+    }
+
+    // counts made before now went to slot 0, and are lost.
+    counter->slot = g_nextSlot++;
+    g_counters[counter->slot] = counter;
+}
+
+_Use_decl_annotations_
+uint64_t percpuRead(const PercpuCounter* counter)
+{
+    if (counter->slot == 0)
+    {
+        return 0;
+    }
+
+    uint64_t total = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        total += ((volatile uint32_t*)cpuGetData(cpu)->counters)[counter->slot];
+    }
+
+    return total;
+}
+
+_Use_decl_annotations_
+void percpuPrint(const kprintf_stream* stream)
+{
+    kprintf(stream, "   %-30s %12s\n", "counter", "total");
+
+    for (uint32_t slot = 1; slot < g_nextSlot; slot++)
+    {
+        kprintf(stream, "   %-30s %12llu\n", g_counters[slot]->name, percpuRead(g_counters[slot]));
+    }
+
+    if (g_droppedCount != 0)
+    {
+        kprintf(stream, "   (%u counters had no slot; raise CPU_CounterCount)\n", g_droppedCount);
+    }
+}
+
+NOS_END_EXTERN_C
@@ -2,9 +2,18 @@
 //! \file
 //! \brief  Implementation of the physical memory interface.
 //!
-//TODO (multithreading or sooner?): Allocation/Deallocation lock
+//! \details
+//! The bitmap is shared by every processor, and frames are freed from interrupt context (by the
+//! thread switch, for one), so it's only touched with g_bitmapLock held and interrupts disabled.
+//!
+//! Memory is split at the top of the direct map. pmAllocatePages only hands out low memory, below
+//! it, since its callers use the result as a pointer. pmAllocateFrame prefers high memory, whose
+//! frames have no address until they're mapped with vmMap or kmapAtomic.
 //-------------------------------------------------------------------------------------------------
 #include "physmem.h"
+#include "vmlayout.h"
+#include "spinlock.h"
+#include "percpu.h"
 #include "platform.h"
 #include "kstddef.h"
 #include "kstdint.h"
@@ -27,7 +36,7 @@ enum // constants
 {
     // FUTURE: consider smaller pages for low-memory systems
     // FUTURE: consider ability to allocate large pages?
-    PageSize = 4096,    //!< The size of a single page of memory.
+    PageSize = NOS_PAGE_SIZE,   //!< The size of a single page of memory.
 
     BitsPerByte = 8,    //!< The number of bits in a single byte.
 
@@ -39,6 +48,12 @@ enum // constants
 
     BitmapByteSize = PageSize * BitsPerByte,
             //!< The number of bytes tracked by a single byte of the bitmap.
+
+    PeHeaderOffsetField = 0x3C,
+            //!< Offset of the PE header's offset in the image's DOS header.
+
+    PeSizeOfImageField = 0x50,
+            //!< Offset of SizeOfImage in the PE header (the same for PE32 and PE32+).
 };
 
 
@@ -46,8 +61,16 @@ enum // constants
 // data
 //-------------------------------------------------------------------------------------------------
 static uint64_t g_totalMemory;
+static uint64_t g_lowMemoryTop;     //!< The end of the frames pmAllocatePages hands out.
 static uint64_t g_allocatedMemory;
 static bitmap_word_t* g_pageBitmap;
+static TicketLock g_bitmapLock;     //!< Guards g_pageBitmap and g_allocatedMemory.
+
+PERCPU_COUNTER(pmPagesAllocated);
+PERCPU_COUNTER(pmPagesFreed);
+PERCPU_COUNTER(pmAllocationFailures);
+
+extern const uint8_t __ImageBase;   //!< Provided by the linker: the base of the kernel image.
 
 //-------------------------------------------------------------------------------------------------
 // inline/static functions
@@ -68,9 +91,11 @@ extern "C++"
 }
 
 static void ConstructBitmap(uintptr_t address, size_t bitmapSize, _In_ const MemoryMap* mmap);
+static uintptr_t KernelImageEnd(void);
 
 static void MarkUnused(uintptr_t pageAddress);
 static void MarkUsed(uintptr_t pageAddress);
+static uintptr_t AllocateBetween(uintptr_t bottom, uint64_t top, uintptr_t hint, uint32_t pageCount);
 
 _Check_return_ _Success_(return != 0)
 static uintptr_t FindUnused(
@@ -104,12 +129,17 @@ bool pmInitialize(const MemoryMap* mmap)
         }
     }
 
-    // cap the total memory to the max pointer value.
-    if (g_totalMemory > UINTPTR_MAX)
+    // a frame's address has to fit in a uintptr_t (and a page table entry).
+    const uint64_t addressableTop = (uint64_t)UINTPTR_MAX - (PageSize - 1);
+    if (g_totalMemory > addressableTop)
     {
-        g_totalMemory = UINTPTR_MAX;
+        g_totalMemory = addressableTop;
     }
 
+    // frames past the direct map would be handed out as pointers nothing can dereference, so
+    // only pmAllocateFrame goes there.
+    g_lowMemoryTop = MIN(g_totalMemory, (uint64_t)VM_DirectMapSize);
+
     const ptrdiff_t numBitmapWords = static_cast<ptrdiff_t>((g_totalMemory + (BitmapWordSize-1)) / BitmapWordSize);
     const ptrdiff_t bitmapSize = numBitmapWords * sizeof(bitmap_word_t);
     uintptr_t bitmapAddr = 0;
@@ -120,8 +150,9 @@ bool pmInitialize(const MemoryMap* mmap)
         const MemMapEntry* entry = &(mmap->entries[i]);
         if (entry->regionType == MMRT_Usable)
         {
+            // the bitmap is used through its physical address, so it has to be in low memory.
             uint64_t entryTop = entry->base + entry->length;
-            uintptr_t usableTop = (uintptr_t)MIN(entryTop, UINTPTR_MAX);
+            uintptr_t usableTop = (uintptr_t)MIN(entryTop, g_lowMemoryTop);
 
             // make sure the clamped top is inside the region
             if (usableTop > entry->base)
@@ -165,7 +196,12 @@ uint64_t pmTotalMemory()
 
 uint64_t pmAllocatedMemory()
 {
-    return g_allocatedMemory;
+    // a 64-bit read takes two loads here, so it could see half of an update without the lock.
+    const bool enabled = ticketLockAcquireIrqSave(&g_bitmapLock);
+    const uint64_t allocated = g_allocatedMemory;
+    ticketLockReleaseIrqRestore(&g_bitmapLock, enabled);
+
+    return allocated;
 }
 
 _Use_decl_annotations_
@@ -190,39 +226,28 @@ void* pmAllocatePages(uint32_t pageCount, void* hint)
         return nullptr;
     }
 
-    uintptr_t hintAddress = (uintptr_t)hint;
-    if (hintAddress > g_totalMemory)
-    {
-        hintAddress = 0;
-    }
+    // null if we're out of memory
+    return (void*)AllocateBetween(0, g_lowMemoryTop, (uintptr_t)hint, pageCount);
+}
 
-    // search [hint, end) for an open spot
-    uintptr_t foundAddress = FindUnused(hintAddress, g_totalMemory, pageCount);
+uintptr_t pmAllocateFrame(uintptr_t hint)
+{
+    //TODO: kassert(g_pageBitmap != nullptr);
 
-    // search [start, hint) for an open spot if we need to
-    if (foundAddress == 0
-        && hintAddress != 0)
+    // keep low memory for the callers that need it, and only fall back to it once high memory
+    // runs out.
+    uintptr_t frame = 0;
+    if (g_totalMemory > g_lowMemoryTop)
     {
-        foundAddress = FindUnused(0, hintAddress, pageCount);
+        frame = AllocateBetween((uintptr_t)g_lowMemoryTop, g_totalMemory, hint, 1);
     }
 
-    if (foundAddress != 0)
+    if (frame == 0)
     {
-        uintptr_t markAddr = foundAddress;
-
-        for (uint32_t i = 0;
-            i < pageCount;
-            i++, markAddr += PageSize)
-        {
-            MarkUsed(markAddr);
-        }
-
-        g_allocatedMemory += uint64_t{ pageCount } * PageSize;
-        return (void*)foundAddress;
+        frame = AllocateBetween(0, g_lowMemoryTop, hint, 1);
     }
 
-    // out of memory
-    return nullptr;
+    return frame;
 }
 
 _Use_decl_annotations_
@@ -230,6 +255,8 @@ void pmFree(void* ptr, uint32_t pageCount)
 {
     uintptr_t baseAddr = (uintptr_t)ptr;
 
+    const bool enabled = ticketLockAcquireIrqSave(&g_bitmapLock);
+
     for (uint32_t i = 0;
         i < pageCount && baseAddr >= (uintptr_t)ptr && baseAddr < g_totalMemory;
         i++, baseAddr += PageSize)
@@ -239,6 +266,9 @@ void pmFree(void* ptr, uint32_t pageCount)
     }
 
     g_allocatedMemory -= uint64_t{ pageCount } * PageSize;
+
+    ticketLockReleaseIrqRestore(&g_bitmapLock, enabled);
+    percpuAdd(&pmPagesFreed, pageCount);
 }
 
 
@@ -258,10 +288,13 @@ void ConstructBitmap(uintptr_t address, size_t bitmapSize, const MemoryMap* mmap
     {
         const MemMapEntry* entry = &(mmap->entries[i]);
 
-        if (entry->regionType == MMRT_Usable)
+        // anything past the cap isn't tracked, so it stays out of the bitmap altogether.
+        if (entry->regionType == MMRT_Usable
+            && entry->base < g_totalMemory)
         {
             uintptr_t baseAddr = (uintptr_t)PageAlignUp(entry->base);
-            const uintptr_t endAddr = (uintptr_t)PageAlignDown(entry->base + entry->length);
+            const uintptr_t endAddr =
+                (uintptr_t)PageAlignDown(MIN(entry->base + entry->length, g_totalMemory));
 
             while (baseAddr < endAddr)
             {
@@ -288,6 +321,77 @@ void ConstructBitmap(uintptr_t address, size_t bitmapSize, const MemoryMap* mmap
             baseAddr += PageSize;
         }
     }
+
+    // mark everything up to the end of the kernel image as used. This covers the real mode
+    // data, the bootstrap and its stack, the memory map we were handed, and the kernel itself.
+    {
+        uintptr_t baseAddr = 0;
+        const uintptr_t endAddr = MIN(PageAlignUp(KernelImageEnd()), (uintptr_t)g_totalMemory);
+
+        while (baseAddr < endAddr)
+        {
+            MarkUsed(baseAddr);
+            baseAddr += PageSize;
+        }
+    }
+}
+
+uintptr_t AllocateBetween(uintptr_t bottom, uint64_t top, uintptr_t hint, uint32_t pageCount)
+{
+    uintptr_t hintAddress = hint;
+    if (hintAddress < bottom
+        || hintAddress >= top)
+    {
+        hintAddress = bottom;
+    }
+
+    const bool enabled = ticketLockAcquireIrqSave(&g_bitmapLock);
+
+    // search [hint, top) for an open spot
+    uintptr_t foundAddress = FindUnused(hintAddress, top, pageCount);
+
+    // search [bottom, hint) for an open spot if we need to
+    if (foundAddress == 0
+        && hintAddress != bottom)
+    {
+        foundAddress = FindUnused(bottom, hintAddress, pageCount);
+    }
+
+    if (foundAddress != 0)
+    {
+        uintptr_t markAddr = foundAddress;
+
+        for (uint32_t i = 0;
+            i < pageCount;
+            i++, markAddr += PageSize)
+        {
+            MarkUsed(markAddr);
+        }
+
+        g_allocatedMemory += uint64_t{ pageCount } * PageSize;
+    }
+
+    ticketLockReleaseIrqRestore(&g_bitmapLock, enabled);
+
+    if (foundAddress != 0)
+    {
+        percpuAdd(&pmPagesAllocated, pageCount);
+    }
+    else
+    {
+        percpuIncrement(&pmAllocationFailures);
+    }
+
+    return foundAddress;
+}
+
+uintptr_t KernelImageEnd()
+{
+    const uint8_t* image = &__ImageBase;
+    const uint32_t peHeaderOffset = *(const uint32_t*)(image + PeHeaderOffsetField);
+    const uint32_t sizeOfImage = *(const uint32_t*)(image + peHeaderOffset + PeSizeOfImageField);
+
+    return (uintptr_t)image + sizeOfImage;
 }
 
 void MarkUnused(uintptr_t pageAddress)
@@ -316,7 +420,8 @@ void MarkUsed(uintptr_t pageAddress)
 _Use_decl_annotations_
 uintptr_t FindUnused(uintptr_t start, uint64_t end, int numPages)
 {
-    uintptr_t wordAddress = start;
+    // the search goes a whole bitmap word at a time, so it starts at the word holding start.
+    uintptr_t wordAddress = start - (start % BitmapWordSize);
     uintptr_t baseAddress = 0;
     uintptr_t foundAddress = 0;
 
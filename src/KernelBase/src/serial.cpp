@@ -0,0 +1,142 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the COM1 output interface.
+//-------------------------------------------------------------------------------------------------
+#include "serial.h"
+#include "katomic.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+//! \brief  The UART's registers, as offsets from its first port.
+enum UartRegister
+{
+    UART_Data = 0,                  //!< Transmit/receive, or the divisor's low byte with DLAB set.
+    UART_InterruptEnable = 1,       //!< Or the divisor's high byte with DLAB set.
+    UART_FifoControl = 2,
+    UART_LineControl = 3,
+    UART_ModemControl = 4,
+    UART_LineStatus = 5,
+};
+
+enum // constants
+{
+    LineControl8N1 = 0x03,
+    LineControlDlab = 0x80,         //!< Maps the divisor over the first two registers.
+    FifoEnableAndClear = 0xC7,      //!< Enable, clear both FIFOs, 14 byte receive threshold.
+    ModemReady = 0x0F,              //!< DTR, RTS, and OUT1/OUT2.
+    ModemLoopback = 0x1E,           //!< As ModemReady, looped back for the self test.
+    LineStatusTransmitEmpty = 0x20, //!< The transmit FIFO is empty.
+    SelfTestByte = 0xAE,
+    UartClock = 115200,             //!< The divisor's input clock.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static bool g_serialPresent;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline void WriteRegister(UartRegister reg, uint8_t value)
+{
+    __outbyte((unsigned short)(SERIAL_Com1Port + reg), value);
+}
+
+static inline uint8_t ReadRegister(UartRegister reg)
+{
+    return __inbyte((unsigned short)(SERIAL_Com1Port + reg));
+}
+
+static void kprintfWrite(char ch);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool serialInitialize()
+{
+    constexpr uint16_t divisor = UartClock / SERIAL_BaudRate;
+
+    WriteRegister(UART_InterruptEnable, 0);
+    WriteRegister(UART_LineControl, LineControlDlab);
+    WriteRegister(UART_Data, (uint8_t)divisor);
+    WriteRegister(UART_InterruptEnable, (uint8_t)(divisor >> 8));
+    WriteRegister(UART_LineControl, LineControl8N1);
+    WriteRegister(UART_FifoControl, FifoEnableAndClear);
+
+    // with nothing at the port, reads float high and the byte won't come back.
+    WriteRegister(UART_ModemControl, ModemLoopback);
+    WriteRegister(UART_Data, SelfTestByte);
+
+    if (ReadRegister(UART_Data) != SelfTestByte)
+    {
+        g_serialPresent = false;
+        return false;
+    }
+
+    WriteRegister(UART_ModemControl, ModemReady);
+    g_serialPresent = true;
+    return true;
+}
+
+_Use_decl_annotations_
+void serialWrite(const char* chars, size_t count)
+{
+    if (!g_serialPresent)
+    {
+        return;
+    }
+
+    // slots known to be free in the transmit FIFO.
+    uint32_t room = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const bool newline = (chars[i] == '\n');
+
+        for (uint32_t part = newline ? 0 : 1; part < 2; part++)
+        {
+            if (room == 0)
+            {
+                while ((ReadRegister(UART_LineStatus) & LineStatusTransmitEmpty) == 0)
+                {
+                    cpu_relax();
+                }
+
+                room = SERIAL_FifoSize;
+            }
+
+            WriteRegister(UART_Data, (part == 0) ? (uint8_t)'\r' : (uint8_t)chars[i]);
+            room--;
+        }
+    }
+}
+
+const kprintf_stream* serialKPrintfStream()
+{
+    static const kprintf_stream stream = {
+        kprintfWrite,
+        serialWrite,
+        nullptr
+    };
+
+    return &stream;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void kprintfWrite(char ch)
+{
+    serialWrite(&ch, 1);
+}
+
+NOS_END_EXTERN_C
@@ -116,6 +116,8 @@ static void ScrollScreenOne()
     }
 }
 
+static void PrintChars(_In_reads_(count) const char* text, size_t count, int color);
+
 static void SyncCursorPos()
 {
     uint16_t idx = static_cast<uint16_t>(cursorY * VGA_Width + cursorX);
@@ -208,9 +210,42 @@ void vtPrintColoredChar(char ch, int color)
 _Use_decl_annotations_
 void vtPrintColoredString(const char* pszText, int color)
 {
-    while (*pszText != '\0')
+    PrintChars(pszText, strlen(pszText), color);
+    SyncCursorPos();
+}
+
+static void kprintfWrite(char ch)
+{
+    vtPrintChar(ch);
+}
+
+static void kprintfWriteN(const char* chars, size_t count)
+{
+    PrintChars(chars, count, VGA_DefaultColor);
+}
+
+static void kprintfFlush()
+{
+    SyncCursorPos();
+}
+
+static kprintf_stream kprintfVgaTextStream = {
+    kprintfWrite,
+    kprintfWriteN,
+    kprintfFlush
+};
+
+const kprintf_stream* vtKPrintfStream()
+{
+    return &kprintfVgaTextStream;
+}
+
+static void PrintChars(const char* text, size_t count, int color)
+{
+    // the cursor is only moved once the caller is done, since that's four port writes.
+    for (size_t i = 0; i < count; i++)
     {
-        switch (*pszText)
+        switch (text[i])
         {
         case '\t':
             cursorX += (4 - (cursorX % 4));
@@ -226,7 +261,7 @@ void vtPrintColoredString(const char* pszText, int color)
             break;
 
         default:
-            GetSlot(cursorX, cursorY)->Set(*pszText, color);
+            GetSlot(cursorX, cursorY)->Set(text[i], color);
             cursorX++;
             break;
         }
@@ -242,25 +277,7 @@ void vtPrintColoredString(const char* pszText, int color)
             ScrollScreenOne();
             cursorY = VGA_Height - 1;
         }
-
-        pszText++;
     }
-
-    SyncCursorPos();
-}
-
-static void kprintfWrite(char ch)
-{
-    vtPrintChar(ch);
-}
-
-static kprintf_stream kprintfVgaTextStream = {
-    kprintfWrite
-};
-
-const kprintf_stream* vtKPrintfStream()
-{
-    return &kprintfVgaTextStream;
 }
 
 NOS_END_EXTERN_C
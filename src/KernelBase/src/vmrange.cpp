@@ -0,0 +1,247 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the virtual range allocator.
+//-------------------------------------------------------------------------------------------------
+#include "vmrange.h"
+#include "physmem.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,       //!< The size of a single page of memory.
+    BitsPerWord = 32,               //!< The number of bits in a bitmap word.
+    FullWord = 0xFFFFFFFF,          //!< A bitmap word with every bit set.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+bool VirtualRangeAllocator::Initialize(uintptr_t base, uintptr_t size)
+{
+    const uint32_t pageCount = (uint32_t)(size / PageSize);
+    const uint32_t wordCount = (pageCount + BitsPerWord - 1) / BitsPerWord;
+    const uint32_t bitmapPages = (wordCount * sizeof(uint32_t) + PageSize - 1) / PageSize;
+
+    uint32_t* reserved = (uint32_t*)pmAllocatePages(bitmapPages, nullptr);
+    uint32_t* starts = (uint32_t*)pmAllocatePages(bitmapPages, nullptr);
+
+    if (reserved == nullptr || starts == nullptr)
+    {
+        if (reserved != nullptr) pmFree(reserved, bitmapPages);
+        if (starts != nullptr) pmFree(starts, bitmapPages);
+        return false;
+    }
+
+    memset(reserved, 0, bitmapPages * PageSize);
+    memset(starts, 0, bitmapPages * PageSize);
+
+    // pages past the end of the window (in the last word) are never handed out.
+    for (uint32_t page = pageCount; page < wordCount * BitsPerWord; page++)
+    {
+        reserved[page / BitsPerWord] |= (1u << (page % BitsPerWord));
+    }
+
+    m_base = base;
+    m_pageCount = pageCount;
+    m_reserved = reserved;
+    m_starts = starts;
+    m_bitmapPages = bitmapPages;
+    m_nextSearch = 0;
+    m_reservedCount = 0;
+    return true;
+}
+
+uintptr_t VirtualRangeAllocator::Allocate(uint32_t pageCount)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&m_lock);
+    const uintptr_t base = AllocateLocked(pageCount);
+    ticketLockReleaseIrqRestore(&m_lock, enabled);
+
+    return base;
+}
+
+uint32_t VirtualRangeAllocator::Free(uintptr_t address)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&m_lock);
+    const uint32_t released = FreeLocked(address);
+    ticketLockReleaseIrqRestore(&m_lock, enabled);
+
+    return released;
+}
+
+uint32_t VirtualRangeAllocator::RangePages(uintptr_t address)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&m_lock);
+    const uint32_t pages = CountLocked(address);
+    ticketLockReleaseIrqRestore(&m_lock, enabled);
+
+    return pages;
+}
+
+bool VirtualRangeAllocator::IsReserved(uintptr_t address) const
+{
+    return Contains(address)
+        && TestBit(m_reserved, (uint32_t)((address - m_base) / PageSize));
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// private function implementations
+//-------------------------------------------------------------------------------------------------
+uintptr_t VirtualRangeAllocator::AllocateLocked(uint32_t pageCount)
+{
+    if (pageCount == 0
+        || pageCount >= m_pageCount)
+    {
+        return 0;
+    }
+
+    // one extra page for the guard. Search from where the last search left off, so freshly
+    // freed ranges (and their possibly stale TLB entries) aren't immediately reused.
+    const uint32_t needed = pageCount + 1;
+    uint32_t first = FindFree(m_nextSearch, m_pageCount, needed);
+
+    if (first == UINT32_MAX
+        && m_nextSearch != 0)
+    {
+        first = FindFree(0, MIN(m_nextSearch + needed, m_pageCount), needed);
+    }
+
+    if (first == UINT32_MAX)
+    {
+        return 0;
+    }
+
+    SetBit(m_starts, first);
+    for (uint32_t page = first; page < first + pageCount; page++)
+    {
+        SetBit(m_reserved, page);
+    }
+
+    SetBit(m_starts, first + pageCount);
+
+    m_nextSearch = first + needed;
+    if (m_nextSearch >= m_pageCount)
+    {
+        m_nextSearch = 0;
+    }
+
+    m_reservedCount += pageCount;
+    return m_base + (uintptr_t)first * PageSize;
+}
+
+uint32_t VirtualRangeAllocator::FreeLocked(uintptr_t address)
+{
+    const uint32_t released = CountLocked(address);
+    if (released == 0)
+    {
+        return 0;
+    }
+
+    const uint32_t first = (uint32_t)((address - m_base) / PageSize);
+
+    ClearBit(m_starts, first);
+
+    for (uint32_t page = first; page < first + released; page++)
+    {
+        ClearBit(m_reserved, page);
+    }
+
+    // release the guard page.
+    if (first + released < m_pageCount)
+    {
+        ClearBit(m_starts, first + released);
+    }
+
+    m_reservedCount -= released;
+    return released;
+}
+
+uint32_t VirtualRangeAllocator::CountLocked(uintptr_t address) const
+{
+    if (!Contains(address)
+        || (address % PageSize) != 0)
+    {
+        return 0;
+    }
+
+    const uint32_t first = (uint32_t)((address - m_base) / PageSize);
+    if (!TestBit(m_starts, first)
+        || !TestBit(m_reserved, first))
+    {
+        return 0;
+    }
+
+    uint32_t page = first + 1;
+    while (page < m_pageCount
+        && TestBit(m_reserved, page)
+        && !TestBit(m_starts, page))
+    {
+        page++;
+    }
+
+    return page - first;
+}
+
+bool VirtualRangeAllocator::TestBit(const uint32_t* bitmap, uint32_t page) const
+{
+    return (bitmap[page / BitsPerWord] & (1u << (page % BitsPerWord))) != 0;
+}
+
+void VirtualRangeAllocator::SetBit(uint32_t* bitmap, uint32_t page)
+{
+    bitmap[page / BitsPerWord] |= (1u << (page % BitsPerWord));
+}
+
+void VirtualRangeAllocator::ClearBit(uint32_t* bitmap, uint32_t page)
+{
+    bitmap[page / BitsPerWord] &= ~(1u << (page % BitsPerWord));
+}
+
+uint32_t VirtualRangeAllocator::FindFree(uint32_t start, uint32_t end, uint32_t pageCount) const
+{
+    uint32_t runStart = start;
+    uint32_t runLength = 0;
+    uint32_t page = start;
+
+    while (page < end)
+    {
+        const uint32_t word = page / BitsPerWord;
+        const uint32_t occupied = m_reserved[word] | m_starts[word];
+
+        if ((page % BitsPerWord) == 0
+            && occupied == FullWord)
+        {
+            // whole word is taken, skip it.
+            runLength = 0;
+            page += BitsPerWord;
+            runStart = page;
+            continue;
+        }
+
+        if ((occupied & (1u << (page % BitsPerWord))) != 0)
+        {
+            runLength = 0;
+            runStart = page + 1;
+        }
+        else
+        {
+            runLength++;
+            if (runLength == pageCount)
+            {
+                return runStart;
+            }
+        }
+
+        page++;
+    }
+
+    return UINT32_MAX;
+}
@@ -72,6 +72,12 @@ __bochsbreak proc
     ret
 __bochsbreak endp
 
+__enable_and_halt proc
+    sti                     ; takes effect after the hlt starts, so its wakeup can't be missed.
+    hlt
+    ret
+__enable_and_halt endp
+
 
 strlen proc uses rcx rdi, psz:ptr
     cld                     ; make sure we scan in the right direction.
@@ -0,0 +1,212 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of ACPI table discovery.
+//!
+//! \note   Only the RSDT is used. The XSDT holds the same tables with 64-bit addresses, which
+//!         non-PAE paging couldn't map anyway.
+//-------------------------------------------------------------------------------------------------
+#include "acpi.h"
+#include "paging.h"
+#include "vmalloc.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_AcpiRsdp
+{
+    char signature[8];
+    uint8_t checksum;           //!< Covers the first 20 bytes (the ACPI 1.0 structure).
+    char oemId[6];
+    uint8_t revision;
+    uint32_t rsdtAddress;
+} AcpiRsdp;
+
+typedef struct tag_AcpiRsdt
+{
+    AcpiTableHeader header;
+    uint32_t entries[1];        //!< Physical addresses of the other tables.
+} AcpiRsdt;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    EbdaSegmentPointer = 0x40E,     //!< BIOS data area word holding the EBDA's segment.
+    EbdaSearchSize = 1024,          //!< The RSDP is in the first KiB of the EBDA...
+    BiosAreaBase = 0xE0000,         //!< ...or somewhere in the BIOS's read-only area.
+    BiosAreaSize = 0x20000,
+    RsdpAlignment = 16,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static const AcpiRsdt* g_rsdt;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static bool ChecksumIsValid(_In_reads_bytes_(cb) const void* ptr, uint32_t cb)
+{
+    const uint8_t* bytes = (const uint8_t*)ptr;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < cb; i++)
+    {
+        sum += bytes[i];
+    }
+
+    return (sum == 0);
+}
+
+static const AcpiRsdp* FindRsdp(uintptr_t base, uint32_t size);
+static const AcpiTableHeader* MapTable(uintptr_t physicalAddress);
+static const void* MapPhysical(uintptr_t physicalAddress, uint32_t cb);
+static void ReleasePhysical(_In_opt_ const void* ptr);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool acpiInitialize()
+{
+    const uint16_t* ebdaSegment = (const uint16_t*)vmPhysToVirt(EbdaSegmentPointer);
+    const AcpiRsdp* rsdp = nullptr;
+
+    if (ebdaSegment != nullptr
+        && *ebdaSegment != 0)
+    {
+        rsdp = FindRsdp((uintptr_t)*ebdaSegment << 4, EbdaSearchSize);
+    }
+
+    if (rsdp == nullptr)
+    {
+        rsdp = FindRsdp(BiosAreaBase, BiosAreaSize);
+    }
+
+    if (rsdp == nullptr)
+    {
+        return false;
+    }
+
+    const AcpiTableHeader* rsdt = MapTable(rsdp->rsdtAddress);
+    if (rsdt == nullptr
+        || memcmp(rsdt->signature, "RSDT", 4) != 0)
+    {
+        return false;
+    }
+
+    g_rsdt = (const AcpiRsdt*)rsdt;
+    return true;
+}
+
+_Use_decl_annotations_
+const AcpiTableHeader* acpiFindTable(const char* signature)
+{
+    if (g_rsdt == nullptr)
+    {
+        return nullptr;
+    }
+
+    const uint32_t count = (g_rsdt->header.length - sizeof(AcpiTableHeader)) / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const AcpiTableHeader* table = MapTable(g_rsdt->entries[i]);
+
+        if (table != nullptr
+            && memcmp(table->signature, signature, 4) == 0)
+        {
+            return table;
+        }
+
+        ReleasePhysical(table);
+    }
+
+    return nullptr;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+const AcpiRsdp* FindRsdp(uintptr_t base, uint32_t size)
+{
+    const uint8_t* area = (const uint8_t*)MapPhysical(base, size);
+    if (area == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (uint32_t offset = 0; offset + sizeof(AcpiRsdp) <= size; offset += RsdpAlignment)
+    {
+        const AcpiRsdp* rsdp = (const AcpiRsdp*)(area + offset);
+
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0
+            && ChecksumIsValid(rsdp, sizeof(AcpiRsdp)))
+        {
+            return rsdp;
+        }
+    }
+
+    return nullptr;
+}
+
+const AcpiTableHeader* MapTable(uintptr_t physicalAddress)
+{
+    const AcpiTableHeader* header =
+        (const AcpiTableHeader*)MapPhysical(physicalAddress, sizeof(AcpiTableHeader));
+
+    if (header == nullptr)
+    {
+        return nullptr;
+    }
+
+    const uint32_t length = header->length;
+    ReleasePhysical(header);
+
+    if (length < sizeof(AcpiTableHeader))
+    {
+        return nullptr;
+    }
+
+    const AcpiTableHeader* table = (const AcpiTableHeader*)MapPhysical(physicalAddress, length);
+
+    if (table != nullptr
+        && !ChecksumIsValid(table, length))
+    {
+        ReleasePhysical(table);
+        return nullptr;
+    }
+
+    return table;
+}
+
+const void* MapPhysical(uintptr_t physicalAddress, uint32_t cb)
+{
+    // tables in RAM are almost always covered by the direct map. Anything else gets its own
+    // mapping, which is kept for as long as the table is in use.
+    if (physicalAddress + cb <= vmDirectMapLimit())
+    {
+        return vmPhysToVirt(physicalAddress);
+    }
+
+    //FUTURE: reuse the mapping when a table is looked up more than once.
+    return vmMapIo(physicalAddress, cb);
+}
+
+void ReleasePhysical(const void* ptr)
+{
+    // does nothing for pointers into the direct map.
+    vmUnmapIo((void*)ptr);
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,623 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the local APIC and IO APIC interface.
+//-------------------------------------------------------------------------------------------------
+#include "apic.h"
+#include "acpi.h"
+#include "pit.h"
+#include "pic.h"
+#include "idt.h"
+#include "cpu.h"
+#include "vmalloc.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+#pragma pack(push, 1)
+typedef struct tag_MadtHeader
+{
+    AcpiTableHeader header;
+    uint32_t localApicAddress;
+    uint32_t flags;
+} MadtHeader;
+
+typedef struct tag_MadtEntry
+{
+    uint8_t type;
+    uint8_t length;
+} MadtEntry;
+
+typedef struct tag_MadtLocalApic
+{
+    MadtEntry entry;
+    uint8_t processorId;
+    uint8_t apicId;
+    uint32_t flags;
+} MadtLocalApic;
+
+typedef struct tag_MadtIoApic
+{
+    MadtEntry entry;
+    uint8_t ioApicId;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsiBase;
+} MadtIoApic;
+
+typedef struct tag_MadtSourceOverride
+{
+    MadtEntry entry;
+    uint8_t bus;
+    uint8_t source;             //!< The ISA IRQ.
+    uint32_t gsi;               //!< The IO APIC input it's wired to.
+    uint16_t flags;
+} MadtSourceOverride;
+#pragma pack(pop)
+
+typedef struct tag_IoApic
+{
+    volatile uint32_t* registers;
+    uint32_t gsiBase;
+    uint32_t inputCount;
+} IoApic;
+
+typedef struct tag_IsaRoute
+{
+    IoApic* ioApic;             //!< The IO APIC the IRQ is wired to, or null if there isn't one.
+    uint32_t input;             //!< The input of the IO APIC the IRQ is wired to.
+    uint32_t low;               //!< The low half of the redirection entry.
+    uint32_t high;              //!< The high half of the redirection entry (the destination).
+} IsaRoute;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    MaxIoApics = 4,
+    CalibrationMs = 10,
+
+    LapicMappingSize = 0x400,
+    IoApicMappingSize = 0x20,
+
+    CPUID1_EDX_APIC = (1u << 9),
+};
+
+enum MadtBits : uint32_t
+{
+    MADT_LocalApic = 0,
+    MADT_IoApic = 1,
+    MADT_SourceOverride = 2,
+
+    MADT_LocalApicEnabled = (1u << 0),
+
+    MADT_PolarityMask = 0x3,
+    MADT_PolarityActiveLow = 0x3,
+    MADT_TriggerMask = 0xC,
+    MADT_TriggerLevel = 0xC,
+};
+
+//! Local APIC registers, as indices into the register array (their offsets / 4).
+enum LapicRegisters : uint32_t
+{
+    LAPIC_Id = 0x020 / 4,
+    LAPIC_TaskPriority = 0x080 / 4,
+    LAPIC_EndOfInterrupt = 0x0B0 / 4,
+    LAPIC_SpuriousVector = 0x0F0 / 4,
+    LAPIC_InService = 0x100 / 4,            //!< The first of 8 registers, 0x10 bytes apart.
+    LAPIC_InterruptCommandLow = 0x300 / 4,
+    LAPIC_InterruptCommandHigh = 0x310 / 4,
+    LAPIC_LvtTimer = 0x320 / 4,
+    LAPIC_TimerInitialCount = 0x380 / 4,
+    LAPIC_TimerCurrentCount = 0x390 / 4,
+    LAPIC_TimerDivide = 0x3E0 / 4,
+};
+
+enum LapicBits : uint32_t
+{
+    LAPIC_SoftwareEnable = (1u << 8),
+    LAPIC_IdShift = 24,
+    LAPIC_RegisterStride = 0x10 / 4,        //!< Between consecutive registers of a bitmap.
+
+    LVT_Masked = (1u << 16),
+    LVT_TimerPeriodic = (1u << 17),
+
+    TIMER_DivideBy16 = 0x3,
+
+    ICR_DeliveryFixed = (0u << 8),
+    ICR_DeliveryInit = (5u << 8),
+    ICR_DeliveryStartup = (6u << 8),
+    ICR_DeliveryPending = (1u << 12),
+    ICR_LevelAssert = (1u << 14),
+    ICR_DestinationShift = 24,
+};
+
+//! IO APIC registers. IOREGSEL and IOWIN are register array indices; the rest are selected
+//! through IOREGSEL.
+enum IoApicRegisters : uint32_t
+{
+    IOAPIC_RegisterSelect = 0x00 / 4,
+    IOAPIC_Window = 0x10 / 4,
+
+    IOAPIC_Version = 0x01,
+    IOAPIC_RedirectionTable = 0x10,
+};
+
+enum IoApicBits : uint32_t
+{
+    IOAPIC_ActiveLow = (1u << 13),
+    IOAPIC_LevelTriggered = (1u << 15),
+    IOAPIC_Masked = (1u << 16),
+    IOAPIC_DestinationShift = 24,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static volatile uint32_t* g_lapic;
+static uint32_t g_cpuApicIds[CPU_MaxCount];
+static uint32_t g_cpuCount;
+
+static IoApic g_ioApics[MaxIoApics];
+static uint32_t g_ioApicCount;
+static IsaRoute g_isaRoutes[IDT_IrqCount];
+
+static uint32_t g_timerTicksPerMs;
+static InterruptHandler g_timerHandler;
+static void* g_timerContext;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline uint32_t IoApicRead(_In_ const IoApic* ioApic, uint32_t reg)
+{
+    ioApic->registers[IOAPIC_RegisterSelect] = reg;
+    return ioApic->registers[IOAPIC_Window];
+}
+
+static inline void IoApicWrite(_In_ const IoApic* ioApic, uint32_t reg, uint32_t value)
+{
+    ioApic->registers[IOAPIC_RegisterSelect] = reg;
+    ioApic->registers[IOAPIC_Window] = value;
+}
+
+static bool ParseMadt(_In_ const MadtHeader* madt);
+static void AddIoApic(_In_ const MadtIoApic* entry);
+static void WriteRoute(uint32_t irq);
+static void TimerInterrupt(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+static void SendInterruptCommand(uint32_t apicId, uint32_t command);
+
+static void IoApicMask(uint32_t irq);
+static void IoApicUnmask(uint32_t irq);
+static bool IoApicIsSpurious(uint32_t irq);
+static void IoApicEndOfInterrupt(uint32_t irq);
+static bool IoApicSetAffinity(uint32_t irq, uint32_t cpu);
+
+static const IrqController g_ioApicController =
+{
+    "IO APIC",
+    IoApicMask,
+    IoApicUnmask,
+    IoApicIsSpurious,
+    IoApicEndOfInterrupt,
+    IoApicSetAffinity,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool apicInitialize()
+{
+    if ((cpuid(0x01).edx & CPUID1_EDX_APIC) == 0)
+    {
+        return false;
+    }
+
+    const MadtHeader* madt = (const MadtHeader*)acpiFindTable("APIC");
+    if (madt == nullptr
+        || !ParseMadt(madt))
+    {
+        return false;
+    }
+
+    g_lapic = (volatile uint32_t*)vmMapIo(madt->localApicAddress, LapicMappingSize);
+    if (g_lapic == nullptr)
+    {
+        return false;
+    }
+
+    // keep the boot processor at index 0, wherever the MADT listed it.
+    const uint32_t bootId = lapicCurrentId();
+    for (uint32_t i = 1; i < g_cpuCount; i++)
+    {
+        if (g_cpuApicIds[i] == bootId)
+        {
+            g_cpuApicIds[i] = g_cpuApicIds[0];
+            g_cpuApicIds[0] = bootId;
+            break;
+        }
+    }
+
+    cpuGetData(0)->apicId = bootId;
+    lapicInitializeProcessor();
+
+    idtRegisterHandler(IDT_LapicTimerVector, TimerInterrupt, nullptr);
+
+    if (g_ioApicCount == 0)
+    {
+        // the local APIC still works (for its timer), but IRQs have to stay on the PICs.
+        return true;
+    }
+
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        IsaRoute* route = &g_isaRoutes[irq];
+        route->low |= (IDT_IrqBase + irq) | IOAPIC_Masked;
+        route->high = bootId << IOAPIC_DestinationShift;
+
+        WriteRoute(irq);
+    }
+
+    idtSetIrqController(&g_ioApicController);
+    return true;
+}
+
+uint32_t apicCpuCount()
+{
+    return g_cpuCount;
+}
+
+uint32_t apicCpuApicId(uint32_t cpu)
+{
+    return g_cpuApicIds[cpu];
+}
+
+uint32_t lapicCurrentId()
+{
+    return g_lapic[LAPIC_Id] >> LAPIC_IdShift;
+}
+
+void lapicEndOfInterrupt()
+{
+    g_lapic[LAPIC_EndOfInterrupt] = 0;
+}
+
+void lapicInitializeProcessor()
+{
+    g_lapic[LAPIC_TaskPriority] = 0;
+    g_lapic[LAPIC_LvtTimer] = IDT_LapicTimerVector | LVT_Masked;
+    g_lapic[LAPIC_TimerDivide] = TIMER_DivideBy16;
+    g_lapic[LAPIC_SpuriousVector] = IDT_LapicSpuriousVector | LAPIC_SoftwareEnable;
+}
+
+void lapicSendIpi(uint32_t apicId, uint32_t vector)
+{
+    SendInterruptCommand(apicId, ICR_DeliveryFixed | ICR_LevelAssert | vector);
+}
+
+void lapicSendInit(uint32_t apicId)
+{
+    SendInterruptCommand(apicId, ICR_DeliveryInit | ICR_LevelAssert);
+}
+
+void lapicSendStartup(uint32_t apicId, uint32_t page)
+{
+    SendInterruptCommand(apicId, ICR_DeliveryStartup | ICR_LevelAssert | (page & 0xFF));
+}
+
+uint32_t lapicTimerCalibrate()
+{
+    if (g_lapic == nullptr)
+    {
+        return 0;
+    }
+
+    g_lapic[LAPIC_LvtTimer] = IDT_LapicTimerVector | LVT_Masked;
+
+    pitStartCountdown(CalibrationMs * 1000);
+    g_lapic[LAPIC_TimerInitialCount] = UINT32_MAX;
+
+    while (!pitCountdownExpired())
+    {
+        _mm_pause();
+    }
+
+    const uint32_t elapsed = UINT32_MAX - g_lapic[LAPIC_TimerCurrentCount];
+    g_lapic[LAPIC_TimerInitialCount] = 0;
+
+    g_timerTicksPerMs = elapsed / CalibrationMs;
+    return g_timerTicksPerMs;
+}
+
+uint32_t lapicTimerTicksPerMs()
+{
+    return g_timerTicksPerMs;
+}
+
+_Use_decl_annotations_
+void lapicTimerSetHandler(InterruptHandler handler, void* context)
+{
+    const bool enabled = idtDisableInterrupts();
+
+    g_timerHandler = handler;
+    g_timerContext = context;
+
+    idtRestoreInterrupts(enabled);
+}
+
+void lapicTimerStart(uint32_t ticks, bool periodic)
+{
+    g_lapic[LAPIC_LvtTimer] = IDT_LapicTimerVector | (periodic ? LVT_TimerPeriodic : 0);
+    g_lapic[LAPIC_TimerInitialCount] = ticks;
+}
+
+void lapicTimerStop()
+{
+    g_lapic[LAPIC_TimerInitialCount] = 0;
+    g_lapic[LAPIC_LvtTimer] = IDT_LapicTimerVector | LVT_Masked;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+bool ParseMadt(const MadtHeader* madt)
+{
+    // ISA IRQs are wired to the same-numbered inputs, active high and edge triggered, unless
+    // the MADT says otherwise.
+    uint32_t isaGsi[IDT_IrqCount];
+    uint16_t isaFlags[IDT_IrqCount];
+    bool overridden[IDT_IrqCount];
+
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        isaGsi[irq] = irq;
+        isaFlags[irq] = 0;
+        overridden[irq] = false;
+    }
+
+    const uint8_t* next = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+
+    while (next + sizeof(MadtEntry) <= end)
+    {
+        const MadtEntry* entry = (const MadtEntry*)next;
+        if (entry->length < sizeof(MadtEntry))
+        {
+            break;
+        }
+
+        switch (entry->type)
+        {
+        case MADT_LocalApic:
+        {
+            const MadtLocalApic* lapic = (const MadtLocalApic*)entry;
+
+            if ((lapic->flags & MADT_LocalApicEnabled) != 0
+                && g_cpuCount < CPU_MaxCount)
+            {
+                g_cpuApicIds[g_cpuCount++] = lapic->apicId;
+            }
+            break;
+        }
+
+        case MADT_IoApic:
+            AddIoApic((const MadtIoApic*)entry);
+            break;
+
+        case MADT_SourceOverride:
+        {
+            const MadtSourceOverride* sourceOverride = (const MadtSourceOverride*)entry;
+
+            if (sourceOverride->bus == 0
+                && sourceOverride->source < IDT_IrqCount)
+            {
+                isaGsi[sourceOverride->source] = sourceOverride->gsi;
+                isaFlags[sourceOverride->source] = sourceOverride->flags;
+                overridden[sourceOverride->source] = true;
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        next += entry->length;
+    }
+
+    // an IRQ that's only assumed to be wired to its own input isn't, if an override puts another
+    // IRQ there (IRQ 0 on input 2, usually). Routing it anyway would overwrite the override's
+    // entry, so it's left without a route.
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        if (overridden[irq])
+        {
+            continue;
+        }
+
+        for (uint32_t other = 0; other < IDT_IrqCount; other++)
+        {
+            if (overridden[other]
+                && isaGsi[other] == isaGsi[irq])
+            {
+                isaGsi[irq] = UINT32_MAX;
+                break;
+            }
+        }
+    }
+
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        IsaRoute* route = &g_isaRoutes[irq];
+
+        for (uint32_t i = 0; i < g_ioApicCount && isaGsi[irq] != UINT32_MAX; i++)
+        {
+            IoApic* ioApic = &g_ioApics[i];
+
+            if (isaGsi[irq] >= ioApic->gsiBase
+                && isaGsi[irq] - ioApic->gsiBase < ioApic->inputCount)
+            {
+                route->ioApic = ioApic;
+                route->input = isaGsi[irq] - ioApic->gsiBase;
+                break;
+            }
+        }
+
+        route->low = 0;
+
+        if ((isaFlags[irq] & MADT_PolarityMask) == MADT_PolarityActiveLow)
+        {
+            route->low |= IOAPIC_ActiveLow;
+        }
+
+        if ((isaFlags[irq] & MADT_TriggerMask) == MADT_TriggerLevel)
+        {
+            route->low |= IOAPIC_LevelTriggered;
+        }
+    }
+
+    return (g_cpuCount > 0);
+}
+
+void AddIoApic(const MadtIoApic* entry)
+{
+    if (g_ioApicCount >= MaxIoApics)
+    {
+        return;
+    }
+
+    IoApic* ioApic = &g_ioApics[g_ioApicCount];
+    ioApic->registers = (volatile uint32_t*)vmMapIo(entry->address, IoApicMappingSize);
+
+    if (ioApic->registers == nullptr)
+    {
+        return;
+    }
+
+    ioApic->gsiBase = entry->gsiBase;
+    ioApic->inputCount = ((IoApicRead(ioApic, IOAPIC_Version) >> 16) & 0xFF) + 1;
+
+    for (uint32_t input = 0; input < ioApic->inputCount; input++)
+    {
+        IoApicWrite(ioApic, IOAPIC_RedirectionTable + input * 2, IOAPIC_Masked);
+    }
+
+    g_ioApicCount++;
+}
+
+void WriteRoute(uint32_t irq)
+{
+    const IsaRoute* route = &g_isaRoutes[irq];
+    if (route->ioApic == nullptr)
+    {
+        return;
+    }
+
+    // mask the entry while the destination changes, so it's never delivered half updated.
+    const uint32_t reg = IOAPIC_RedirectionTable + route->input * 2;
+    IoApicWrite(route->ioApic, reg, route->low | IOAPIC_Masked);
+    IoApicWrite(route->ioApic, reg + 1, route->high);
+    IoApicWrite(route->ioApic, reg, route->low);
+}
+
+void TimerInterrupt(InterruptFrame* frame, void* context)
+{
+    (void)context;
+
+    // interrupts stay disabled until the handler returns, so acknowledging first is safe - and
+    // means the handler is free to rearm the timer.
+    lapicEndOfInterrupt();
+
+    if (g_timerHandler != nullptr)
+    {
+        g_timerHandler(frame, g_timerContext);
+    }
+}
+
+void SendInterruptCommand(uint32_t apicId, uint32_t command)
+{
+    // writing the low half sends the IPI, so the destination has to be written first - and
+    // nothing else on this processor may send one in between.
+    const bool enabled = idtDisableInterrupts();
+
+    g_lapic[LAPIC_InterruptCommandHigh] = apicId << ICR_DestinationShift;
+    g_lapic[LAPIC_InterruptCommandLow] = command;
+
+    while ((g_lapic[LAPIC_InterruptCommandLow] & ICR_DeliveryPending) != 0)
+    {
+        _mm_pause();
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+void IoApicMask(uint32_t irq)
+{
+    g_isaRoutes[irq].low |= IOAPIC_Masked;
+    WriteRoute(irq);
+}
+
+void IoApicUnmask(uint32_t irq)
+{
+    g_isaRoutes[irq].low &= ~IOAPIC_Masked;
+    WriteRoute(irq);
+}
+
+bool IoApicIsSpurious(uint32_t irq)
+{
+    // the local APIC reports its own spurious interrupts on their own vector, but the masked PICs
+    // can still raise a spurious IRQ 7 or 15 (through LINT0) on the vector the IO APIC uses for
+    // that IRQ. Only the local APIC's deliveries set the vector's in-service bit.
+    if (irq != 7
+        && irq != 15)
+    {
+        return false;
+    }
+
+    const uint32_t vector = IDT_IrqBase + irq;
+    const uint32_t inService = g_lapic[LAPIC_InService + (vector / 32) * LAPIC_RegisterStride];
+
+    if ((inService & (1u << (vector % 32))) != 0)
+    {
+        return false;
+    }
+
+    // it came from the PICs, so it's dropped either way - but a real one still needs their EOI
+    // (and the master needs one for a spurious IRQ 15, which picIsSpurious takes care of).
+    if (!picIsSpurious(irq))
+    {
+        picEndOfInterrupt(irq);
+    }
+
+    return true;
+}
+
+void IoApicEndOfInterrupt(uint32_t irq)
+{
+    (void)irq;
+    lapicEndOfInterrupt();
+}
+
+bool IoApicSetAffinity(uint32_t irq, uint32_t cpu)
+{
+    if (cpu >= g_cpuCount
+        || g_isaRoutes[irq].ioApic == nullptr)
+    {
+        return false;
+    }
+
+    g_isaRoutes[irq].high = g_cpuApicIds[cpu] << IOAPIC_DestinationShift;
+    WriteRoute(irq);
+    return true;
+}
+
+NOS_END_EXTERN_C
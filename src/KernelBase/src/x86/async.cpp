@@ -0,0 +1,227 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the asynchronous task executor.
+//!
+//! \details
+//! Each processor has a FIFO of tasks ready to be resumed, which only it touches (with interrupts
+//! disabled). Queueing a task raises SOFTIRQ_Async, whose handler resumes the tasks that were
+//! ready when it started; any they queue run on the next pass, so a task which keeps yielding
+//! can't hold up the other softirqs.
+//-------------------------------------------------------------------------------------------------
+#include "async.h"
+#include "softirq.h"
+#include "idt.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_AsyncCpuState
+{
+    AsyncTask* head;            //!< The oldest ready task.
+    AsyncTask* tail;
+    AsyncStats stats;
+} AsyncCpuState;
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static AsyncCpuState g_asyncCpuState[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline AsyncCpuState* CurrentState()
+{
+    return &g_asyncCpuState[cpuCurrentIndex()];
+}
+
+static void AsyncSoftirq(_In_opt_ void* context);
+static void Run(_Inout_ AsyncTask* task);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void asyncInitialize()
+{
+    softirqRegister(SOFTIRQ_Async, AsyncSoftirq, nullptr);
+}
+
+_Use_decl_annotations_
+AsyncStatus asyncStart(AsyncTask* task, AsyncFunction function, void* context)
+{
+    task->next = nullptr;
+    task->function = function;
+    task->context = context;
+    task->resumePoint = 0;
+    task->readyTsc = 0;
+
+    bool enabled = idtDisableInterrupts();
+    CurrentState()->stats.startCount++;
+    idtRestoreInterrupts(enabled);
+
+    const AsyncStatus status = function(task);
+
+    if (status == ASYNC_Done)
+    {
+        enabled = idtDisableInterrupts();
+        CurrentState()->stats.finishCount++;
+        idtRestoreInterrupts(enabled);
+    }
+
+    return status;
+}
+
+_Use_decl_annotations_
+void asyncCompletionSetup(AsyncCompletion* completion)
+{
+    completion->waiter.store(nullptr, memory_order::relaxed);
+    completion->result = 0;
+}
+
+_Use_decl_annotations_
+void asyncComplete(AsyncCompletion* completion, long result)
+{
+    //TODO: kassert(completion->waiter.load(memory_order::relaxed) != ASYNC_CompletedMarker);
+    completion->result = result;
+
+    // the exchange publishes the result, both to a task which awaits after this and to this
+    // processor's softirq.
+    AsyncTask* waiter = completion->waiter.exchange(ASYNC_CompletedMarker);
+    if (waiter == nullptr)
+    {
+        return;
+    }
+
+    asyncReady(waiter);
+
+    // outside of an interrupt there's no interrupt exit coming to drain the softirq, so resume
+    // the task now - unless interrupts are disabled, which the caller is relying on.
+    if (!idtInInterrupt())
+    {
+        const bool enabled = idtDisableInterrupts();
+        idtRestoreInterrupts(enabled);
+
+        if (enabled)
+        {
+            softirqRunPending();
+        }
+    }
+}
+
+_Use_decl_annotations_
+bool asyncSuspend(AsyncTask* task, AsyncCompletion* completion)
+{
+    AsyncTask* expected = nullptr;
+    if (completion->waiter.compare_exchange(expected, task))
+    {
+        return false;
+    }
+
+    //TODO: kassert(expected == ASYNC_CompletedMarker);
+    return true;
+}
+
+_Use_decl_annotations_
+void asyncReady(AsyncTask* task)
+{
+    task->next = nullptr;
+    task->readyTsc = __rdtsc();
+
+    const bool enabled = idtDisableInterrupts();
+    AsyncCpuState* state = CurrentState();
+
+    if (state->tail != nullptr)
+    {
+        state->tail->next = task;
+    }
+    else
+    {
+        state->head = task;
+    }
+
+    state->tail = task;
+
+    idtRestoreInterrupts(enabled);
+    softirqRaise(SOFTIRQ_Async);
+}
+
+_Use_decl_annotations_
+void asyncGetStats(AsyncStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const AsyncStats* cpuStats = &g_asyncCpuState[cpu].stats;
+
+        stats->startCount += cpuStats->startCount;
+        stats->finishCount += cpuStats->finishCount;
+        stats->resumeCount += cpuStats->resumeCount;
+        stats->resumeCycles += cpuStats->resumeCycles;
+        if (cpuStats->maxResumeCycles > stats->maxResumeCycles)
+        {
+            stats->maxResumeCycles = cpuStats->maxResumeCycles;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void AsyncSoftirq(void* context)
+{
+    (void)context;
+
+    const bool enabled = idtDisableInterrupts();
+    AsyncCpuState* state = CurrentState();
+
+    AsyncTask* task = state->head;
+    state->head = nullptr;
+    state->tail = nullptr;
+
+    idtRestoreInterrupts(enabled);
+
+    while (task != nullptr)
+    {
+        // the task may be queued again (and its next overwritten) while it runs.
+        AsyncTask* next = task->next;
+        Run(task);
+        task = next;
+    }
+}
+
+void Run(AsyncTask* task)
+{
+    const uint64_t latency = __rdtsc() - task->readyTsc;
+    const AsyncStatus status = task->function(task);
+
+    const bool enabled = idtDisableInterrupts();
+    AsyncStats* stats = &CurrentState()->stats;
+
+    stats->resumeCount++;
+    stats->resumeCycles += latency;
+    if (latency > stats->maxResumeCycles)
+    {
+        stats->maxResumeCycles = latency;
+    }
+
+    if (status == ASYNC_Done)
+    {
+        stats->finishCount++;
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,28 @@
+.686P
+.model  flat, c
+
+.code
+
+; void CpuLoadSegments(uint32_t codeSelector, uint32_t dataSelector, uint32_t fsSelector)
+;
+; Reloads every segment register from the GDT that was just loaded. cs can only be changed by a
+; far transfer, so that's done with a far return to the next instruction.
+CpuLoadSegments proc
+    mov     eax, [esp+8]
+    mov     ds, ax
+    mov     es, ax
+    mov     gs, ax
+    mov     ss, ax
+
+    mov     eax, [esp+12]
+    mov     fs, ax
+
+    push    dword ptr [esp+4]   ; codeSelector
+    push    offset Reloaded
+    retf
+Reloaded:
+    ret
+CpuLoadSegments endp
+
+
+end
@@ -0,0 +1,148 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the kernel's GDT and per-CPU data for x86.
+//-------------------------------------------------------------------------------------------------
+#include "cpu.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef uint64_t GdtEntry;
+
+#pragma pack(push, 1)
+typedef struct tag_GdtDescriptor
+{
+    uint16_t limit;
+    uint32_t base;
+} GdtDescriptor;
+#pragma pack(pop)
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    // the flat segments keep the selectors the bootstrapper used, so nothing that was loaded
+    // before this has to change.
+    GdtNull = 0,
+    GdtKernelData = 1,              //!< Flat data, selector 0x08.
+    GdtKernelCode = 2,              //!< Flat code, selector 0x10.
+    GdtFirstCpu = 3,                //!< The first per-CPU data segment.
+    GdtEntryCount = GdtFirstCpu + CPU_MaxCount,
+
+    AccessData = 0x92,              //!< Present, ring 0, writable data.
+    AccessCode = 0x9A,              //!< Present, ring 0, readable code.
+
+    FlagsFlat = 0xC,                //!< 32-bit, page granularity.
+    FlagsBytes = 0x4,               //!< 32-bit, byte granularity.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+alignas(8) static GdtEntry g_gdt[GdtEntryCount];
+static CpuData g_cpuData[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+// defined in cpu.asm
+void CpuLoadSegments(uint32_t codeSelector, uint32_t dataSelector, uint32_t fsSelector);
+
+static inline uint32_t Selector(uint32_t entry)
+{
+    return entry * sizeof(GdtEntry);
+}
+
+static GdtEntry MakeSegment(uint32_t base, uint32_t limit, uint32_t access, uint32_t flags);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void cpuInitialize(uint32_t index)
+{
+    // the boot processor builds the whole table before any other processor is started.
+    if (index == 0)
+    {
+        g_gdt[GdtNull] = 0;
+        g_gdt[GdtKernelData] = MakeSegment(0, 0xFFFFF, AccessData, FlagsFlat);
+        g_gdt[GdtKernelCode] = MakeSegment(0, 0xFFFFF, AccessCode, FlagsFlat);
+
+        for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+        {
+            g_cpuData[cpu].self = &g_cpuData[cpu];
+            g_cpuData[cpu].index = cpu;
+
+            g_gdt[GdtFirstCpu + cpu] = MakeSegment(
+                (uint32_t)(uintptr_t)&g_cpuData[cpu],
+                sizeof(CpuData) - 1,
+                AccessData,
+                FlagsBytes
+            );
+        }
+    }
+
+    GdtDescriptor descriptor;
+    descriptor.limit = (uint16_t)(sizeof(g_gdt) - 1);
+    descriptor.base = (uint32_t)(uintptr_t)g_gdt;
+
+    _lgdt(&descriptor);
+    CpuLoadSegments(
+        Selector(GdtKernelCode),
+        Selector(GdtKernelData),
+        Selector(GdtFirstCpu + index)
+    );
+
+    // the boot processor is online as soon as it has per-CPU data; the others wait until they
+    // can take interrupts.
+    if (index == 0)
+    {
+        g_cpuData[0].online = true;
+    }
+}
+
+CpuData* cpuGetData(uint32_t index)
+{
+    return &g_cpuData[index];
+}
+
+uint32_t cpuOnlineCount()
+{
+    uint32_t count = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (g_cpuData[cpu].online)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+GdtEntry MakeSegment(uint32_t base, uint32_t limit, uint32_t access, uint32_t flags)
+{
+    GdtEntry entry = (limit & 0xFFFF);
+    entry |= (GdtEntry)(base & 0xFFFFFF) << 16;
+    entry |= (GdtEntry)(access & 0xFF) << 40;
+    entry |= (GdtEntry)((limit >> 16) & 0xF) << 48;
+    entry |= (GdtEntry)(flags & 0xF) << 52;
+    entry |= (GdtEntry)(base >> 24) << 56;
+
+    return entry;
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,244 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of idling with hlt or monitor/mwait.
+//!
+//! \details
+//! mwait is used with interrupts disabled, and the extension that lets interrupts end it anyway;
+//! they're taken once it returns and interrupts are enabled. That avoids relying on sti's one
+//! instruction shadow reaching the mwait, which the compiler's register setup could come between.
+//!
+//! A waker which sees the processor in mwait writes to its wake line. One which doesn't (because
+//! the processor is halted, or hasn't started waiting yet) sends an IPI instead, which ends a wait
+//! that starts later too, since it stays pending while interrupts are disabled. A write that comes
+//! between the processor announcing mwait and arming the monitor is caught by comparing the line
+//! with what it held before.
+//!
+//FUTURE: deeper C-states (mwait hints from CPUID leaf 5) once there's a way to know how long the
+//        processor is likely to stay idle.
+//-------------------------------------------------------------------------------------------------
+#include "idle.h"
+#include "softirq.h"
+#include "katomic.h"
+#include "krtinit.h"
+#include "ktime.h"
+#include "apic.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+enum IdleMode : uint32_t
+{
+    IM_Running,
+    IM_Mwait,
+    IM_Halt,
+};
+
+//! \brief  A processor's idle state. The wake line is monitored, so nothing else shares it.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_IdleCpuState
+{
+    katomic<uint32_t> wakeLine;                     //!< Written by idleWake to end an mwait.
+
+    alignas(NOS_CACHE_LINE_SIZE) katomic<uint32_t> mode;
+    katomic<uint64_t> wakeTsc;                      //!< When idleWake was last called, or 0.
+    uint64_t firstIdleTsc;
+    IdleStats stats;                                //!< Only touched by the processor itself.
+} IdleCpuState;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    MwaitC1 = 0,                    //!< mwait hint for the shallowest C-state.
+    MwaitBreakOnInterrupt = 1,      //!< mwait extension: interrupts end it even while disabled.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static IdleCpuState g_idleCpuState[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline IdleCpuState* CurrentState()
+{
+    return &g_idleCpuState[cpuCurrentIndex()];
+}
+
+static void WaitWithMwait(_Inout_ IdleCpuState* state);
+static void RecordWait(_Inout_ IdleCpuState* state, uint64_t start, uint64_t end);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool idleUsesMwait()
+{
+    return (nos_cpu_features & nos_cpu_Mwait) != 0;
+}
+
+void idleWait()
+{
+    IdleCpuState* state = CurrentState();
+    const uint64_t start = __rdtsc();
+
+    if (state->firstIdleTsc == 0)
+    {
+        state->firstIdleTsc = start;
+    }
+
+    if (idleUsesMwait())
+    {
+        WaitWithMwait(state);
+        RecordWait(state, start, __rdtsc());
+        _enable();
+    }
+    else
+    {
+        state->mode.store(IM_Halt, memory_order::seq_cst);
+
+        // sti only takes effect after the next instruction, so no interrupt can slip in between
+        // it and the hlt - as long as they're adjacent, which two intrinsics don't promise. The
+        // interrupt that ends the hlt is handled before the end is read.
+        __enable_and_halt();
+
+        _disable();
+        state->mode.store(IM_Running, memory_order::relaxed);
+        RecordWait(state, start, __rdtsc());
+        _enable();
+    }
+}
+
+void idleWake(uint32_t cpu, uint32_t vector)
+{
+    IdleCpuState* state = &g_idleCpuState[cpu];
+    state->wakeTsc.store(__rdtsc(), memory_order::relaxed);
+
+    // the caller's stores (the work being woken for) must be visible before the mode is read,
+    // or the processor could look one last time, miss the work, and mwait without an IPI coming.
+    atomic_thread_fence(memory_order::seq_cst);
+
+    if (state->mode.load(memory_order::relaxed) == IM_Mwait)
+    {
+        state->wakeLine.fetch_add(1);
+    }
+    else
+    {
+        lapicSendIpi(cpuGetData(cpu)->apicId, vector);
+    }
+}
+
+void idleLoop()
+{
+    for (;;)
+    {
+        _disable();
+
+        if (softirqIsPending())
+        {
+            _enable();
+            softirqRunPending();
+        }
+        else
+        {
+            idleWait();
+        }
+    }
+}
+
+_Use_decl_annotations_
+void idleGetStats(uint32_t cpu, IdleStats* stats)
+{
+    *stats = g_idleCpuState[cpu].stats;
+}
+
+_Use_decl_annotations_
+void idlePrintReport(const kprintf_stream* stream)
+{
+    kprintf(
+        stream,
+        "idle with %s:\n   cpu  idle%%  waits  wakes  avg wake  max wake\n",
+        idleUsesMwait() ? "mwait" : "hlt"
+    );
+
+    const uint64_t now = __rdtsc();
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const IdleCpuState* state = &g_idleCpuState[cpu];
+        const IdleStats* stats = &state->stats;
+
+        if (state->firstIdleTsc == 0)
+        {
+            continue;
+        }
+
+        const uint64_t elapsed = now - state->firstIdleTsc;
+
+        kprintf(
+            stream,
+            "   %3u  %4llu%%  %5u  %5u  %5llu ns  %5llu ns\n",
+            cpu,
+            (elapsed > 0) ? (stats->idleCycles * 100) / elapsed : 0,
+            stats->idleCount,
+            stats->wakeCount,
+            (stats->wakeCount > 0) ? ktimeCyclesToNs(stats->wakeCycles) / stats->wakeCount : 0,
+            ktimeCyclesToNs(stats->maxWakeCycles)
+        );
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void WaitWithMwait(IdleCpuState* state)
+{
+    const uint32_t seen = state->wakeLine.load(memory_order::relaxed);
+
+    // a waker reads the mode after publishing its work, so if it misses this, it sends an IPI.
+    state->mode.store(IM_Mwait, memory_order::seq_cst);
+    _mm_monitor((const void*)state->wakeLine.address(), 0, 0);
+
+    if (state->wakeLine.load(memory_order::relaxed) == seen)
+    {
+        _mm_mwait(MwaitBreakOnInterrupt, MwaitC1);
+    }
+
+    state->mode.store(IM_Running, memory_order::relaxed);
+}
+
+void RecordWait(IdleCpuState* state, uint64_t start, uint64_t end)
+{
+    // called with interrupts disabled.
+    IdleStats* stats = &state->stats;
+
+    stats->idleCount++;
+    stats->idleCycles += end - start;
+
+    const uint64_t wakeTsc = state->wakeTsc.exchange(0);
+    if (wakeTsc != 0
+        && wakeTsc >= start)
+    {
+        const uint64_t latency = end - wakeTsc;
+
+        stats->wakeCount++;
+        stats->wakeCycles += latency;
+        if (latency > stats->maxWakeCycles)
+        {
+            stats->maxWakeCycles = latency;
+        }
+    }
+}
+
+NOS_END_EXTERN_C
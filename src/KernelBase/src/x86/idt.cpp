@@ -0,0 +1,658 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of x86 interrupt handling.
+//!
+//! \details
+//! The dispatcher reads the handler table on every interrupt, on every processor, and it's almost
+//! never written - so it's read without locks, RCU style. Each vector has two entries; registering
+//! fills in the one that isn't published, publishes it, and waits out a grace period so the other
+//! one is free for next time.
+//-------------------------------------------------------------------------------------------------
+#include "idt.h"
+#include "pic.h"
+#include "kheap.h"
+#include "physmem.h"
+#include "softirq.h"
+#include "rcu.h"
+#include "spinlock.h"
+#include "katomic.h"
+#include "thread.h"
+#include "ktime.h"
+#include "cpu.h"
+#include "percpu.h"
+#include "kprintf.h"
+#include "vgatext.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_IdtGate
+{
+    uint16_t offsetLow;
+    uint16_t selector;
+    uint8_t reserved;
+    uint8_t typeAttributes;
+    uint16_t offsetHigh;
+} IdtGate;
+
+#pragma pack(push, 1)
+typedef struct tag_IdtDescriptor
+{
+    uint16_t limit;
+    uint32_t base;
+} IdtDescriptor;
+#pragma pack(pop)
+
+typedef struct tag_HandlerEntry
+{
+    InterruptHandler handler;
+    void* context;
+} HandlerEntry;
+
+//! \brief  A processor's interrupt counters. Only ever updated by the processor itself.
+typedef struct tag_IdtCpuStats
+{
+    uint32_t spuriousCount;
+    IdtVectorStats vectors[IDT_VectorCount];
+} IdtCpuStats;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    KernelCodeSelector = 0x10,      //!< The flat code selector set up by the bootstrapper.
+
+    GateInterrupt32 = 0x8E,         //!< Present, ring 0, 32-bit interrupt gate.
+};
+
+static const char* const ExceptionNames[IDT_ExceptionCount] =
+{
+    "divide error",             "debug exception",          "NMI",
+    "breakpoint",               "overflow",                 "bound range exceeded",
+    "invalid opcode",           "device not available",     "double fault",
+    "coprocessor overrun",      "invalid TSS",              "segment not present",
+    "stack fault",              "general protection fault", "page fault",
+    "reserved exception",       "x87 FPU error",            "alignment check",
+    "machine check",            "SIMD exception",           "virtualization exception",
+    "control protection fault", "reserved exception",       "reserved exception",
+    "reserved exception",       "reserved exception",       "reserved exception",
+    "reserved exception",       "hypervisor injection",     "VMM communication exception",
+    "security exception",       "reserved exception",
+};
+
+static const char* const IrqNames[IDT_IrqCount] =
+{
+    "IRQ 0",    "IRQ 1",    "IRQ 2",    "IRQ 3",    "IRQ 4",    "IRQ 5",    "IRQ 6",    "IRQ 7",
+    "IRQ 8",    "IRQ 9",    "IRQ 10",   "IRQ 11",   "IRQ 12",   "IRQ 13",   "IRQ 14",   "IRQ 15",
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+alignas(8) static IdtGate g_idt[IDT_VectorCount];
+static HandlerEntry g_handlerEntries[IDT_VectorCount][2];
+static katomic<const HandlerEntry*> g_handlers[IDT_VectorCount];   //!< The published entries.
+static TicketLock g_handlerLock;                //!< Serializes registrations.
+static IdtCpuStats g_bootCpuStats;
+static IdtCpuStats* g_cpuStats[CPU_MaxCount];   //!< Null for a processor that couldn't get any.
+static const IrqController* g_irqController;
+static uint32_t g_nestingDepth[CPU_MaxCount];   //!< Interrupts in progress on each processor.
+
+PERCPU_COUNTER(idtInterrupts);
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+// defined in isr.asm
+extern const InterruptEntry IsrStubTable[IDT_VectorCount];
+void IsrRaiseSelfTest(void);
+
+// called from the entry stubs in isr.asm
+void idtDispatch(_Inout_ InterruptFrame* frame);
+
+static void SetGate(uint32_t vector, uintptr_t entry);
+static void PageFaultHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+static void SelfTestHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+static void FatalFault(_In_ const InterruptFrame* frame);
+static void RecordDispatch(
+    _Inout_ IdtVectorStats* stats,
+    uint64_t latency,
+    uint64_t duration,
+    uint32_t depth
+);
+static const char* VectorName(uint32_t vector);
+static uint64_t AverageNs(uint64_t totalCycles, uint32_t count);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void idtInitialize()
+{
+    picInitialize(IDT_IrqBase);
+    g_irqController = picGetController();
+
+    // the boot processor's counters are there from the start, since interrupts are measured
+    // before there's any memory to allocate.
+    g_cpuStats[0] = &g_bootCpuStats;
+
+    for (uint32_t vector = 0; vector < IDT_VectorCount; vector++)
+    {
+        SetGate(vector, (uintptr_t)IsrStubTable[vector]);
+    }
+
+    idtRegisterHandler(IDT_PageFault, PageFaultHandler, nullptr);
+    idtRegisterHandler(IDT_SelfTestVector, SelfTestHandler, nullptr);
+
+    idtInitializeProcessor();
+}
+
+void idtInitializeProcessor()
+{
+    IdtDescriptor descriptor;
+    descriptor.limit = (uint16_t)(sizeof(g_idt) - 1);
+    descriptor.base = (uint32_t)(uintptr_t)g_idt;
+
+    __lidt(&descriptor);
+
+    // the other processors' counters are allocated as they start. Without them, a processor's
+    // interrupts still work, but aren't counted.
+    const uint32_t cpu = cpuCurrentIndex();
+    if (g_cpuStats[cpu] == nullptr)
+    {
+        uint32_t pageCount;
+        IdtCpuStats* stats =
+            (IdtCpuStats*)pmAllocateBytes(sizeof(IdtCpuStats), nullptr, &pageCount);
+
+        if (stats != nullptr)
+        {
+            memset(stats, 0, sizeof(IdtCpuStats));
+        }
+
+        g_cpuStats[cpu] = stats;
+    }
+}
+
+_Use_decl_annotations_
+void idtRegisterHandler(uint32_t vector, InterruptHandler handler, void* context)
+{
+    // a processor spinning here isn't reading the table, so it doesn't hold up the grace period
+    // the current registration is waiting for.
+    while (!ticketLockTryAcquire(&g_handlerLock))
+    {
+        rcuQuiescentState();
+        cpu_relax();
+    }
+
+    const HandlerEntry* published = g_handlers[vector].load(memory_order::relaxed);
+    HandlerEntry* entry = nullptr;
+
+    if (handler != nullptr)
+    {
+        entry = &g_handlerEntries[vector][(published == &g_handlerEntries[vector][0]) ? 1 : 0];
+        entry->handler = handler;
+        entry->context = context;
+    }
+
+    g_handlers[vector].store(entry, memory_order::release);
+
+    if (published != nullptr)
+    {
+        rcuSynchronize();
+    }
+
+    ticketLockRelease(&g_handlerLock);
+}
+
+_Use_decl_annotations_
+void idtRegisterIrqHandler(uint32_t irq, InterruptHandler handler, void* context)
+{
+    idtRegisterHandler(IDT_IrqBase + irq, handler, context);
+    g_irqController->unmask(irq);
+}
+
+void idtUnregisterIrqHandler(uint32_t irq)
+{
+    g_irqController->mask(irq);
+    idtRegisterHandler(IDT_IrqBase + irq, nullptr, nullptr);
+}
+
+bool idtSetIrqAffinity(uint32_t irq, uint32_t cpu)
+{
+    return g_irqController->setAffinity(irq, cpu);
+}
+
+_Use_decl_annotations_
+void idtSetIrqController(const IrqController* controller)
+{
+    const bool enabled = idtDisableInterrupts();
+
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        g_irqController->mask(irq);
+    }
+
+    g_irqController = controller;
+
+    for (uint32_t irq = 0; irq < IDT_IrqCount; irq++)
+    {
+        if (g_handlers[IDT_IrqBase + irq].load(memory_order::acquire) != nullptr)
+        {
+            controller->unmask(irq);
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+const IrqController* idtGetIrqController()
+{
+    return g_irqController;
+}
+
+uint32_t idtGetVectorCount(uint32_t vector)
+{
+    uint32_t count = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (g_cpuStats[cpu] != nullptr)
+        {
+            count += g_cpuStats[cpu]->vectors[vector].count;
+        }
+    }
+
+    return count;
+}
+
+uint32_t idtGetSpuriousCount()
+{
+    uint32_t count = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (g_cpuStats[cpu] != nullptr)
+        {
+            count += g_cpuStats[cpu]->spuriousCount;
+        }
+    }
+
+    return count;
+}
+
+bool idtInInterrupt()
+{
+    return (g_nestingDepth[cpuCurrentIndex()] != 0);
+}
+
+_Use_decl_annotations_
+void idtGetVectorStats(uint32_t vector, IdtVectorStats* stats)
+{
+    // this processor's counters can't change under it with interrupts disabled. The others' can,
+    // so the totals may be off by the interrupts that are in progress elsewhere.
+    const bool enabled = idtDisableInterrupts();
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (g_cpuStats[cpu] == nullptr)
+        {
+            continue;
+        }
+
+        const IdtVectorStats* cpuStats = &g_cpuStats[cpu]->vectors[vector];
+
+        stats->count += cpuStats->count;
+        stats->latencyCycles += cpuStats->latencyCycles;
+        stats->handlerCycles += cpuStats->handlerCycles;
+
+        stats->maxNesting = MAX(stats->maxNesting, cpuStats->maxNesting);
+        stats->maxLatencyCycles = MAX(stats->maxLatencyCycles, cpuStats->maxLatencyCycles);
+        stats->maxHandlerCycles = MAX(stats->maxHandlerCycles, cpuStats->maxHandlerCycles);
+
+        for (uint32_t bucket = 0; bucket < IDT_HistogramBuckets; bucket++)
+        {
+            stats->histogram[bucket] += cpuStats->histogram[bucket];
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+void idtResetStats()
+{
+    // meant for when the other processors are quiet; an interrupt they take while their counters
+    // are being cleared may be partly counted.
+    const bool enabled = idtDisableInterrupts();
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (g_cpuStats[cpu] != nullptr)
+        {
+            memset(g_cpuStats[cpu], 0, sizeof(IdtCpuStats));
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+void idtPrintReport(const kprintf_stream* stream)
+{
+    // times are in ns; the lines are kept short enough for the 80 column console.
+    kprintf(stream, "   vector                 count  avg lat  max lat  avg run  max run nest\n");
+
+    for (uint32_t vector = 0; vector < IDT_VectorCount; vector++)
+    {
+        IdtVectorStats stats;
+        idtGetVectorStats(vector, &stats);
+
+        if (stats.count == 0)
+        {
+            continue;
+        }
+
+        kprintf(
+            stream,
+            "%02X %-20s %7u %8llu %8llu %8llu %8llu %4u\n",
+            vector,
+            VectorName(vector),
+            stats.count,
+            AverageNs(stats.latencyCycles, stats.count),
+            ktimeCyclesToNs(stats.maxLatencyCycles),
+            AverageNs(stats.handlerCycles, stats.count),
+            ktimeCyclesToNs(stats.maxHandlerCycles),
+            stats.maxNesting
+        );
+    }
+
+    kprintf(stream, "spurious IRQs: %u\n", idtGetSpuriousCount());
+}
+
+_Use_decl_annotations_
+void idtPrintVectorStats(const kprintf_stream* stream, uint32_t vector)
+{
+    IdtVectorStats stats;
+    idtGetVectorStats(vector, &stats);
+
+    kprintf(
+        stream,
+        "vector %02X (%s): %u dispatched, latency avg %llu ns max %llu ns, "
+        "handler avg %llu ns max %llu ns, nesting max %u\n",
+        vector,
+        VectorName(vector),
+        stats.count,
+        AverageNs(stats.latencyCycles, stats.count),
+        ktimeCyclesToNs(stats.maxLatencyCycles),
+        AverageNs(stats.handlerCycles, stats.count),
+        ktimeCyclesToNs(stats.maxHandlerCycles),
+        stats.maxNesting
+    );
+
+    // only the populated part of the histogram is interesting.
+    uint32_t first = IDT_HistogramBuckets;
+    uint32_t last = 0;
+
+    for (uint32_t bucket = 0; bucket < IDT_HistogramBuckets; bucket++)
+    {
+        if (stats.histogram[bucket] != 0)
+        {
+            first = (first < bucket) ? first : bucket;
+            last = bucket;
+        }
+    }
+
+    for (uint32_t bucket = first; bucket <= last && bucket < IDT_HistogramBuckets; bucket++)
+    {
+        kprintf(
+            stream,
+            "    < %10llu ns: %u\n",
+            ktimeCyclesToNs(2ull << bucket),
+            stats.histogram[bucket]
+        );
+    }
+}
+
+_Use_decl_annotations_
+void idtMeasureEntryCost(uint32_t iterations, uint64_t* minCycles, uint64_t* averageCycles)
+{
+    uint64_t best = UINT64_MAX;
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        const uint64_t start = __rdtsc();
+        IsrRaiseSelfTest();
+        const uint64_t cycles = __rdtsc() - start;
+
+        total += cycles;
+        if (cycles < best)
+        {
+            best = cycles;
+        }
+    }
+
+    *minCycles = (iterations > 0) ? best : 0;
+    *averageCycles = (iterations > 0) ? (total / iterations) : 0;
+}
+
+_Use_decl_annotations_
+void idtDispatch(InterruptFrame* frame)
+{
+    const uint32_t vector = frame->vector;
+    const uint32_t irq = vector - IDT_IrqBase;
+    const bool isIrq = (irq < IDT_IrqCount);
+    const uint32_t cpu = cpuCurrentIndex();
+    IdtCpuStats* cpuStats = g_cpuStats[cpu];
+
+    if (isIrq && g_irqController->isSpurious(irq))
+    {
+        if (cpuStats != nullptr)
+        {
+            cpuStats->spuriousCount++;
+        }
+
+        return;
+    }
+
+    percpuIncrement(&idtInterrupts);
+
+    uint32_t* depth = &g_nestingDepth[cpu];
+
+    // latency is measured from the entry stub; when the device actually raised the interrupt
+    // can't be observed, so time spent with interrupts disabled before delivery isn't included.
+    const uint64_t handlerStart = __rdtsc();
+    const uint64_t latency = handlerStart - frame->entryTsc;
+    const uint32_t entryDepth = *depth;
+
+    (*depth)++;
+
+    const HandlerEntry* entry = g_handlers[vector].load(memory_order::acquire);
+    if (entry != nullptr)
+    {
+        entry->handler(frame, entry->context);
+    }
+    else if (vector < IDT_ExceptionCount)
+    {
+        FatalFault(frame);
+    }
+
+    if (cpuStats != nullptr)
+    {
+        RecordDispatch(&cpuStats->vectors[vector], latency, __rdtsc() - handlerStart, entryDepth);
+    }
+
+    if (isIrq)
+    {
+        g_irqController->endOfInterrupt(irq);
+    }
+
+    // deferred work runs on the way out of the outermost interrupt - but only if the interrupted
+    // code had interrupts enabled, since draining enables them (a fault taken with interrupts
+    // disabled mustn't open up the code it interrupted). It still counts as interrupt context.
+    // Exceptions are left out altogether: a fault is part of the code it interrupted (a heap
+    // fault in the middle of an allocation, say), which mustn't run softirqs or be switched away
+    // from at that point any more than it could by calling them itself.
+    const bool interruptible = (frame->eflags & EFLAGS_IF) != 0
+        && vector >= IDT_ExceptionCount;
+
+    if (*depth == 1
+        && interruptible)
+    {
+        softirqDrain();
+    }
+
+    (*depth)--;
+
+    // the same goes for switching threads. The frame stays on the interrupted thread's stack
+    // until it's switched back to. Code with interrupts enabled can't be in an RCU read-side
+    // critical section, and the handlers are done, so this is a quiescent state too.
+    if (*depth == 0
+        && interruptible)
+    {
+        rcuQuiescentState();
+        threadPreemptIfNeeded();
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void SetGate(uint32_t vector, uintptr_t entry)
+{
+    IdtGate* gate = &g_idt[vector];
+
+    gate->offsetLow = (uint16_t)(entry & 0xFFFF);
+    gate->selector = KernelCodeSelector;
+    gate->reserved = 0;
+    gate->typeAttributes = GateInterrupt32;
+    gate->offsetHigh = (uint16_t)(entry >> 16);
+}
+
+void PageFaultHandler(InterruptFrame* frame, void* context)
+{
+    (void)context;
+    const uintptr_t address = __readcr2();
+
+    if (kheapHandleFault(address, (frame->errorCode & PF_Present) != 0))
+    {
+        return;
+    }
+
+    kprintf(vtKPrintfStream(), "*** Faulting address %p\n", (void*)address);
+    FatalFault(frame);
+}
+
+void SelfTestHandler(InterruptFrame* frame, void* context)
+{
+    (void)frame;
+    (void)context;
+}
+
+void FatalFault(const InterruptFrame* frame)
+{
+    kprintf(
+        vtKPrintfStream(),
+        "*** Unhandled %s (vector %u, error %08X) at eip %p\n",
+        ExceptionNames[frame->vector],
+        frame->vector,
+        frame->errorCode,
+        (void*)frame->eip
+    );
+
+    for (;;)
+    {
+        _disable();
+        __halt();
+    }
+}
+
+_Use_decl_annotations_
+void RecordDispatch(IdtVectorStats* stats, uint64_t latency, uint64_t duration, uint32_t depth)
+{
+    stats->count++;
+    stats->latencyCycles += latency;
+    if (latency > stats->maxLatencyCycles)
+    {
+        stats->maxLatencyCycles = latency;
+    }
+
+    if (depth > stats->maxNesting)
+    {
+        stats->maxNesting = depth;
+    }
+
+    stats->handlerCycles += duration;
+    if (duration > stats->maxHandlerCycles)
+    {
+        stats->maxHandlerCycles = duration;
+    }
+
+    unsigned long bucket = 0;
+    if (duration > UINT32_MAX)
+    {
+        bucket = IDT_HistogramBuckets - 1;
+    }
+    else
+    {
+        _BitScanReverse(&bucket, (uint32_t)duration);
+    }
+
+    stats->histogram[bucket]++;
+}
+
+const char* VectorName(uint32_t vector)
+{
+    if (vector < IDT_ExceptionCount)
+    {
+        return ExceptionNames[vector];
+    }
+
+    switch (vector)
+    {
+    case IDT_LapicTimerVector:
+        return "LAPIC timer";
+
+    case IDT_SelfTestVector:
+        return "self test";
+
+    case IDT_TaskWakeVector:
+        return "task wakeup IPI";
+
+    case IDT_RcuKickVector:
+        return "RCU kick IPI";
+
+    case IDT_TlbShootdownVector:
+        return "TLB shootdown IPI";
+
+    case IDT_ThreadWakeVector:
+        return "thread wake IPI";
+
+    case IDT_LapicSpuriousVector:
+        return "LAPIC spurious";
+    }
+
+    const uint32_t irq = vector - IDT_IrqBase;
+    if (irq < IDT_IrqCount)
+    {
+        return IrqNames[irq];
+    }
+
+    return "";
+}
+
+uint64_t AverageNs(uint64_t totalCycles, uint32_t count)
+{
+    return (count > 0) ? ktimeCyclesToNs(totalCycles / count) : 0;
+}
+
+NOS_END_EXTERN_C
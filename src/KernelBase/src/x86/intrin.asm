@@ -8,5 +8,15 @@ __bochsbreak proc
     ret
 __bochsbreak endp
 
+; void __enable_and_halt(void)
+;
+; sti only takes effect after the instruction that follows it, so with the hlt right there no
+; interrupt can be taken between the two - and the one that ends the hlt can't be missed.
+__enable_and_halt proc
+    sti
+    hlt
+    ret
+__enable_and_halt endp
+
 
 end
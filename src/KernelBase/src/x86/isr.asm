@@ -0,0 +1,73 @@
+.686P
+.model  flat, c
+
+extern idtDispatch:proc
+
+public IsrStubTable
+
+IDT_VECTOR_COUNT        equ 256
+IDT_SELF_TEST_VECTOR    equ 0F0h        ; must match IDT_SelfTestVector in idt.h
+
+
+; Defines the entry stub for a vector. Every stub pushes the same frame (see InterruptFrame in
+; idt.h), so vectors for which the processor doesn't push an error code push a 0 in its place.
+ISR_STUB macro vector
+IsrStub&vector&:
+if (vector eq 8) or ((vector ge 10) and (vector le 14)) or (vector eq 17) or (vector eq 21) or (vector eq 29) or (vector eq 30)
+    push    vector
+else
+    push    0
+    push    vector
+endif
+    jmp     IsrCommon
+endm
+
+ISR_TABLE_ENTRY macro vector
+    dd      IsrStub&vector&
+endm
+
+
+.code
+
+; Only the registers a C function is allowed to clobber are saved. The handlers preserve the rest
+; themselves, so saving them here (as pushad would) just costs time on every interrupt.
+IsrCommon:
+    push    eax
+    push    ecx
+    push    edx
+    rdtsc                       ; entry timestamp, for the dispatcher's latency counters
+    push    edx
+    push    eax
+    cld
+    push    esp                 ; InterruptFrame*
+    call    idtDispatch
+    add     esp, 12             ; discard the frame pointer and the timestamp
+    pop     edx
+    pop     ecx
+    pop     eax
+    add     esp, 8              ; discard the vector and error code
+    iretd
+
+vector = 0
+rept IDT_VECTOR_COUNT
+    ISR_STUB %vector
+    vector = vector + 1
+endm
+
+IsrRaiseSelfTest proc
+    int     IDT_SELF_TEST_VECTOR
+    ret
+IsrRaiseSelfTest endp
+
+
+.const
+
+IsrStubTable label dword
+vector = 0
+rept IDT_VECTOR_COUNT
+    ISR_TABLE_ENTRY %vector
+    vector = vector + 1
+endm
+
+
+end
@@ -0,0 +1,145 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the demand-faulted kernel heap region.
+//-------------------------------------------------------------------------------------------------
+#include "kheap.h"
+#include "vmrange.h"
+#include "paging.h"
+#include "physmem.h"
+#include "kmap.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,   //!< The size of a single page of memory.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static VirtualRangeAllocator g_heapRanges;
+static uint32_t g_committedPages;
+static uint32_t g_faultCount;
+static uint32_t g_failedFaults;
+static uint64_t g_faultCycles;
+static uint64_t g_maxFaultCycles;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static bool CommitPage(uintptr_t pageAddress);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool kheapInitialize()
+{
+    return g_heapRanges.Initialize(VM_HeapBase, VM_HeapSize);
+}
+
+_Use_decl_annotations_
+void* kheapReserve(size_t cb)
+{
+    if (cb == 0
+        || cb > VM_HeapSize)
+    {
+        return nullptr;
+    }
+
+    const uint32_t pageCount = (uint32_t)((cb + PageSize - 1) / PageSize);
+    return (void*)g_heapRanges.Allocate(pageCount);
+}
+
+_Use_decl_annotations_
+void kheapRelease(void* ptr)
+{
+    const uintptr_t base = (uintptr_t)ptr;
+
+    if (ptr == nullptr
+        || !g_heapRanges.IsReserved(base))
+    {
+        return;
+    }
+
+    // the range is only freed once the pages are unmapped everywhere, so it can't be handed out
+    // again while a stale TLB entry still points at the old frames.
+    g_committedPages -= vmUnmapAndFree(ptr, g_heapRanges.RangePages(base));
+    g_heapRanges.Free(base);
+}
+
+_Use_decl_annotations_
+bool kheapHandleFault(uintptr_t address, bool wasPresent)
+{
+    // guard pages and released ranges aren't reserved, so touching them still faults for real.
+    if (wasPresent
+        || !g_heapRanges.IsReserved(address))
+    {
+        return false;
+    }
+
+    const uint64_t start = __rdtsc();
+    const bool committed = CommitPage(address & ~(uintptr_t)(PageSize - 1));
+    const uint64_t cycles = __rdtsc() - start;
+
+    g_faultCount++;
+    g_faultCycles += cycles;
+
+    if (cycles > g_maxFaultCycles)
+    {
+        g_maxFaultCycles = cycles;
+    }
+
+    if (!committed)
+    {
+        g_failedFaults++;
+    }
+
+    return committed;
+}
+
+_Use_decl_annotations_
+void kheapGetStats(KheapStats* stats)
+{
+    stats->reservedPages = g_heapRanges.ReservedPages();
+    stats->committedPages = g_committedPages;
+    stats->faultCount = g_faultCount;
+    stats->failedFaults = g_failedFaults;
+    stats->faultCycles = g_faultCycles;
+    stats->maxFaultCycles = g_maxFaultCycles;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+bool CommitPage(uintptr_t pageAddress)
+{
+    const uintptr_t frame = pmAllocateFrame(0);
+    if (frame == 0)
+    {
+        return false;
+    }
+
+    // zero the frame before it becomes visible, so stale data never leaks into the heap.
+    if (!kmapZeroFrame(frame)
+        || !vmMap((void*)pageAddress, frame, 1, VMF_KernelData))
+    {
+        pmFree((void*)frame, 1);
+        return false;
+    }
+
+    g_committedPages++;
+    return true;
+}
+
+NOS_END_EXTERN_C
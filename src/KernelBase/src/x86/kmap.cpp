@@ -0,0 +1,177 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of temporary frame mappings for x86.
+//!
+//! \details
+//! Low memory is reached through the direct map; the slots are for the high memory frames
+//! pmAllocateFrame hands out above it. The slots all live in a single page table at the top of
+//! the address space, which is allocated once up front. That keeps kmapAtomic down to a store
+//! into that table - no page table walk, no allocation, and nothing to flush, since every slot is
+//! invalidated when it's released.
+//-------------------------------------------------------------------------------------------------
+#include "kmap.h"
+#include "pagetable.h"
+#include "paging.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+//! \brief  The state of a processor's slots. Padded so processors don't share cache lines.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_KmapCpuState
+{
+    uint32_t depth;         //!< The number of slots in use.
+} KmapCpuState;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,   //!< The size of a single page of memory.
+    PteShift = 12,              //!< Shift of the page table index in an address.
+};
+
+static_assert(CPU_MaxCount * KMAP_SlotsPerCpu * PageSize <= VM_FixmapSize,
+              "Not enough room for every processor's slots.");
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static pte_t* g_fixmapEntries;      //!< The entries of the slots' page table.
+static KmapCpuState g_kmapCpuState[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline uintptr_t SlotAddress(uint32_t slot)
+{
+    return VM_FixmapBase + (uintptr_t)slot * PageSize;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool kmapInitialize()
+{
+    // the window is exactly one page table, so the entries for every slot are contiguous.
+    g_fixmapEntries = vmGetPageTableEntry(VM_FixmapBase, true);
+    return (g_fixmapEntries != nullptr);
+}
+
+_Use_decl_annotations_
+void* kmapAtomic(uintptr_t frame)
+{
+    if ((frame % PageSize) != 0)
+    {
+        return nullptr;
+    }
+
+    void* direct = vmPhysToVirt(frame);
+    if (direct != nullptr)
+    {
+        return direct;
+    }
+
+    if (g_fixmapEntries == nullptr)
+    {
+        return nullptr;
+    }
+
+    // the slot is this processor's, so the thread can't be switched away (letting the next one
+    // on the processor take the same slot) until it's released.
+    cpuDisablePreemption();
+
+    const uint32_t cpu = cpuCurrentIndex();
+    KmapCpuState* state = &g_kmapCpuState[cpu];
+
+    if (state->depth >= KMAP_SlotsPerCpu)
+    {
+        cpuEnablePreemption();
+        return nullptr;
+    }
+
+    // claim the slot before filling it in, so an interrupt arriving in between takes the next
+    // one instead of this one.
+    const uint32_t slot = cpu * KMAP_SlotsPerCpu + state->depth;
+    state->depth++;
+    _ReadWriteBarrier();
+
+    // the slot was invalidated when it was last released, so there's no stale entry to flush.
+    g_fixmapEntries[slot] = (pte_t)frame | PE_Present | PE_Writable;
+    return (void*)SlotAddress(slot);
+}
+
+_Use_decl_annotations_
+void kunmapAtomic(void* ptr)
+{
+    const uintptr_t address = (uintptr_t)ptr;
+
+    if (address < VM_FixmapBase)
+    {
+        // came from the direct map; nothing to release.
+        return;
+    }
+
+    const uint32_t cpu = cpuCurrentIndex();
+    KmapCpuState* state = &g_kmapCpuState[cpu];
+    const uint32_t slot = (uint32_t)((address - VM_FixmapBase) >> PteShift);
+
+    //TODO: kassert(state->depth > 0 && slot == cpu * KMAP_SlotsPerCpu + state->depth - 1);
+    g_fixmapEntries[slot] = 0;
+    __invlpg((void*)SlotAddress(slot));
+
+    // only hand the slot back once the old translation is gone.
+    _ReadWriteBarrier();
+    state->depth--;
+
+    cpuEnablePreemption();
+}
+
+_Use_decl_annotations_
+bool kmapZeroFrame(uintptr_t frame)
+{
+    void* ptr = kmapAtomic(frame);
+    if (ptr == nullptr)
+    {
+        return false;
+    }
+
+    memset(ptr, 0, PageSize);
+    kunmapAtomic(ptr);
+    return true;
+}
+
+_Use_decl_annotations_
+bool kmapCopyFrame(uintptr_t destFrame, uintptr_t sourceFrame)
+{
+    void* dest = kmapAtomic(destFrame);
+    if (dest == nullptr)
+    {
+        return false;
+    }
+
+    void* source = kmapAtomic(sourceFrame);
+    if (source == nullptr)
+    {
+        kunmapAtomic(dest);
+        return false;
+    }
+
+    memcpy(dest, source, PageSize);
+
+    kunmapAtomic(source);
+    kunmapAtomic(dest);
+    return true;
+}
+
+NOS_END_EXTERN_C
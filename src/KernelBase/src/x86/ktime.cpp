@@ -0,0 +1,316 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the TSC-based monotonic clock.
+//!
+//! \details
+//! Cycles are converted to nanoseconds with a 32-bit multiplier and a shift, which only needs
+//! two 32x32 multiplies on x86 (no 64-bit division). The conversion parameters are published
+//! with a sequence lock, so they can be updated (by recalibration, for instance) while other
+//! code is reading the clock without taking a lock on the read side.
+//-------------------------------------------------------------------------------------------------
+#include "ktime.h"
+#include "acpi.h"
+#include "pit.h"
+#include "idt.h"
+#include "vmalloc.h"
+#include "krtinit.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+//! \brief  A conversion from one rate to another: out = (in * mult) >> shift.
+typedef struct tag_MultShift
+{
+    uint32_t mult;
+    uint32_t shift;
+} MultShift;
+
+//! \brief  The state published by the clock's writer.
+typedef struct tag_ClockState
+{
+    uint64_t baseCycles;        //!< TSC value at the last rebase.
+    uint64_t baseNs;            //!< Clock value at the last rebase.
+    MultShift cyclesToNs;
+    MultShift nsToCycles;
+} ClockState;
+
+#pragma pack(push, 1)
+typedef struct tag_AcpiHpet
+{
+    AcpiTableHeader header;
+    uint32_t eventTimerBlockId;
+    uint8_t addressSpaceId;
+    uint8_t registerBitWidth;
+    uint8_t registerBitOffset;
+    uint8_t accessSize;
+    uint64_t address;
+    uint8_t hpetNumber;
+    uint16_t minimumTick;
+    uint8_t pageProtection;
+} AcpiHpet;
+#pragma pack(pop)
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    CalibrationUs = 50000,          //!< Length of each PIT calibration run.
+    CalibrationRuns = 3,            //!< The fastest of these many runs is used.
+    HpetCalibrationNs = 10000000,   //!< Length of the HPET calibration run.
+
+    HpetMappingSize = 0x100,
+    HPET_Capabilities = 0x00 / 4,   //!< High dword: counter period, in femtoseconds.
+    HPET_Configuration = 0x10 / 4,
+    HPET_MainCounter = 0xF0 / 4,
+    HPET_Enable = (1u << 0),
+};
+
+static const uint64_t NsPerSecond = 1000000000;
+static const uint64_t FsPerNs = 1000000;
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static volatile uint32_t g_clockSequence;   //!< Odd while the state is being updated.
+static ClockState g_clock;
+static uint64_t g_tscFrequency;
+static const char* g_calibrationSource = "none";
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline uint64_t MulShift(uint64_t value, MultShift conversion)
+{
+    // (value * mult) is up to 96 bits, so it's done in two halves. shift is at most 32, so the
+    // result is exact.
+    const uint64_t low = __emulu((uint32_t)value, conversion.mult);
+    const uint64_t high = __emulu((uint32_t)(value >> 32), conversion.mult);
+
+    return (high << (32 - conversion.shift)) + (low >> conversion.shift);
+}
+
+static inline void ReadClock(_Out_ ClockState* state)
+{
+    uint32_t sequence;
+
+    do
+    {
+        sequence = g_clockSequence;
+        _ReadWriteBarrier();
+
+        *state = g_clock;
+
+        _ReadWriteBarrier();
+    } while ((sequence & 1) != 0 || sequence != g_clockSequence);
+}
+
+static MultShift ComputeMultShift(uint64_t fromRate, uint64_t toRate);
+static void Publish(uint64_t tscFrequency);
+static uint64_t CalibrateWithPit(void);
+static uint64_t CalibrateWithHpet(_In_ const AcpiHpet* hpet);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool ktimeInitialize()
+{
+    if ((nos_cpu_features & nos_cpu_TSC) == 0)
+    {
+        return false;
+    }
+
+    uint64_t frequency = 0;
+
+    const AcpiHpet* hpet = (const AcpiHpet*)acpiFindTable("HPET");
+    if (hpet != nullptr)
+    {
+        frequency = CalibrateWithHpet(hpet);
+        g_calibrationSource = "HPET";
+    }
+
+    if (frequency == 0)
+    {
+        frequency = CalibrateWithPit();
+        g_calibrationSource = "PIT";
+    }
+
+    if (frequency == 0)
+    {
+        return false;
+    }
+
+    Publish(frequency);
+    return true;
+}
+
+uint64_t ktimeNowNs()
+{
+    ClockState state;
+    ReadClock(&state);
+
+    return state.baseNs + MulShift(__rdtsc() - state.baseCycles, state.cyclesToNs);
+}
+
+uint64_t ktimeCyclesToNs(uint64_t cycles)
+{
+    ClockState state;
+    ReadClock(&state);
+
+    return MulShift(cycles, state.cyclesToNs);
+}
+
+uint64_t ktimeNsToCycles(uint64_t ns)
+{
+    ClockState state;
+    ReadClock(&state);
+
+    return MulShift(ns, state.nsToCycles);
+}
+
+uint64_t ktimeTscFrequency()
+{
+    return g_tscFrequency;
+}
+
+bool ktimeTscIsInvariant()
+{
+    return (nos_cpu_features & nos_cpu_InvariantTSC) != 0;
+}
+
+const char* ktimeCalibrationSource()
+{
+    return g_calibrationSource;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+MultShift ComputeMultShift(uint64_t fromRate, uint64_t toRate)
+{
+    // use the biggest shift (the most precision) which keeps mult in 32 bits, and doesn't
+    // overflow while computing it.
+    MultShift conversion = { 0, 0 };
+
+    for (uint32_t shift = 32; shift > 0; shift--)
+    {
+        if ((toRate >> (64 - shift)) != 0)
+        {
+            continue;
+        }
+
+        const uint64_t mult = (toRate << shift) / fromRate;
+        if (mult <= UINT32_MAX)
+        {
+            conversion.mult = (uint32_t)mult;
+            conversion.shift = shift;
+            return conversion;
+        }
+    }
+
+    const uint64_t mult = toRate / fromRate;
+    conversion.mult = (mult <= UINT32_MAX) ? (uint32_t)mult : UINT32_MAX;
+    return conversion;
+}
+
+void Publish(uint64_t tscFrequency)
+{
+    // carry the clock's current value over, so it stays monotonic across the change.
+    const uint64_t nowNs = (g_tscFrequency != 0) ? ktimeNowNs() : 0;
+
+    const bool enabled = idtDisableInterrupts();
+
+    g_clockSequence++;
+    _ReadWriteBarrier();
+
+    g_clock.baseCycles = __rdtsc();
+    g_clock.baseNs = nowNs;
+    g_clock.cyclesToNs = ComputeMultShift(tscFrequency, NsPerSecond);
+    g_clock.nsToCycles = ComputeMultShift(NsPerSecond, tscFrequency);
+    g_tscFrequency = tscFrequency;
+
+    _ReadWriteBarrier();
+    g_clockSequence++;
+
+    idtRestoreInterrupts(enabled);
+}
+
+uint64_t CalibrateWithPit()
+{
+    uint64_t bestCycles = UINT64_MAX;
+
+    for (uint32_t run = 0; run < CalibrationRuns; run++)
+    {
+        pitStartCountdown(CalibrationUs);
+        const uint64_t start = __rdtsc();
+
+        while (!pitCountdownExpired())
+        {
+            _mm_pause();
+        }
+
+        const uint64_t cycles = __rdtsc() - start;
+
+        // anything that delays the loop (such as an SMI) only makes a run longer.
+        if (cycles < bestCycles)
+        {
+            bestCycles = cycles;
+        }
+    }
+
+    return (bestCycles * 1000000) / CalibrationUs;
+}
+
+uint64_t CalibrateWithHpet(const AcpiHpet* hpet)
+{
+    if (hpet->address > UINTPTR_MAX)
+    {
+        return 0;
+    }
+
+    volatile uint32_t* registers =
+        (volatile uint32_t*)vmMapIo((uintptr_t)hpet->address, HpetMappingSize);
+
+    if (registers == nullptr)
+    {
+        return 0;
+    }
+
+    const uint32_t periodFs = registers[HPET_Capabilities + 1];
+    if (periodFs == 0)
+    {
+        vmUnmapIo((void*)registers);
+        return 0;
+    }
+
+    registers[HPET_Configuration] |= HPET_Enable;
+
+    // 10ms of HPET ticks fits easily in the low half of the counter, so the high half is ignored.
+    const uint32_t targetTicks = (uint32_t)((HpetCalibrationNs * FsPerNs) / periodFs);
+    const uint32_t startTicks = registers[HPET_MainCounter];
+    const uint64_t startCycles = __rdtsc();
+
+    uint32_t elapsedTicks;
+    do
+    {
+        _mm_pause();
+        elapsedTicks = registers[HPET_MainCounter] - startTicks;
+    } while (elapsedTicks < targetTicks);
+
+    const uint64_t cycles = __rdtsc() - startCycles;
+    vmUnmapIo((void*)registers);
+
+    const uint64_t elapsedNs = ((uint64_t)elapsedTicks * periodFs) / FsPerNs;
+    return (cycles * NsPerSecond) / elapsedNs;
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,505 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of kernel timers, on a hierarchical timing wheel.
+//!
+//! \details
+//! The wheel has WheelLevels levels of SlotsPerLevel slots each. A slot on level L covers
+//! 64^L ticks, so the levels together cover 64^4 ticks (about 4.6 hours at 1ms per tick). Each
+//! timer goes on the lowest level with room for its deadline. Whenever the low level wraps
+//! around, the next slot of the level above is cascaded down - its timers are reinserted, and
+//! land on lower levels now that they're closer. Timers further out than the whole wheel are
+//! parked in the top level and cascade around it until they come into range.
+//!
+//! Each level has a bitmap of its occupied slots, so finding the next deadline (to program the
+//! hardware timer) and skipping over idle stretches never has to look at empty slots.
+//!
+//! Every processor has a wheel of its own, driven by its local APIC timer, and a timer goes on the
+//! wheel of the processor which arms it - so it expires there too. Each wheel has a lock, since a
+//! timer can be cancelled or rearmed from another processor. Without a local APIC timer there's
+//! only the PIT, whose interrupt goes to one processor, so every timer shares the first wheel.
+//-------------------------------------------------------------------------------------------------
+#include "ktimer.h"
+#include "ktime.h"
+#include "apic.h"
+#include "pit.h"
+#include "idt.h"
+#include "softirq.h"
+#include "physmem.h"
+#include "spinlock.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    WheelLevels = 4,
+    SlotBits = 6,
+    SlotsPerLevel = (1 << SlotBits),
+    SlotMask = SlotsPerLevel - 1,
+
+    MaxOneShotNs = 1000000000,      //!< Longest hardware timer delay (it's rearmed if needed).
+};
+
+static const uint64_t WheelSpan = (uint64_t)1 << (SlotBits * WheelLevels);
+static const uint64_t NoDeadline = UINT64_MAX;
+
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+//! \brief  A processor's timing wheel. Only expired by its own processor.
+typedef struct tag_TimerWheel
+{
+    TicketLock lock;                            //!< Guards everything below.
+    uint64_t occupied[WheelLevels];             //!< Bit set for every non-empty slot.
+    uint64_t wheelTick;                         //!< The last tick processed.
+    uint64_t programmedTick;                    //!< The tick the hardware will fire on.
+    TimerStats stats;
+    Timer slots[WheelLevels][SlotsPerLevel];    //!< List heads (circular, with sentinels).
+} TimerWheel;
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static TimerWheel* g_wheels[CPU_MaxCount];      //!< Allocated for each processor online.
+static bool g_useLapic;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline uint64_t NowTick()
+{
+    return ktimeNowNs() / TIMER_TickNs;
+}
+
+static inline uint32_t CurrentWheelIndex()
+{
+    return g_useLapic ? cpuCurrentIndex() : 0;
+}
+
+static inline bool IsSlotHead(_In_ const TimerWheel* wheel, _In_ const Timer* timer)
+{
+    const Timer* first = &wheel->slots[0][0];
+    return (timer >= first && timer < first + WheelLevels * SlotsPerLevel);
+}
+
+static inline void Unlink(_Inout_ TimerWheel* wheel, _Inout_ Timer* timer)
+{
+    Timer* prev = timer->prev;
+    Timer* next = timer->next;
+
+    prev->next = next;
+    next->prev = prev;
+
+    timer->prev = nullptr;
+    timer->next = nullptr;
+
+    // if that left the slot empty, only its head is left, pointing at itself.
+    if (prev == next
+        && IsSlotHead(wheel, prev))
+    {
+        const uint32_t index = (uint32_t)(prev - &wheel->slots[0][0]);
+        wheel->occupied[index / SlotsPerLevel] &= ~((uint64_t)1 << (index % SlotsPerLevel));
+    }
+}
+
+static uint32_t NextSlotDistance(uint64_t occupied, uint32_t current);
+static void Insert(_Inout_ TimerWheel* wheel, _Inout_ Timer* timer);
+static void Cascade(_Inout_ TimerWheel* wheel, uint32_t level, uint32_t slot);
+static void ExpireSlot(_Inout_ TimerWheel* wheel, uint32_t slot);
+static void Process(_Inout_ TimerWheel* wheel, uint64_t nowTick);
+static uint64_t NextDeadline(_In_ const TimerWheel* wheel);
+static void Program(_Inout_ TimerWheel* wheel, uint64_t deadlineTick);
+static void TimerInterrupt(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+static void TimerSoftirq(_In_opt_ void* context);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool timerInitialize()
+{
+    if (ktimeTscFrequency() == 0)
+    {
+        return false;
+    }
+
+    // the local APIC timer doesn't need port I/O to rearm, and every processor has its own, so
+    // it's preferred over the PIT.
+    g_useLapic = (lapicTimerTicksPerMs() != 0);
+
+    const uint32_t wheelCount = g_useLapic ? CPU_MaxCount : 1;
+    const uint32_t wheelPages = (sizeof(TimerWheel) + NOS_PAGE_SIZE - 1) / NOS_PAGE_SIZE;
+
+    for (uint32_t cpu = 0; cpu < wheelCount; cpu++)
+    {
+        if (!cpuGetData(cpu)->online)
+        {
+            continue;
+        }
+
+        TimerWheel* wheel = (TimerWheel*)pmAllocatePages(wheelPages, nullptr);
+        if (wheel == nullptr)
+        {
+            return false;
+        }
+
+        memset(wheel, 0, sizeof(*wheel));
+
+        for (uint32_t level = 0; level < WheelLevels; level++)
+        {
+            for (uint32_t slot = 0; slot < SlotsPerLevel; slot++)
+            {
+                wheel->slots[level][slot].next = &wheel->slots[level][slot];
+                wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+            }
+        }
+
+        wheel->wheelTick = NowTick();
+        wheel->programmedTick = NoDeadline;
+        g_wheels[cpu] = wheel;
+    }
+
+    softirqRegister(SOFTIRQ_Timer, TimerSoftirq, nullptr);
+
+    if (g_useLapic)
+    {
+        lapicTimerSetHandler(TimerInterrupt, nullptr);
+    }
+    else
+    {
+        idtRegisterIrqHandler(PIT_Irq, TimerInterrupt, nullptr);
+    }
+
+    return true;
+}
+
+_Use_decl_annotations_
+void timerSetup(Timer* timer, TimerCallback callback, void* context)
+{
+    timer->next = nullptr;
+    timer->prev = nullptr;
+    timer->expires = 0;
+    timer->wheel = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+_Use_decl_annotations_
+void timerArm(Timer* timer, uint64_t delayNs)
+{
+    // the timer may be armed on another processor's wheel, which is only changed under its lock.
+    timerCancel(timer);
+
+    const bool enabled = idtDisableInterrupts();
+    const uint32_t index = CurrentWheelIndex();
+    TimerWheel* wheel = g_wheels[index];
+
+    ticketLockAcquire(&wheel->lock);
+
+    // round up, so the timer never fires early.
+    timer->expires = (ktimeNowNs() + delayNs + TIMER_TickNs - 1) / TIMER_TickNs;
+    timer->wheel = index;
+    Insert(wheel, timer);
+    wheel->stats.armedCount++;
+
+    if (timer->expires < wheel->programmedTick)
+    {
+        Program(wheel, timer->expires);
+    }
+
+    ticketLockReleaseIrqRestore(&wheel->lock, enabled);
+}
+
+_Use_decl_annotations_
+bool timerCancel(Timer* timer)
+{
+    TimerWheel* wheel = g_wheels[timer->wheel];
+    const bool enabled = ticketLockAcquireIrqSave(&wheel->lock);
+    const bool wasArmed = timerIsArmed(timer);
+
+    if (wasArmed)
+    {
+        // the hardware timer is left alone. If this was the next deadline, the interrupt will
+        // find nothing to do and program the one after.
+        Unlink(wheel, timer);
+        wheel->stats.armedCount--;
+    }
+
+    ticketLockReleaseIrqRestore(&wheel->lock, enabled);
+    return wasArmed;
+}
+
+_Use_decl_annotations_
+void timerGetStats(TimerStats* stats)
+{
+    stats->armedCount = 0;
+    stats->firedCount = 0;
+    stats->interruptCount = 0;
+    stats->cascadeCount = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        TimerWheel* wheel = g_wheels[cpu];
+        if (wheel == nullptr)
+        {
+            continue;
+        }
+
+        const bool enabled = ticketLockAcquireIrqSave(&wheel->lock);
+
+        stats->armedCount += wheel->stats.armedCount;
+        stats->firedCount += wheel->stats.firedCount;
+        stats->interruptCount += wheel->stats.interruptCount;
+        stats->cascadeCount += wheel->stats.cascadeCount;
+
+        ticketLockReleaseIrqRestore(&wheel->lock, enabled);
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+uint32_t NextSlotDistance(uint64_t occupied, uint32_t current)
+{
+    // rotate so the slot after current is bit 0, then find the first occupied slot from there.
+    const uint32_t start = (current + 1) & SlotMask;
+    const uint64_t rotated = (start == 0)
+        ? occupied
+        : ((occupied >> start) | (occupied << (SlotsPerLevel - start)));
+
+    unsigned long index;
+    if (_BitScanForward(&index, (uint32_t)rotated))
+    {
+        return index + 1;
+    }
+
+    _BitScanForward(&index, (uint32_t)(rotated >> 32));
+    return index + 32 + 1;
+}
+
+_Use_decl_annotations_
+void Insert(TimerWheel* wheel, Timer* timer)
+{
+    const uint64_t wheelTick = wheel->wheelTick;
+    uint64_t expires = timer->expires;
+
+    if (expires <= wheelTick)
+    {
+        expires = wheelTick + 1;
+    }
+    else if (expires - wheelTick >= WheelSpan)
+    {
+        expires = wheelTick + WheelSpan - 1;
+    }
+
+    const uint64_t delta = expires - wheelTick;
+    uint32_t level = 0;
+
+    while (level < WheelLevels - 1
+        && delta >= ((uint64_t)1 << (SlotBits * (level + 1))))
+    {
+        level++;
+    }
+
+    const uint32_t slot = (uint32_t)(expires >> (SlotBits * level)) & SlotMask;
+    Timer* head = &wheel->slots[level][slot];
+
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+_Use_decl_annotations_
+void Cascade(TimerWheel* wheel, uint32_t level, uint32_t slot)
+{
+    Timer* head = &wheel->slots[level][slot];
+
+    while (head->next != head)
+    {
+        Timer* timer = head->next;
+
+        Unlink(wheel, timer);
+        Insert(wheel, timer);
+        wheel->stats.cascadeCount++;
+    }
+}
+
+_Use_decl_annotations_
+void ExpireSlot(TimerWheel* wheel, uint32_t slot)
+{
+    Timer* head = &wheel->slots[0][slot];
+
+    // every timer in a level 0 slot expires on the same tick. Callbacks may arm timers, but
+    // never into this slot, since they're at least a tick in the future.
+    while (head->next != head)
+    {
+        Timer* timer = head->next;
+
+        Unlink(wheel, timer);
+        wheel->stats.armedCount--;
+        wheel->stats.firedCount++;
+
+        // the timer is already off the wheel, so the callback can run with interrupts enabled,
+        // and without the lock - it may well rearm the timer.
+        const TimerCallback callback = timer->callback;
+        void* context = timer->context;
+
+        ticketLockRelease(&wheel->lock);
+        _enable();
+        callback(timer, context);
+        _disable();
+        ticketLockAcquire(&wheel->lock);
+    }
+}
+
+_Use_decl_annotations_
+void Process(TimerWheel* wheel, uint64_t nowTick)
+{
+    while (wheel->wheelTick < nowTick)
+    {
+        // with nothing on level 0, skip straight to the next cascade (or to now).
+        const uint64_t lastBeforeCascade = wheel->wheelTick | SlotMask;
+
+        if (wheel->occupied[0] == 0
+            && lastBeforeCascade > wheel->wheelTick)
+        {
+            wheel->wheelTick = (lastBeforeCascade < nowTick) ? lastBeforeCascade : nowTick;
+            continue;
+        }
+
+        const uint64_t tick = ++wheel->wheelTick;
+
+        if ((tick & SlotMask) == 0)
+        {
+            for (uint32_t level = 1; level < WheelLevels; level++)
+            {
+                const uint32_t slot = (uint32_t)(tick >> (SlotBits * level)) & SlotMask;
+                Cascade(wheel, level, slot);
+
+                if (slot != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        ExpireSlot(wheel, (uint32_t)tick & SlotMask);
+    }
+}
+
+_Use_decl_annotations_
+uint64_t NextDeadline(const TimerWheel* wheel)
+{
+    const uint64_t wheelTick = wheel->wheelTick;
+    uint64_t deadline = NoDeadline;
+
+    if (wheel->occupied[0] != 0)
+    {
+        deadline = wheelTick + NextSlotDistance(wheel->occupied[0], (uint32_t)wheelTick & SlotMask);
+    }
+
+    // higher levels only need a wakeup to cascade their next slot down.
+    for (uint32_t level = 1; level < WheelLevels; level++)
+    {
+        const uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        const uint32_t shift = SlotBits * level;
+        const uint64_t period = wheelTick >> shift;
+        const uint32_t distance = NextSlotDistance(occupied, (uint32_t)period & SlotMask);
+        const uint64_t cascadeTick = (period + distance) << shift;
+
+        if (cascadeTick < deadline)
+        {
+            deadline = cascadeTick;
+        }
+    }
+
+    return deadline;
+}
+
+_Use_decl_annotations_
+void Program(TimerWheel* wheel, uint64_t deadlineTick)
+{
+    // the wheel belongs to this processor (or, with the PIT, to the only one taking its
+    // interrupt), so it's this processor's hardware timer being programmed.
+    wheel->programmedTick = deadlineTick;
+
+    if (deadlineTick == NoDeadline)
+    {
+        // nothing to wait for - no more interrupts until a timer is armed.
+        if (g_useLapic)
+        {
+            lapicTimerStop();
+        }
+
+        return;
+    }
+
+    const uint64_t nowNs = ktimeNowNs();
+    const uint64_t deadlineNs = deadlineTick * TIMER_TickNs;
+
+    uint64_t delayNs = (deadlineNs > nowNs) ? (deadlineNs - nowNs) : 0;
+    if (delayNs > MaxOneShotNs)
+    {
+        delayNs = MaxOneShotNs;
+    }
+
+    if (g_useLapic)
+    {
+        const uint64_t ticks = (delayNs * lapicTimerTicksPerMs()) / 1000000;
+        lapicTimerStart((ticks > 0) ? (uint32_t)ticks : 1, false);
+    }
+    else
+    {
+        pitStartIrqCountdown((uint32_t)(delayNs / 1000));
+    }
+}
+
+void TimerInterrupt(InterruptFrame* frame, void* context)
+{
+    (void)frame;
+    (void)context;
+
+    // expiring timers (and running their callbacks) is left to the softirq, to keep the time
+    // spent with interrupts disabled short.
+    TimerWheel* wheel = g_wheels[CurrentWheelIndex()];
+
+    ticketLockAcquire(&wheel->lock);
+    wheel->stats.interruptCount++;
+    ticketLockRelease(&wheel->lock);
+
+    softirqRaise(SOFTIRQ_Timer);
+}
+
+void TimerSoftirq(void* context)
+{
+    (void)context;
+
+    TimerWheel* wheel = g_wheels[CurrentWheelIndex()];
+    const bool enabled = ticketLockAcquireIrqSave(&wheel->lock);
+
+    Process(wheel, NowTick());
+    Program(wheel, NextDeadline(wheel));
+
+    ticketLockReleaseIrqRestore(&wheel->lock, enabled);
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,632 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the paging interface for x86 (32-bit, non-PAE paging).
+//!
+//! \details
+//! Changes to the page tables are made with g_pageTableLock held, so two processors can't both
+//! create the same table. Lookups don't take it: entries are written with single stores.
+//!
+//! When a mapping is removed or changed, the other online processors are sent an IPI to flush it
+//! from their TLBs too, and waited for. That happens after the lock is released, since a processor
+//! spinning for the lock with interrupts disabled couldn't take the IPI. For the same reason, a
+//! processor waiting to start a shootdown of its own carries out the one in progress by polling.
+//-------------------------------------------------------------------------------------------------
+#include "paging.h"
+#include "pagetable.h"
+#include "physmem.h"
+#include "spinlock.h"
+#include "katomic.h"
+#include "idt.h"
+#include "apic.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,           //!< The size of a single page of memory.
+    LargePageSize = 0x400000,           //!< The size of a 4 MiB (PSE) page.
+    EntriesPerTable = 1024,             //!< The number of entries in a page directory or table.
+
+    PdeShift = 22,                      //!< Shift of the page directory index in an address.
+    PteShift = 12,                      //!< Shift of the page table index in an address.
+    IndexMask = EntriesPerTable - 1,    //!< Mask of a table index after shifting.
+
+    FlushAllThreshold = 32,
+            //!< Above this many pages, flushing the whole TLB is cheaper than invlpg.
+};
+
+enum ControlRegisterBits : uint32_t
+{
+    CR0_WriteProtect = (1u << 16),
+    CR0_Paging       = (1u << 31),
+
+    CR4_PageSizeExtensions = (1u << 4),
+    CR4_PageGlobalEnable   = (1u << 7),
+};
+
+enum CpuidFeatureBits : uint32_t
+{
+    CPUID1_EDX_PSE = (1u << 3),
+    CPUID1_EDX_PGE = (1u << 13),
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static pte_t* g_pageDirectory;
+static uintptr_t g_directMapLimit;
+static bool g_pagingEnabled;
+static bool g_supportsLargePages;
+static bool g_supportsGlobalPages;
+static TicketLock g_pageTableLock;
+static TicketLock g_shootdownLock;                  //!< Held for the shootdown in progress.
+static katomic<uint32_t> g_shootdownPending;        //!< Processors yet to flush for it.
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+extern "C++"
+{
+    //---------------------------------------------------------------------------------------------
+    //! \brief  Collects the addresses whose TLB entries need to be invalidated, so a whole
+    //!         mapping change costs one flush instead of one per page.
+    //---------------------------------------------------------------------------------------------
+    class TlbFlushBatch
+    {
+    public:
+        TlbFlushBatch()
+            : m_count{ 0 }
+            , m_flushAll{ false }
+        { }
+
+        void Add(uintptr_t address)
+        {
+            if (m_count < FlushAllThreshold)
+            {
+                m_addresses[m_count++] = address;
+            }
+            else
+            {
+                m_flushAll = true;
+            }
+        }
+
+        void Flush();
+        void FlushLocal() const;
+
+    private:
+        uintptr_t m_addresses[FlushAllThreshold];
+        uint32_t m_count;
+        bool m_flushAll;
+    };
+
+    template <class T>
+    inline T PageAlignUp(T addr)
+    {
+        return ((addr + T{ PageSize - 1 }) & ~T{ PageSize - 1 });
+    }
+}
+
+//! \brief  What the shootdown in progress flushes. Declared here, after its class.
+static TlbFlushBatch g_shootdownBatch;
+
+static uint32_t TranslateFlags(uint32_t flags);
+static pte_t* TableFromEntry(pte_t entry);
+static pte_t* DirectoryEntry(uintptr_t virtualAddress);
+static void FlushEntireTlb(void);
+static void ClearRange(uintptr_t address, uint32_t pageCount, pte_t keepMask);
+static void ShootDown(_In_ const TlbFlushBatch* batch);
+static void ServiceShootdown(void);
+static void ShootdownHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+
+_Check_return_ _Success_(return != nullptr)
+static pte_t* AllocateTable(void);
+
+_Check_return_ _Success_(return != nullptr)
+static pte_t* GetPageTable(uintptr_t virtualAddress, uint32_t tableFlags, bool create);
+
+_Check_return_ _Success_(return != false)
+static bool MapRangeEarly(uintptr_t virtualAddress, uintptr_t physicalAddress, uintptr_t size, pte_t flags);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool vmInitialize()
+{
+    const cpuid_result features = cpuid(0x01);
+    g_supportsLargePages = (features.edx & CPUID1_EDX_PSE) != 0;
+    g_supportsGlobalPages = (features.edx & CPUID1_EDX_PGE) != 0;
+
+    uint64_t memoryTop = pmTotalMemory();
+    if (memoryTop > VM_DirectMapSize)
+    {
+        memoryTop = VM_DirectMapSize;
+    }
+
+    // with large pages, there's no point stopping short of the 4 MiB boundary.
+    g_directMapLimit = g_supportsLargePages
+        ? (((uintptr_t)memoryTop + (LargePageSize - 1)) & ~(uintptr_t)(LargePageSize - 1))
+        : PageAlignUp((uintptr_t)memoryTop);
+
+    if (g_directMapLimit < LargePageSize)
+    {
+        g_directMapLimit = LargePageSize;
+    }
+
+    g_pageDirectory = AllocateTable();
+    if (g_pageDirectory == nullptr)
+    {
+        return false;
+    }
+
+    const pte_t kernelFlags = TranslateFlags(VMF_KernelData);
+
+    // identity map: the first 4 MiB is mapped with small pages so page 0 can stay unmapped, the
+    // rest uses large pages where available.
+    bool mapped = MapRangeEarly(PageSize, PageSize, LargePageSize - PageSize, kernelFlags)
+        && MapRangeEarly(LargePageSize, LargePageSize, g_directMapLimit - LargePageSize, kernelFlags)
+        && MapRangeEarly(VM_DirectMapBase, 0, g_directMapLimit, kernelFlags);
+
+    if (!mapped)
+    {
+        //FUTURE: give the page tables back.
+        return false;
+    }
+
+    uint32_t cr4 = __readcr4();
+    if (g_supportsLargePages)
+    {
+        cr4 |= CR4_PageSizeExtensions;
+    }
+    __writecr4(cr4);
+
+    __writecr3((uint32_t)(uintptr_t)g_pageDirectory);
+    __writecr0(__readcr0() | CR0_Paging | CR0_WriteProtect);
+
+    if (g_supportsGlobalPages)
+    {
+        __writecr4(__readcr4() | CR4_PageGlobalEnable);
+    }
+
+    g_pagingEnabled = true;
+
+    idtRegisterHandler(IDT_TlbShootdownVector, ShootdownHandler, nullptr);
+    return true;
+}
+
+_Use_decl_annotations_
+bool vmMap(void* virtualAddress, uintptr_t physicalAddress, uint32_t pageCount, uint32_t flags)
+{
+    const uintptr_t baseAddress = (uintptr_t)virtualAddress;
+    const pte_t entryFlags = TranslateFlags(flags) | PE_Present;
+    const pte_t tableFlags = PE_Present | PE_Writable | (entryFlags & PE_User);
+
+    if ((baseAddress % PageSize) != 0
+        || (physicalAddress % PageSize) != 0)
+    {
+        return false;
+    }
+
+    TlbFlushBatch batch;
+    uintptr_t address = baseAddress;
+
+    const bool enabled = ticketLockAcquireIrqSave(&g_pageTableLock);
+
+    // make every table the range needs first, so a failure leaves the entries as they were -
+    // including ones that were already mapped, which rolling back couldn't restore.
+    for (uint32_t i = 0; i < pageCount; i++, address += PageSize)
+    {
+        if (GetPageTable(address, tableFlags, true) == nullptr)
+        {
+            ticketLockReleaseIrqRestore(&g_pageTableLock, enabled);
+            return false;
+        }
+    }
+
+    address = baseAddress;
+
+    for (uint32_t i = 0; i < pageCount; i++, address += PageSize, physicalAddress += PageSize)
+    {
+        pte_t* table = GetPageTable(address, tableFlags, false);
+        pte_t* entry = &table[(address >> PteShift) & IndexMask];
+
+        if ((*entry & PE_Present) != 0)
+        {
+            batch.Add(address);
+        }
+
+        *entry = (pte_t)physicalAddress | entryFlags;
+    }
+
+    ticketLockReleaseIrqRestore(&g_pageTableLock, enabled);
+    batch.Flush();
+    return true;
+}
+
+_Use_decl_annotations_
+void vmUnmap(void* virtualAddress, uint32_t pageCount)
+{
+    ClearRange((uintptr_t)virtualAddress, pageCount, 0);
+}
+
+_Use_decl_annotations_
+uint32_t vmUnmapAndFree(void* virtualAddress, uint32_t pageCount)
+{
+    // the entries keep their frames (just not the present bit) until every processor has
+    // flushed them, so there's no need for a list of frames to free afterwards.
+    ClearRange((uintptr_t)virtualAddress, pageCount, PE_FrameMask);
+
+    uintptr_t address = (uintptr_t)virtualAddress;
+    uint32_t freed = 0;
+
+    const bool enabled = ticketLockAcquireIrqSave(&g_pageTableLock);
+
+    for (uint32_t i = 0; i < pageCount; i++, address += PageSize)
+    {
+        pte_t* table = GetPageTable(address, 0, false);
+        if (table == nullptr)
+        {
+            continue;
+        }
+
+        pte_t* entry = &table[(address >> PteShift) & IndexMask];
+        if (*entry != 0)
+        {
+            pmFree((void*)(uintptr_t)(*entry & PE_FrameMask), 1);
+            *entry = 0;
+            freed++;
+        }
+    }
+
+    ticketLockReleaseIrqRestore(&g_pageTableLock, enabled);
+    return freed;
+}
+
+_Use_decl_annotations_
+bool vmTranslate(const void* virtualAddress, uintptr_t* physicalAddress)
+{
+    const uintptr_t address = (uintptr_t)virtualAddress;
+    *physicalAddress = 0;
+
+    if (!g_pagingEnabled)
+    {
+        *physicalAddress = address;
+        return true;
+    }
+
+    const pte_t pde = *DirectoryEntry(address);
+    if ((pde & PE_Present) == 0)
+    {
+        return false;
+    }
+
+    if ((pde & PE_LargePage) != 0)
+    {
+        *physicalAddress = (pde & PE_LargeFrameMask) | (address & (LargePageSize - 1));
+        return true;
+    }
+
+    const pte_t pte = TableFromEntry(pde)[(address >> PteShift) & IndexMask];
+    if ((pte & PE_Present) == 0)
+    {
+        return false;
+    }
+
+    *physicalAddress = (pte & PE_FrameMask) | (address & (PageSize - 1));
+    return true;
+}
+
+void* vmPhysToVirt(uintptr_t physicalAddress)
+{
+    if (physicalAddress >= g_directMapLimit)
+    {
+        return nullptr;
+    }
+
+    return (void*)(VM_DirectMapBase + physicalAddress);
+}
+
+uintptr_t vmDirectMapLimit()
+{
+    return g_directMapLimit;
+}
+
+_Use_decl_annotations_
+pte_t* vmGetPageTableEntry(uintptr_t virtualAddress, bool create)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&g_pageTableLock);
+    pte_t* table = GetPageTable(virtualAddress, PE_Present | PE_Writable, create);
+    ticketLockReleaseIrqRestore(&g_pageTableLock, enabled);
+
+    if (table == nullptr)
+    {
+        return nullptr;
+    }
+
+    return &table[(virtualAddress >> PteShift) & IndexMask];
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void TlbFlushBatch::Flush()
+{
+    // before paging is on, nothing can be cached yet.
+    if (g_pagingEnabled
+        && (m_count > 0 || m_flushAll))
+    {
+        FlushLocal();
+        ShootDown(this);
+    }
+
+    m_count = 0;
+    m_flushAll = false;
+}
+
+void TlbFlushBatch::FlushLocal() const
+{
+    if (m_flushAll)
+    {
+        FlushEntireTlb();
+    }
+    else
+    {
+        for (uint32_t i = 0; i < m_count; i++)
+        {
+            __invlpg((void*)m_addresses[i]);
+        }
+    }
+}
+
+uint32_t TranslateFlags(uint32_t flags)
+{
+    pte_t entry = 0;
+
+    if ((flags & VMF_Writable) != 0)        entry |= PE_Writable;
+    if ((flags & VMF_User) != 0)            entry |= PE_User;
+    if ((flags & VMF_WriteThrough) != 0)    entry |= PE_WriteThrough;
+    if ((flags & VMF_NoCache) != 0)         entry |= PE_NoCache;
+
+    if ((flags & VMF_Global) != 0
+        && g_supportsGlobalPages)
+    {
+        entry |= PE_Global;
+    }
+
+    return entry;
+}
+
+pte_t* TableFromEntry(pte_t entry)
+{
+    const uintptr_t tableAddress = entry & PE_FrameMask;
+
+    // once paging is on, go through the direct map. Before that, physical addresses are usable
+    // as is.
+    return g_pagingEnabled
+        ? (pte_t*)vmPhysToVirt(tableAddress)
+        : (pte_t*)tableAddress;
+}
+
+pte_t* DirectoryEntry(uintptr_t virtualAddress)
+{
+    pte_t* pde = &g_pageDirectory[virtualAddress >> PdeShift];
+
+    // the directory's address is physical, like the tables'.
+    return g_pagingEnabled
+        ? (pte_t*)vmPhysToVirt((uintptr_t)pde)
+        : pde;
+}
+
+void FlushEntireTlb()
+{
+    if (g_supportsGlobalPages)
+    {
+        // toggling PGE flushes global entries as well as everything else.
+        const uint32_t cr4 = __readcr4();
+        __writecr4(cr4 & ~CR4_PageGlobalEnable);
+        __writecr4(cr4);
+    }
+    else
+    {
+        __writecr3(__readcr3());
+    }
+}
+
+void ClearRange(uintptr_t address, uint32_t pageCount, pte_t keepMask)
+{
+    TlbFlushBatch batch;
+
+    const bool enabled = ticketLockAcquireIrqSave(&g_pageTableLock);
+
+    for (uint32_t i = 0; i < pageCount; i++, address += PageSize)
+    {
+        pte_t* table = GetPageTable(address, 0, false);
+        if (table == nullptr)
+        {
+            continue;
+        }
+
+        pte_t* entry = &table[(address >> PteShift) & IndexMask];
+        if ((*entry & PE_Present) != 0)
+        {
+            *entry &= keepMask;
+            batch.Add(address);
+        }
+    }
+
+    //FUTURE: free page tables which become empty.
+    ticketLockReleaseIrqRestore(&g_pageTableLock, enabled);
+    batch.Flush();
+}
+
+void ShootDown(const TlbFlushBatch* batch)
+{
+    const uint32_t self = cpuCurrentIndex();
+    uint32_t targets = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (cpu != self
+            && cpuGetData(cpu)->online)
+        {
+            targets |= (1u << cpu);
+        }
+    }
+
+    if (targets == 0)
+    {
+        return;
+    }
+
+    while (!ticketLockTryAcquire(&g_shootdownLock))
+    {
+        ServiceShootdown();
+        cpu_relax();
+    }
+
+    // the batch is published before the targets, which only look at it once they see their bit.
+    g_shootdownBatch = *batch;
+    g_shootdownPending.store(targets, memory_order::release);
+
+    uint32_t remaining = targets;
+    unsigned long cpu;
+
+    while (_BitScanForward(&cpu, remaining))
+    {
+        remaining &= remaining - 1;
+        lapicSendIpi(cpuGetData(cpu)->apicId, IDT_TlbShootdownVector);
+    }
+
+    while (g_shootdownPending.load(memory_order::acquire) != 0)
+    {
+        cpu_relax();
+    }
+
+    ticketLockRelease(&g_shootdownLock);
+}
+
+void ServiceShootdown()
+{
+    const uint32_t bit = (1u << cpuCurrentIndex());
+
+    if ((g_shootdownPending.load(memory_order::acquire) & bit) != 0)
+    {
+        g_shootdownBatch.FlushLocal();
+        g_shootdownPending.fetch_and(~bit, memory_order::release);
+    }
+}
+
+void ShootdownHandler(InterruptFrame* frame, void* context)
+{
+    // the request may already have been carried out by polling, in which case there's nothing
+    // left to do but acknowledge the IPI.
+    (void)frame;
+    (void)context;
+
+    ServiceShootdown();
+    lapicEndOfInterrupt();
+}
+
+pte_t* AllocateTable()
+{
+    // tables are reached through the direct map, so keep them as low as possible.
+    pte_t* table = (pte_t*)pmAllocatePages(1, nullptr);
+    if (table == nullptr)
+    {
+        return nullptr;
+    }
+
+    if ((uintptr_t)table >= g_directMapLimit)
+    {
+        pmFree(table, 1);
+        return nullptr;
+    }
+
+    pte_t* tableVirt = g_pagingEnabled
+        ? (pte_t*)vmPhysToVirt((uintptr_t)table)
+        : table;
+
+    memset(tableVirt, 0, PageSize);
+    return table;
+}
+
+pte_t* GetPageTable(uintptr_t virtualAddress, uint32_t tableFlags, bool create)
+{
+    pte_t* pde = DirectoryEntry(virtualAddress);
+
+    if ((*pde & PE_Present) == 0)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+
+        pte_t* table = AllocateTable();
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+
+        *pde = (pte_t)(uintptr_t)table | tableFlags;
+    }
+    else if ((*pde & PE_LargePage) != 0)
+    {
+        // can't map individual pages inside a large page.
+        return nullptr;
+    }
+    else if ((*pde & tableFlags) != tableFlags)
+    {
+        *pde |= tableFlags;
+    }
+
+    return TableFromEntry(*pde);
+}
+
+bool MapRangeEarly(uintptr_t virtualAddress, uintptr_t physicalAddress, uintptr_t size, pte_t flags)
+{
+    const uintptr_t largeMask = LargePageSize - 1;
+
+    while (size > 0)
+    {
+        if (g_supportsLargePages
+            && (virtualAddress & largeMask) == 0
+            && (physicalAddress & largeMask) == 0
+            && size >= LargePageSize)
+        {
+            g_pageDirectory[virtualAddress >> PdeShift] = (pte_t)physicalAddress | flags | PE_Present | PE_LargePage;
+
+            virtualAddress += LargePageSize;
+            physicalAddress += LargePageSize;
+            size -= LargePageSize;
+        }
+        else
+        {
+            pte_t* table = GetPageTable(virtualAddress, PE_Present | PE_Writable, true);
+            if (table == nullptr)
+            {
+                return false;
+            }
+
+            table[(virtualAddress >> PteShift) & IndexMask] = (pte_t)physicalAddress | flags | PE_Present;
+
+            virtualAddress += PageSize;
+            physicalAddress += PageSize;
+            size -= PageSize;
+        }
+    }
+
+    return true;
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,176 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the 8259 PIC interface.
+//-------------------------------------------------------------------------------------------------
+#include "pic.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PIC1 = 0x20,                    //!< IO base address for master PIC
+    PIC2 = 0xA0,                    //!< IO base address for slave PIC
+
+    PIC1_COMMAND = PIC1,
+    PIC1_DATA = (PIC1 + 1),
+
+    PIC2_COMMAND = PIC2,
+    PIC2_DATA = (PIC2 + 1),
+
+    IoDelayPort = 0x80,             //!< Unused port written to give the PICs time to settle.
+
+    IrqsPerPic = 8,
+};
+
+enum PicCommands : uint8_t
+{
+    ICW1_Icw4Needed  = 0x01,
+    ICW1_Initialize  = 0x10,
+    ICW4_8086Mode    = 0x01,
+
+    OCW2_EndOfInterrupt = 0x20,
+    OCW3_ReadIsr        = 0x0B,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static uint16_t g_irqMask = 0xFFFF;     //!< Bit set for every masked IRQ (master in the low byte).
+
+static bool SetAffinity(uint32_t irq, uint32_t cpu);
+
+static const IrqController g_picController =
+{
+    "8259 PIC",
+    picMask,
+    picUnmask,
+    picIsSpurious,
+    picEndOfInterrupt,
+    SetAffinity,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline void IoDelay()
+{
+    __outbyte(IoDelayPort, 0);
+}
+
+static void WriteMask(uint32_t irq);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void picInitialize(uint32_t vectorBase)
+{
+    __outbyte(PIC1_COMMAND, ICW1_Initialize | ICW1_Icw4Needed);
+    IoDelay();
+    __outbyte(PIC2_COMMAND, ICW1_Initialize | ICW1_Icw4Needed);
+    IoDelay();
+
+    // ICW2: vector bases
+    __outbyte(PIC1_DATA, (uint8_t)vectorBase);
+    IoDelay();
+    __outbyte(PIC2_DATA, (uint8_t)(vectorBase + IrqsPerPic));
+    IoDelay();
+
+    // ICW3: the slave is on the master's IRQ 2, and has cascade identity 2.
+    __outbyte(PIC1_DATA, 1 << PIC_CascadeIrq);
+    IoDelay();
+    __outbyte(PIC2_DATA, PIC_CascadeIrq);
+    IoDelay();
+
+    __outbyte(PIC1_DATA, ICW4_8086Mode);
+    IoDelay();
+    __outbyte(PIC2_DATA, ICW4_8086Mode);
+    IoDelay();
+
+    // everything starts out masked, except the cascade so the slave's IRQs can get through once
+    // they're unmasked.
+    g_irqMask = (uint16_t)~(1u << PIC_CascadeIrq);
+    __outbyte(PIC1_DATA, (uint8_t)(g_irqMask & 0xFF));
+    __outbyte(PIC2_DATA, (uint8_t)(g_irqMask >> 8));
+}
+
+void picMask(uint32_t irq)
+{
+    g_irqMask |= (uint16_t)(1u << irq);
+    WriteMask(irq);
+}
+
+void picUnmask(uint32_t irq)
+{
+    g_irqMask &= (uint16_t)~(1u << irq);
+    WriteMask(irq);
+}
+
+bool picIsSpurious(uint32_t irq)
+{
+    if (irq == 7)
+    {
+        __outbyte(PIC1_COMMAND, OCW3_ReadIsr);
+        return (__inbyte(PIC1_COMMAND) & 0x80) == 0;
+    }
+
+    if (irq == 15)
+    {
+        __outbyte(PIC2_COMMAND, OCW3_ReadIsr);
+        if ((__inbyte(PIC2_COMMAND) & 0x80) == 0)
+        {
+            __outbyte(PIC1_COMMAND, OCW2_EndOfInterrupt);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void picEndOfInterrupt(uint32_t irq)
+{
+    if (irq >= IrqsPerPic)
+    {
+        __outbyte(PIC2_COMMAND, OCW2_EndOfInterrupt);
+    }
+
+    __outbyte(PIC1_COMMAND, OCW2_EndOfInterrupt);
+}
+
+const IrqController* picGetController()
+{
+    return &g_picController;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void WriteMask(uint32_t irq)
+{
+    // port I/O is slow, so only the PIC which owns the IRQ is updated.
+    if (irq >= IrqsPerPic)
+    {
+        __outbyte(PIC2_DATA, (uint8_t)(g_irqMask >> 8));
+    }
+    else
+    {
+        __outbyte(PIC1_DATA, (uint8_t)(g_irqMask & 0xFF));
+    }
+}
+
+bool SetAffinity(uint32_t irq, uint32_t cpu)
+{
+    // the PICs only ever deliver to the boot processor.
+    (void)irq;
+    return (cpu == 0);
+}
+
+NOS_END_EXTERN_C
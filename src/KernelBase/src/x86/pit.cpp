@@ -0,0 +1,79 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the PIT reference clock helpers.
+//-------------------------------------------------------------------------------------------------
+#include "pit.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PIT_CHANNEL0 = 0x40,
+    PIT_CHANNEL2 = 0x42,
+    PIT_COMMAND = 0x43,
+    PORT_B = 0x61,                      //!< System control port B (channel 2 gate and output).
+
+    Channel0OneShot = 0x30,             //!< Channel 0, low then high byte, mode 0, binary.
+    Channel2OneShot = 0xB0,             //!< Channel 2, low then high byte, mode 0, binary.
+
+    PortB_Gate2 = 0x01,
+    PortB_Speaker = 0x02,
+    PortB_Out2 = 0x20,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline uint32_t CountFromMicroseconds(uint32_t microseconds)
+{
+    if (microseconds > PIT_MaxCountdownUs)
+    {
+        microseconds = PIT_MaxCountdownUs;
+    }
+
+    const uint32_t count = (uint32_t)(((uint64_t)microseconds * PIT_Frequency) / 1000000);
+    return (count > 0) ? count : 1;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void pitStartCountdown(uint32_t microseconds)
+{
+    const uint32_t count = CountFromMicroseconds(microseconds);
+
+    // hold the gate low (and keep the speaker quiet) while the count is loaded, then raise it to
+    // start counting. The output goes high when the count reaches 0.
+    const uint8_t portB = __inbyte(PORT_B) & ~(PortB_Gate2 | PortB_Speaker);
+    __outbyte(PORT_B, portB);
+
+    __outbyte(PIT_COMMAND, Channel2OneShot);
+    __outbyte(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    __outbyte(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
+
+    __outbyte(PORT_B, portB | PortB_Gate2);
+}
+
+bool pitCountdownExpired()
+{
+    return (__inbyte(PORT_B) & PortB_Out2) != 0;
+}
+
+void pitStartIrqCountdown(uint32_t microseconds)
+{
+    const uint32_t count = CountFromMicroseconds(microseconds);
+
+    // channel 0's gate is always high, so it starts counting as soon as the count is loaded.
+    __outbyte(PIT_COMMAND, Channel0OneShot);
+    __outbyte(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    __outbyte(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
+
+NOS_END_EXTERN_C
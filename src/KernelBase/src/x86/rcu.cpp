@@ -0,0 +1,165 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of quiescent-state-based reclamation.
+//!
+//! \details
+//! Reporting a quiescent state is a store to the processor's own counter - but a sequentially
+//! consistent one. Otherwise the store could sit in the store buffer while the processor goes on
+//! to read a pointer the writer has already replaced, and the writer would see the new count and
+//! free what's being read.
+//!
+//! A waiting writer reports its own quiescent states while it waits, so two writers waiting at
+//! once can't hold each other up.
+//-------------------------------------------------------------------------------------------------
+#include "rcu.h"
+#include "katomic.h"
+#include "idt.h"
+#include "apic.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+//! \brief  A processor's counter gets a cache line of its own, since every writer polls it.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_RcuCpuState
+{
+    katomic<uint32_t> quiescentCount;
+    RcuStats stats;             //!< Only touched by the processor itself.
+} RcuCpuState;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    KickSpins = 2000,           //!< Polls before the processors still in the way get an IPI.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static RcuCpuState g_rcuCpuState[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static void KickHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void rcuInitialize()
+{
+    idtRegisterHandler(IDT_RcuKickVector, KickHandler, nullptr);
+}
+
+void rcuQuiescentState()
+{
+    // only this processor writes its counter, so there's no need for a locked add.
+    katomic<uint32_t>* count = &g_rcuCpuState[cpuCurrentIndex()].quiescentCount;
+    count->store(count->load(memory_order::relaxed) + 1, memory_order::seq_cst);
+}
+
+void rcuSynchronize()
+{
+    // this processor is between reads, and the report's fence puts the caller's publishing
+    // store ahead of the counters read below.
+    rcuQuiescentState();
+
+    const uint32_t self = cpuCurrentIndex();
+    uint32_t snapshot[CPU_MaxCount];
+    uint32_t waiting = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        if (cpu != self
+            && cpuGetData(cpu)->online)
+        {
+            snapshot[cpu] = g_rcuCpuState[cpu].quiescentCount.load(memory_order::acquire);
+            waiting |= (1u << cpu);
+        }
+    }
+
+    RcuStats* stats = &g_rcuCpuState[self].stats;
+    const uint64_t start = __rdtsc();
+    uint32_t spins = 0;
+
+    while (waiting != 0)
+    {
+        uint32_t remaining = waiting;
+        unsigned long cpu;
+
+        while (_BitScanForward(&cpu, remaining))
+        {
+            remaining &= ~(1u << cpu);
+
+            // any change will do: the count wraps long before a processor could go all the way
+            // round it in one poll.
+            if (g_rcuCpuState[cpu].quiescentCount.load(memory_order::acquire) != snapshot[cpu])
+            {
+                waiting &= ~(1u << cpu);
+            }
+            else if (spins == KickSpins)
+            {
+                lapicSendIpi(cpuGetData(cpu)->apicId, IDT_RcuKickVector);
+                stats->kickCount++;
+            }
+        }
+
+        spins++;
+        rcuQuiescentState();
+        cpu_relax();
+    }
+
+    const uint64_t elapsed = __rdtsc() - start;
+
+    stats->graceCount++;
+    stats->waitCycles += elapsed;
+    if (elapsed > stats->maxWaitCycles)
+    {
+        stats->maxWaitCycles = elapsed;
+    }
+}
+
+_Use_decl_annotations_
+void rcuGetStats(RcuStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const RcuStats* cpuStats = &g_rcuCpuState[cpu].stats;
+
+        stats->graceCount += cpuStats->graceCount;
+        stats->kickCount += cpuStats->kickCount;
+        stats->waitCycles += cpuStats->waitCycles;
+        if (cpuStats->maxWaitCycles > stats->maxWaitCycles)
+        {
+            stats->maxWaitCycles = cpuStats->maxWaitCycles;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void KickHandler(InterruptFrame* frame, void* context)
+{
+    // the quiescent state is reported by the dispatcher, on the way out.
+    (void)frame;
+    (void)context;
+
+    lapicEndOfInterrupt();
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,79 @@
+.686P
+.model  flat, c
+
+public ApTrampolineStart
+public ApProtectedMode
+public ApTrampolineParameters
+public ApTrampolineEnd
+
+.code
+
+; The application processor trampoline. smpStartProcessors copies everything from
+; ApTrampolineStart to ApTrampolineEnd into a page below 1 MiB, fills in the parameters, and
+; starts the processor at the start of the page with cs:ip = page:0.
+;
+; The first part runs in 16-bit real mode. This module is assembled as 32-bit code, so those
+; instructions are spelled out as bytes. Until paging is on, everything is addressed relative to
+; the copy: through ds = cs in real mode, and through ebx = the copy's linear address after that.
+align 16
+ApTrampolineStart:
+    db      0FAh                        ; cli
+    db      0FCh                        ; cld
+    db      08Ch, 0C8h                  ; mov     ax, cs
+    db      08Eh, 0D8h                  ; mov     ds, ax
+    db      066h, 00Fh, 0B7h, 0D8h      ; movzx   ebx, ax
+    db      066h, 0C1h, 0E3h, 004h      ; shl     ebx, 4
+    db      066h, 00Fh, 001h, 016h      ; lgdt    fword ptr [ApGdtDescriptor]
+    dw      ApGdtDescriptor - ApTrampolineStart
+    db      00Fh, 020h, 0C0h            ; mov     eax, cr0
+    db      00Ch, 001h                  ; or      al, 1 (protection enable)
+    db      00Fh, 022h, 0C0h            ; mov     cr0, eax
+    db      066h, 0FFh, 02Eh            ; jmp     fword ptr [ApFarJump]
+    dw      ApFarJump - ApTrampolineStart
+
+ApProtectedMode:
+    mov     ax, 08h
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     gs, ax
+    mov     ss, ax
+
+    mov     eax, [ebx + (ApCr4 - ApTrampolineStart)]
+    mov     cr4, eax
+    mov     eax, [ebx + (ApCr3 - ApTrampolineStart)]
+    mov     cr3, eax
+    mov     eax, [ebx + (ApCr0 - ApTrampolineStart)]
+    mov     cr0, eax                    ; paging on; the copy is identity mapped, so this continues
+
+    mov     esp, [ebx + (ApStack - ApTrampolineStart)]
+    mov     eax, [ebx + (ApEntry - ApTrampolineStart)]
+    call    eax                         ; never returns
+
+; the parameters. Must match ApTrampolineParameters in smp.cpp.
+align 8
+ApTrampolineParameters:
+ApGdt:
+    dq      0000000000000000h           ; null
+    dq      00CF92000000FFFFh           ; 08h: flat data
+    dq      00CF9A000000FFFFh           ; 10h: flat code
+ApGdtDescriptor:
+    dw      ApGdtDescriptor - ApGdt - 1
+    dd      0                           ; linear address of ApGdt in the copy
+ApFarJump:
+    dd      0                           ; linear address of ApProtectedMode in the copy
+    dw      10h
+ApCr0:
+    dd      0
+ApCr3:
+    dd      0
+ApCr4:
+    dd      0
+ApStack:
+    dd      0
+ApEntry:
+    dd      0
+ApTrampolineEnd:
+
+
+end
@@ -0,0 +1,224 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of application processor startup.
+//!
+//! \details
+//! Processors are started one at a time, so the trampoline page and the handoff globals can be
+//! shared: the next processor isn't started until the last one has reported that it's online
+//! (or been given up on).
+//-------------------------------------------------------------------------------------------------
+#include "smp.h"
+#include "apic.h"
+#include "idt.h"
+#include "pit.h"
+#include "cpu.h"
+#include "physmem.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+#pragma pack(push, 1)
+//! \brief  The trampoline's parameters. Must match the layout at ApTrampolineParameters in
+//!         smp.asm.
+typedef struct tag_TrampolineParameters
+{
+    uint64_t gdt[3];
+    uint16_t gdtLimit;
+    uint32_t gdtBase;
+    uint32_t protectedModeOffset;
+    uint16_t protectedModeSelector;
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+} TrampolineParameters;
+#pragma pack(pop)
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,
+
+    TrampolineLimit = 0x100000,         //!< A startup IPI can only start a processor below 1 MiB.
+    TrampolineHint = 0x1000,            //!< Where to start looking for the trampoline page.
+
+    InitDelayUs = 10000,                //!< How long to wait after the INIT IPI.
+    StartupDelayUs = 200,               //!< How long to wait after each startup IPI.
+    OnlineTimeoutUs = 100000,           //!< How long to wait for a processor to come online.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static volatile uint32_t g_startingIndex;   //!< The index of the processor being started.
+static SmpEntry g_entry;
+static void* g_entryContext;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+// defined in smp.asm
+extern const uint8_t ApTrampolineStart[];
+extern const uint8_t ApProtectedMode[];
+extern const uint8_t ApTrampolineParameters[];
+extern const uint8_t ApTrampolineEnd[];
+
+// called from the trampoline
+void SmpApEntry(void);
+
+static bool StartProcessor(uint32_t index, _Inout_ uint8_t* trampoline);
+static void DelayUs(uint32_t microseconds);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+uint32_t smpStartProcessors(SmpEntry entry, void* context)
+{
+    const uint32_t cpuCount = (apicCpuCount() < CPU_MaxCount) ? apicCpuCount() : CPU_MaxCount;
+    if (cpuCount <= 1)
+    {
+        return cpuOnlineCount();
+    }
+
+    // physical memory is identity mapped, so the page is at the same address before and after the
+    // processor turns paging on.
+    uint8_t* trampoline = (uint8_t*)pmAllocatePages(1, (void*)TrampolineHint);
+    if (trampoline == nullptr)
+    {
+        return cpuOnlineCount();
+    }
+
+    if ((uintptr_t)trampoline >= TrampolineLimit)
+    {
+        pmFree(trampoline, 1);
+        return cpuOnlineCount();
+    }
+
+    g_entry = entry;
+    g_entryContext = context;
+
+    for (uint32_t index = 1; index < cpuCount; index++)
+    {
+        // a processor which didn't come up in time may still do so later, and run the trampoline
+        // with whatever stack and g_startingIndex it holds then. So nothing else is started, and
+        // the page is never freed.
+        if (!StartProcessor(index, trampoline))
+        {
+            return cpuOnlineCount();
+        }
+    }
+
+    pmFree(trampoline, 1);
+    return cpuOnlineCount();
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+bool StartProcessor(uint32_t index, uint8_t* trampoline)
+{
+    //FUTURE: guard pages under the stacks, once they come from vmalloc.
+    uint8_t* stack = (uint8_t*)pmAllocatePages(SMP_StackPages, nullptr);
+    if (stack == nullptr)
+    {
+        return false;
+    }
+
+    const uintptr_t base = (uintptr_t)trampoline;
+    const size_t size = (size_t)(ApTrampolineEnd - ApTrampolineStart);
+    memcpy(trampoline, ApTrampolineStart, size);
+
+    TrampolineParameters* parameters = (TrampolineParameters*)(
+        trampoline + (ApTrampolineParameters - ApTrampolineStart)
+    );
+
+    parameters->gdtBase = (uint32_t)(base + (ApTrampolineParameters - ApTrampolineStart));
+    parameters->protectedModeOffset = (uint32_t)(base + (ApProtectedMode - ApTrampolineStart));
+    parameters->cr0 = (uint32_t)__readcr0();
+    parameters->cr3 = (uint32_t)__readcr3();
+    parameters->cr4 = (uint32_t)__readcr4();
+    parameters->stack = (uint32_t)(uintptr_t)(stack + SMP_StackPages * PageSize);
+    parameters->entry = (uint32_t)(uintptr_t)SmpApEntry;
+
+    CpuData* data = cpuGetData(index);
+    data->apicId = apicCpuApicId(index);
+    g_startingIndex = index;
+
+    // the processor may start on the first startup IPI; the second is for the ones that don't.
+    lapicSendInit(data->apicId);
+    DelayUs(InitDelayUs);
+
+    for (uint32_t attempt = 0; attempt < 2 && !data->online; attempt++)
+    {
+        lapicSendStartup(data->apicId, (uint32_t)(base / PageSize));
+        DelayUs(StartupDelayUs);
+    }
+
+    for (uint32_t waited = 0; waited < OnlineTimeoutUs && !data->online; waited += 1000)
+    {
+        DelayUs(1000);
+    }
+
+    if (!data->online)
+    {
+        // it may still come up later and use the stack, so it's leaked rather than freed.
+        return false;
+    }
+
+    return true;
+}
+
+void DelayUs(uint32_t microseconds)
+{
+    while (microseconds > 0)
+    {
+        const uint32_t chunk = (microseconds < PIT_MaxCountdownUs)
+            ? microseconds
+            : PIT_MaxCountdownUs;
+
+        pitStartCountdown(chunk);
+        while (!pitCountdownExpired())
+        {
+            _mm_pause();
+        }
+
+        microseconds -= chunk;
+    }
+}
+
+void SmpApEntry()
+{
+    // running on the new stack with paging on, but still on the trampoline's GDT.
+    cpuInitialize(g_startingIndex);
+    idtInitializeProcessor();
+    lapicInitializeProcessor();
+
+    cpuCurrentData()->online = true;
+    _enable();
+
+    if (g_entry != nullptr)
+    {
+        g_entry(g_entryContext);
+    }
+
+    for (;;)
+    {
+        __halt();
+    }
+}
+
+NOS_END_EXTERN_C
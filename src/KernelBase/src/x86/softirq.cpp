@@ -0,0 +1,306 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of deferred interrupt work.
+//-------------------------------------------------------------------------------------------------
+#include "softirq.h"
+#include "ktime.h"
+#include "idt.h"
+#include "thread.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef struct tag_SoftirqEntry
+{
+    SoftirqHandler handler;
+    void* context;
+} SoftirqEntry;
+
+//! \brief  A processor's softirq state. Only ever touched by its own processor.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_SoftirqCpuState
+{
+    uint32_t pending;                           //!< Bit set for every pending source.
+    bool draining;                              //!< Set while handlers are running.
+    uint64_t raisedAt[SOFTIRQ_SourceCount];     //!< When each pending source was raised.
+    SoftirqStats stats[SOFTIRQ_SourceCount];
+} SoftirqCpuState;
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static SoftirqEntry g_softirqs[SOFTIRQ_SourceCount];
+static SoftirqCpuState g_softirqCpuState[CPU_MaxCount];
+static SoftirqDeferHook g_deferHook;
+static Thread* g_workers[CPU_MaxCount];        //!< Each processor's worker, if it has threads.
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline SoftirqCpuState* CurrentState()
+{
+    return &g_softirqCpuState[cpuCurrentIndex()];
+}
+
+static void RunPending(_Inout_ SoftirqCpuState* state, uint64_t budgetCycles, uint32_t maxPasses);
+static void WorkerMain(_In_opt_ void* context);
+static void WakeWorker(void);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void softirqRegister(uint32_t source, SoftirqHandler handler, void* context)
+{
+    const bool enabled = idtDisableInterrupts();
+
+    g_softirqs[source].handler = handler;
+    g_softirqs[source].context = context;
+
+    idtRestoreInterrupts(enabled);
+}
+
+void softirqRaise(uint32_t source)
+{
+    const bool enabled = idtDisableInterrupts();
+    SoftirqCpuState* state = CurrentState();
+    const uint32_t bit = (1u << source);
+
+    if ((state->pending & bit) == 0)
+    {
+        state->pending |= bit;
+        state->raisedAt[source] = __rdtsc();
+        state->stats[source].raiseCount++;
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+void softirqDrain()
+{
+    SoftirqCpuState* state = CurrentState();
+
+    if (state->pending == 0)
+    {
+        return;
+    }
+
+    // an interrupt arriving while the handlers run (here, or in a thread draining with
+    // softirqRunPending) leaves the draining to whoever is already at it. That one picks up the new
+    // work, but may be out of budget, so the hook is told about it too.
+    if (state->draining)
+    {
+        if (g_deferHook != nullptr)
+        {
+            g_deferHook();
+        }
+
+        return;
+    }
+
+    // until the clock is calibrated, only the number of passes limits the drain.
+    uint64_t budgetCycles = ktimeNsToCycles((uint64_t)SOFTIRQ_BudgetUs * 1000);
+    if (budgetCycles == 0)
+    {
+        budgetCycles = UINT64_MAX;
+    }
+
+    RunPending(state, budgetCycles, SOFTIRQ_MaxRestarts);
+
+    if (state->pending != 0
+        && g_deferHook != nullptr)
+    {
+        g_deferHook();
+    }
+}
+
+void softirqRunPending()
+{
+    const bool enabled = idtDisableInterrupts();
+    SoftirqCpuState* state = CurrentState();
+
+    if (!state->draining)
+    {
+        RunPending(state, UINT64_MAX, UINT32_MAX);
+    }
+
+    idtRestoreInterrupts(enabled);
+
+    // a switch asked for while the handlers ran was held off until now.
+    if (enabled
+        && !idtInInterrupt())
+    {
+        threadPreemptIfNeeded();
+    }
+}
+
+bool softirqIsPending()
+{
+    return (CurrentState()->pending != 0);
+}
+
+_Use_decl_annotations_
+void softirqSetDeferHook(SoftirqDeferHook hook)
+{
+    g_deferHook = hook;
+}
+
+bool softirqStartWorker()
+{
+    // threads stay on the processor that created them, so this one is the caller's.
+    Thread* worker = threadCreate(WorkerMain, nullptr);
+    if (worker == nullptr)
+    {
+        return false;
+    }
+
+    // the work was already due when it was deferred, so it shouldn't wait behind other threads.
+    threadSetPriority(worker, THREAD_PriorityCount - 1);
+    g_workers[cpuCurrentIndex()] = worker;
+
+    softirqSetDeferHook(WakeWorker);
+    return true;
+}
+
+_Use_decl_annotations_
+void softirqGetStats(uint32_t source, SoftirqStats* stats)
+{
+    const bool enabled = idtDisableInterrupts();
+
+    stats->raiseCount = 0;
+    stats->runCount = 0;
+    stats->latencyCycles = 0;
+    stats->maxLatencyCycles = 0;
+    stats->runCycles = 0;
+    stats->maxRunCycles = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const SoftirqStats* cpuStats = &g_softirqCpuState[cpu].stats[source];
+
+        stats->raiseCount += cpuStats->raiseCount;
+        stats->runCount += cpuStats->runCount;
+        stats->latencyCycles += cpuStats->latencyCycles;
+        stats->runCycles += cpuStats->runCycles;
+
+        if (cpuStats->maxLatencyCycles > stats->maxLatencyCycles)
+        {
+            stats->maxLatencyCycles = cpuStats->maxLatencyCycles;
+        }
+
+        if (cpuStats->maxRunCycles > stats->maxRunCycles)
+        {
+            stats->maxRunCycles = cpuStats->maxRunCycles;
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void RunPending(SoftirqCpuState* state, uint64_t budgetCycles, uint32_t maxPasses)
+{
+    // called with interrupts disabled. They're enabled while the handlers run, and the pending
+    // bitmap is only touched with them disabled. The thread draining can't be switched away
+    // until it's done, or the processor's softirqs would be stuck behind it.
+    const uint64_t start = __rdtsc();
+    uint32_t passes = 0;
+
+    cpuDisablePreemption();
+    state->draining = true;
+
+    while (state->pending != 0
+        && passes < maxPasses
+        && __rdtsc() - start < budgetCycles)
+    {
+        uint32_t pending = state->pending;
+        state->pending = 0;
+        passes++;
+
+        unsigned long source;
+        while (_BitScanForward(&source, pending))
+        {
+            pending &= pending - 1;
+
+            const uint64_t raisedAt = state->raisedAt[source];
+            const SoftirqEntry entry = g_softirqs[source];
+
+            _enable();
+
+            const uint64_t runStart = __rdtsc();
+            if (entry.handler != nullptr)
+            {
+                entry.handler(entry.context);
+            }
+            const uint64_t runEnd = __rdtsc();
+
+            _disable();
+
+            SoftirqStats* stats = &state->stats[source];
+            const uint64_t latency = runStart - raisedAt;
+            const uint64_t duration = runEnd - runStart;
+
+            stats->runCount++;
+            stats->latencyCycles += latency;
+            stats->runCycles += duration;
+
+            if (latency > stats->maxLatencyCycles)
+            {
+                stats->maxLatencyCycles = latency;
+            }
+
+            if (duration > stats->maxRunCycles)
+            {
+                stats->maxRunCycles = duration;
+            }
+        }
+    }
+
+    state->draining = false;
+    cpuEnablePreemption();
+}
+
+void WorkerMain(void* context)
+{
+    (void)context;
+
+    for (;;)
+    {
+        softirqRunPending();
+
+        // anything raised after the check is drained on interrupt exit, and whatever that leaves
+        // pending wakes the worker again through the hook.
+        const bool enabled = idtDisableInterrupts();
+        if (!softirqIsPending())
+        {
+            threadBlock();
+        }
+
+        idtRestoreInterrupts(enabled);
+    }
+}
+
+void WakeWorker()
+{
+    // processors without a worker of their own pick the work up from taskRunWorker's loop.
+    Thread* worker = g_workers[cpuCurrentIndex()];
+
+    if (worker != nullptr)
+    {
+        threadWake(worker);
+    }
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,158 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the lock profiling statistics.
+//!
+//! \details
+//! Sites put themselves on a list the first time they're used. The counts and spin times are
+//! updated with locked instructions, since one site may take many different locks (per processor
+//! ones, say) at once. The longest hold is only updated under the lock itself, so it may miss the
+//! odd maximum when that happens - good enough for spotting the locks worth looking at.
+//-------------------------------------------------------------------------------------------------
+#include "spinlock.h"
+#include "ktime.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static LockSite* volatile g_lockSites;  //!< Every site used so far, newest first.
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static void RegisterSite(_Inout_ LockSite* site);
+static const char* FileName(_In_z_ const char* path);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void lockProfileAcquired(LockSite* site, uint64_t spinCycles, bool contended)
+{
+    if (site->registered == 0)
+    {
+        RegisterSite(site);
+    }
+
+    _InterlockedIncrement(&site->acquireCount);
+
+    if (contended)
+    {
+        _InterlockedIncrement(&site->contendedCount);
+        // _InterlockedAddLargeStatistic only adds 32 bits, and a long wait is more than that.
+        __int64 total = site->spinCycles;
+        __int64 seen;
+
+        while ((seen = _InterlockedCompareExchange64(
+                    &site->spinCycles,
+                    total + (__int64)spinCycles,
+                    total)) != total)
+        {
+            total = seen;
+        }
+    }
+}
+
+_Use_decl_annotations_
+void lockProfileReleased(LockSite* site, uint64_t holdCycles)
+{
+    if (holdCycles > site->maxHoldCycles)
+    {
+        site->maxHoldCycles = holdCycles;
+    }
+}
+
+_Use_decl_annotations_
+void lockProfilePrint(const kprintf_stream* stream)
+{
+    if (!NOS_LOCK_PROFILING)
+    {
+        kprintf(stream, "lock profiling is disabled (NOS_LOCK_PROFILING)\n");
+        return;
+    }
+
+    // times are in ns; the lines are kept short enough for the 80 column console.
+    kprintf(
+        stream,
+        "   %-26s %9s %9s %9s %9s\n",
+        "lock site",
+        "acquires",
+        "contended",
+        "avg spin",
+        "max hold"
+    );
+
+    for (const LockSite* site = g_lockSites; site != nullptr; site = site->next)
+    {
+        const uint64_t averageSpin = (site->contendedCount != 0)
+            ? ktimeCyclesToNs((uint64_t)site->spinCycles) / (uint64_t)site->contendedCount
+            : 0;
+
+        kprintf(
+            stream,
+            "   %-20s %5u %9u %9u %9llu %9llu\n",
+            FileName(site->file),
+            site->line,
+            (uint32_t)site->acquireCount,
+            (uint32_t)site->contendedCount,
+            averageSpin,
+            ktimeCyclesToNs(site->maxHoldCycles)
+        );
+    }
+}
+
+void lockProfileReset()
+{
+    for (LockSite* site = g_lockSites; site != nullptr; site = site->next)
+    {
+        site->acquireCount = 0;
+        site->contendedCount = 0;
+        site->spinCycles = 0;
+        site->maxHoldCycles = 0;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void RegisterSite(LockSite* site)
+{
+    // the first processor to mark the site adds it; sites are never removed, so a plain push
+    // is all the list needs.
+    if (_InterlockedExchange(&site->registered, 1) != 0)
+    {
+        return;
+    }
+
+    LockSite* head;
+    do
+    {
+        head = g_lockSites;
+        site->next = head;
+    } while (_InterlockedCompareExchangePointer((void* volatile*)&g_lockSites, site, head) != head);
+}
+
+const char* FileName(const char* path)
+{
+    // __FILE__ is a full path, which doesn't fit in the report.
+    const char* name = path;
+
+    for (const char* c = path; *c != '\0'; c++)
+    {
+        if (*c == '\\' || *c == '/')
+        {
+            name = c + 1;
+        }
+    }
+
+    return name;
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,518 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the blocking synchronization primitives.
+//!
+//! \details
+//! A waiter queues itself with the queue's spinlock held and interrupts disabled, and keeps
+//! interrupts disabled until it has blocked - so nothing on its own processor can wake it in
+//! between and be missed. Wakers pass whatever is being waited for (ownership, a count) along with
+//! the wakeup, so a woken thread never has to go back and compete for it. A wakeup from another
+//! processor is routed to the waiter's own processor by threadWake.
+//!
+//! A processor without threads (one that only runs task workers) can't block, so a wait there
+//! spins until it's woken, with interrupts as the caller had them.
+//-------------------------------------------------------------------------------------------------
+#include "sync.h"
+#include "thread.h"
+#include "idt.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_SyncCpuState
+{
+    SyncStats stats;            //!< Only touched by the processor itself, with interrupts disabled.
+} SyncCpuState;
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static SyncCpuState g_syncCpuState[CPU_MaxCount];
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline SyncCpuState* CurrentState()
+{
+    return &g_syncCpuState[cpuCurrentIndex()];
+}
+
+static inline bool WorthSpinning()
+{
+    // whatever is being waited for can only arrive from another processor while this one spins.
+    return cpuOnlineCount() > 1;
+}
+
+static void SetupEntry(_Out_ WaitEntry* entry);
+static void Append(_Inout_ WaitQueue* queue, _Inout_ WaitEntry* entry);
+static WaitEntry* PopFirst(_Inout_ WaitQueue* queue);
+static void Block(_Inout_ WaitEntry* entry, bool enabled);
+static void Wake(_Inout_ WaitEntry* entry);
+static void SwitchIfWoken(bool enabled);
+static void CountSpin(void);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+_Use_decl_annotations_
+bool waitQueueWaitIf(WaitQueue* queue, const volatile long* address, long expected)
+{
+    WaitEntry entry;
+    SetupEntry(&entry);
+
+    const bool enabled = ticketLockAcquireIrqSave(&queue->lock);
+
+    if (*address != expected)
+    {
+        ticketLockReleaseIrqRestore(&queue->lock, enabled);
+        return false;
+    }
+
+    Append(queue, &entry);
+    ticketLockRelease(&queue->lock);
+
+    Block(&entry, enabled);
+    idtRestoreInterrupts(enabled);
+    return true;
+}
+
+_Use_decl_annotations_
+uint32_t waitQueueWake(WaitQueue* queue, uint32_t count)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&queue->lock);
+
+    uint32_t woken = 0;
+    WaitEntry* entry;
+
+    while (woken < count
+        && (entry = PopFirst(queue)) != nullptr)
+    {
+        Wake(entry);
+        woken++;
+    }
+
+    ticketLockReleaseIrqRestore(&queue->lock, enabled);
+    SwitchIfWoken(enabled);
+    return woken;
+}
+
+_Use_decl_annotations_
+void mutexSetup(Mutex* mutex)
+{
+    memset(mutex, 0, sizeof(*mutex));
+}
+
+_Use_decl_annotations_
+void mutexAcquire(Mutex* mutex)
+{
+    if (mutexTryAcquire(mutex))
+    {
+        return;
+    }
+
+    // spin while the owner is running elsewhere, since it may be about to release the mutex. Once
+    // it isn't, it won't be releasing it any time soon.
+    if (WorthSpinning())
+    {
+        for (uint32_t spin = 0; spin < SYNC_SpinCount; spin++)
+        {
+            if (mutex->state.load(memory_order::relaxed) == 0
+                && mutexTryAcquire(mutex))
+            {
+                CountSpin();
+                return;
+            }
+
+            Thread* owner = mutex->owner;
+            if (owner != nullptr
+                && !threadIsRunning(owner))
+            {
+                break;
+            }
+
+            cpu_relax();
+        }
+    }
+
+    WaitEntry entry;
+    SetupEntry(&entry);
+
+    const bool enabled = ticketLockAcquireIrqSave(&mutex->waiters.lock);
+
+    // with the queue locked, the owner can't release the mutex without seeing the waiter bit.
+    if (mutex->state.exchange(2) == 0)
+    {
+        mutex->owner = entry.thread;
+        ticketLockReleaseIrqRestore(&mutex->waiters.lock, enabled);
+        return;
+    }
+
+    Append(&mutex->waiters, &entry);
+    ticketLockRelease(&mutex->waiters.lock);
+
+    // the releasing thread made this one the owner before waking it.
+    Block(&entry, enabled);
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+bool mutexTryAcquire(Mutex* mutex)
+{
+    long expected = 0;
+    if (!mutex->state.compare_exchange(expected, 1))
+    {
+        return false;
+    }
+
+    mutex->owner = threadCurrent();
+    return true;
+}
+
+_Use_decl_annotations_
+void mutexRelease(Mutex* mutex)
+{
+    //TODO: kassert(mutex->owner == threadCurrent());
+    mutex->owner = nullptr;
+
+    long expected = 1;
+    if (mutex->state.compare_exchange(expected, 0))
+    {
+        return;
+    }
+
+    const bool enabled = ticketLockAcquireIrqSave(&mutex->waiters.lock);
+    WaitEntry* next = PopFirst(&mutex->waiters);
+
+    if (next != nullptr)
+    {
+        // the mutex never becomes free, it just changes hands.
+        mutex->owner = next->thread;
+        mutex->state.store((mutex->waiters.head != nullptr) ? 2 : 1, memory_order::release);
+        CurrentState()->stats.handoffCount++;
+        Wake(next);
+    }
+    else
+    {
+        mutex->state.store(0, memory_order::release);
+    }
+
+    ticketLockReleaseIrqRestore(&mutex->waiters.lock, enabled);
+    SwitchIfWoken(enabled);
+}
+
+_Use_decl_annotations_
+void semaphoreSetup(Semaphore* semaphore, uint32_t count)
+{
+    memset(semaphore, 0, sizeof(*semaphore));
+    semaphore->count.store((long)count, memory_order::relaxed);
+}
+
+_Use_decl_annotations_
+void semaphoreWait(Semaphore* semaphore)
+{
+    const uint32_t spins = WorthSpinning() ? SYNC_SpinCount : 1;
+
+    for (uint32_t spin = 0; spin < spins; spin++)
+    {
+        long count = semaphore->count.load(memory_order::relaxed);
+
+        if (count > 0
+            && semaphore->count.compare_exchange(count, count - 1))
+        {
+            if (spin > 0)
+            {
+                CountSpin();
+            }
+
+            return;
+        }
+
+        cpu_relax();
+    }
+
+    WaitEntry entry;
+    SetupEntry(&entry);
+
+    // the count only goes up with the queue locked, so if it's 0 here, the next signal will find
+    // this thread in the queue.
+    const bool enabled = ticketLockAcquireIrqSave(&semaphore->waiters.lock);
+
+    long count = semaphore->count.load(memory_order::relaxed);
+    while (count > 0)
+    {
+        if (semaphore->count.compare_exchange(count, count - 1))
+        {
+            ticketLockReleaseIrqRestore(&semaphore->waiters.lock, enabled);
+            return;
+        }
+    }
+
+    Append(&semaphore->waiters, &entry);
+    ticketLockRelease(&semaphore->waiters.lock);
+
+    Block(&entry, enabled);
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+void semaphoreSignal(Semaphore* semaphore)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&semaphore->waiters.lock);
+    WaitEntry* next = PopFirst(&semaphore->waiters);
+
+    if (next != nullptr)
+    {
+        CurrentState()->stats.handoffCount++;
+        Wake(next);
+    }
+    else
+    {
+        semaphore->count.fetch_add(1);
+    }
+
+    ticketLockReleaseIrqRestore(&semaphore->waiters.lock, enabled);
+    SwitchIfWoken(enabled);
+}
+
+_Use_decl_annotations_
+void condSetup(CondVar* cond)
+{
+    memset(cond, 0, sizeof(*cond));
+}
+
+_Use_decl_annotations_
+void condWait(CondVar* cond, Mutex* mutex)
+{
+    WaitEntry entry;
+    SetupEntry(&entry);
+
+    const bool enabled = ticketLockAcquireIrqSave(&cond->waiters.lock);
+    Append(&cond->waiters, &entry);
+    ticketLockRelease(&cond->waiters.lock);
+
+    // already queued, so a signal sent as soon as the mutex is free will find this thread.
+    mutexRelease(mutex);
+    Block(&entry, enabled);
+    idtRestoreInterrupts(enabled);
+
+    mutexAcquire(mutex);
+}
+
+_Use_decl_annotations_
+void condSignal(CondVar* cond)
+{
+    waitQueueWake(&cond->waiters, 1);
+}
+
+_Use_decl_annotations_
+void condBroadcast(CondVar* cond)
+{
+    waitQueueWake(&cond->waiters, UINT32_MAX);
+}
+
+_Use_decl_annotations_
+void eventSetup(Event* event, bool set)
+{
+    memset(event, 0, sizeof(*event));
+    event->set.store(set ? 1 : 0, memory_order::relaxed);
+}
+
+_Use_decl_annotations_
+void eventWait(Event* event)
+{
+    const uint32_t spins = WorthSpinning() ? SYNC_SpinCount : 1;
+
+    for (uint32_t spin = 0; spin < spins; spin++)
+    {
+        if (event->set.load(memory_order::acquire) != 0)
+        {
+            if (spin > 0)
+            {
+                CountSpin();
+            }
+
+            return;
+        }
+
+        cpu_relax();
+    }
+
+    WaitEntry entry;
+    SetupEntry(&entry);
+
+    const bool enabled = ticketLockAcquireIrqSave(&event->waiters.lock);
+
+    if (event->set.load(memory_order::acquire) != 0)
+    {
+        ticketLockReleaseIrqRestore(&event->waiters.lock, enabled);
+        return;
+    }
+
+    Append(&event->waiters, &entry);
+    ticketLockRelease(&event->waiters.lock);
+
+    Block(&entry, enabled);
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+void eventSet(Event* event)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&event->waiters.lock);
+
+    event->set.store(1, memory_order::release);
+
+    WaitEntry* entry;
+    while ((entry = PopFirst(&event->waiters)) != nullptr)
+    {
+        Wake(entry);
+    }
+
+    ticketLockReleaseIrqRestore(&event->waiters.lock, enabled);
+    SwitchIfWoken(enabled);
+}
+
+_Use_decl_annotations_
+void eventReset(Event* event)
+{
+    event->set.store(0, memory_order::release);
+}
+
+_Use_decl_annotations_
+void syncGetStats(SyncStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const SyncStats* cpuStats = &g_syncCpuState[cpu].stats;
+
+        stats->spinCount += cpuStats->spinCount;
+        stats->blockCount += cpuStats->blockCount;
+        stats->handoffCount += cpuStats->handoffCount;
+        stats->wakeCycles += cpuStats->wakeCycles;
+        if (cpuStats->maxWakeCycles > stats->maxWakeCycles)
+        {
+            stats->maxWakeCycles = cpuStats->maxWakeCycles;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+void SetupEntry(WaitEntry* entry)
+{
+    entry->next = nullptr;
+    entry->thread = threadCurrent();
+    entry->woken.store(false, memory_order::relaxed);
+    entry->wakeTsc = 0;
+}
+
+void Append(WaitQueue* queue, WaitEntry* entry)
+{
+    if (queue->tail != nullptr)
+    {
+        queue->tail->next = entry;
+    }
+    else
+    {
+        queue->head = entry;
+    }
+
+    queue->tail = entry;
+}
+
+WaitEntry* PopFirst(WaitQueue* queue)
+{
+    WaitEntry* entry = queue->head;
+
+    if (entry != nullptr)
+    {
+        queue->head = entry->next;
+        if (queue->head == nullptr)
+        {
+            queue->tail = nullptr;
+        }
+    }
+
+    return entry;
+}
+
+void Block(WaitEntry* entry, bool enabled)
+{
+    if (entry->thread == nullptr)
+    {
+        // the wakeup can come from another processor, or from an interrupt on this one.
+        idtRestoreInterrupts(enabled);
+
+        while (!entry->woken.load(memory_order::acquire))
+        {
+            cpu_relax();
+        }
+
+        _disable();
+    }
+
+    // interrupts are disabled, so a wakeup from this processor can only come once the thread has
+    // blocked; the loop covers one from another processor that came first.
+    while (!entry->woken.load(memory_order::acquire))
+    {
+        threadBlock();
+    }
+
+    const uint64_t latency = __rdtsc() - entry->wakeTsc;
+    SyncStats* stats = &CurrentState()->stats;
+
+    stats->blockCount++;
+    stats->wakeCycles += latency;
+    if (latency > stats->maxWakeCycles)
+    {
+        stats->maxWakeCycles = latency;
+    }
+}
+
+void Wake(WaitEntry* entry)
+{
+    // the entry is on the waiter's stack, which may be gone as soon as woken is set.
+    Thread* thread = entry->thread;
+
+    entry->wakeTsc = __rdtsc();
+    entry->woken.store(true, memory_order::release);
+
+    if (thread != nullptr)
+    {
+        threadWake(thread);
+    }
+}
+
+void SwitchIfWoken(bool enabled)
+{
+    // threadWake couldn't switch to a higher priority thread with the queue locked, so give it
+    // the chance now.
+    if (enabled
+        && !idtInInterrupt())
+    {
+        threadPreemptIfNeeded();
+    }
+}
+
+void CountSpin()
+{
+    const bool enabled = idtDisableInterrupts();
+    CurrentState()->stats.spinCount++;
+    idtRestoreInterrupts(enabled);
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,442 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the work-stealing task scheduler.
+//!
+//! \details
+//! The deques follow Chase and Lev's "Dynamic Circular Work-Stealing Deque" (with a fixed size),
+//! with the memory orderings from Le et al's "Correct and Efficient Work-Stealing for Weak Memory
+//! Models". On x86 only one of them costs anything: the owner taking the last task while a thief
+//! steals it is a store followed by a load, which needs the seq_cst store's fence.
+//!
+//! The owner's end of a deque is also used by every thread on its processor, so it's only touched
+//! with interrupts disabled; that keeps a preempted push from being interleaved with another.
+//!
+//! Workers with nothing to steal spin for a while, then idle. A processor which spawns a task
+//! wakes one of them with idleWake - a write to the line it's monitoring, or an IPI if it halted.
+//-------------------------------------------------------------------------------------------------
+#include "task.h"
+#include "katomic.h"
+#include "idt.h"
+#include "idle.h"
+#include "softirq.h"
+#include "apic.h"
+#include "cpu.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+//! \brief  A processor's deque. top is shared with thieves, so it gets a cache line of its own.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_TaskCpuState
+{
+    katomic<long> top;                          //!< The next task to steal.
+    alignas(NOS_CACHE_LINE_SIZE) katomic<long> bottom;  //!< Where the next task is pushed.
+    uint32_t seed;                              //!< For picking victims to steal from.
+    TaskStats stats;
+    katomic<Task*> tasks[TASK_DequeSize];
+} TaskCpuState;
+
+typedef struct tag_ForShared
+{
+    ParallelForBody body;
+    void* context;
+    uint32_t grain;
+} ForShared;
+
+typedef struct tag_ForRange
+{
+    Task task;
+    const ForShared* shared;
+    uint32_t begin;
+    uint32_t end;
+} ForRange;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    DequeMask = TASK_DequeSize - 1,
+    IdleSpinLimit = 10000,          //!< Failed attempts to find work before a worker idles.
+    MaxSplits = 32,                 //!< Halving a 32-bit range can't take more steps than this.
+};
+
+static_assert((TASK_DequeSize & (TASK_DequeSize - 1)) == 0, "TASK_DequeSize must be a power of 2");
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static TaskCpuState g_taskCpuState[CPU_MaxCount];
+static katomic<long> g_sleepingMask;    //!< Bit n is set while processor n idles for lack of work.
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+static inline TaskCpuState* CurrentState()
+{
+    return &g_taskCpuState[cpuCurrentIndex()];
+}
+
+static bool Push(_Inout_ TaskCpuState* cpu, _In_ Task* task);
+static Task* Pop(_Inout_ TaskCpuState* cpu);
+static Task* Steal(_Inout_ TaskCpuState* victim);
+static Task* FindWork(_Inout_ TaskCpuState* cpu);
+static void Run(_Inout_ Task* task);
+static void WakeIdleWorker(_Inout_ TaskCpuState* cpu);
+static void RunRange(_In_opt_ void* context);
+static void WakeHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+void taskInitialize()
+{
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        g_taskCpuState[cpu].seed = 2463534242u + cpu;
+    }
+
+    idtRegisterHandler(IDT_TaskWakeVector, WakeHandler, nullptr);
+}
+
+_Use_decl_annotations_
+void taskRunWorker(void* context)
+{
+    (void)context;
+
+    TaskCpuState* cpu = CurrentState();
+    const long bit = (long)(1u << cpuCurrentIndex());
+    uint32_t idleSpins = 0;
+
+    for (;;)
+    {
+        // there are no threads here, so this loop is the processor's softirq worker: whatever an
+        // interrupt's drain left pending is run before any more tasks.
+        if (softirqIsPending())
+        {
+            softirqRunPending();
+        }
+
+        Task* task = FindWork(cpu);
+        if (task != nullptr)
+        {
+            Run(task);
+            idleSpins = 0;
+            continue;
+        }
+
+        if (++idleSpins < IdleSpinLimit)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        // announce the wait before looking one last time, so a task spawned in between is either
+        // found here or followed by a wakeup.
+        _disable();
+        g_sleepingMask.fetch_or(bit);
+
+        task = FindWork(cpu);
+        if (task == nullptr
+            && !softirqIsPending())
+        {
+            // a wakeup sent since the announcement ends the wait straight away.
+            idleWait();
+            _disable();
+        }
+
+        g_sleepingMask.fetch_and(~bit);
+        _enable();
+        idleSpins = 0;
+
+        if (task != nullptr)
+        {
+            Run(task);
+        }
+    }
+}
+
+_Use_decl_annotations_
+void taskSpawn(TaskGroup* group, Task* task)
+{
+    task->group = group;
+    _InterlockedIncrement(&group->pending);
+
+    const bool enabled = idtDisableInterrupts();
+    TaskCpuState* cpu = CurrentState();
+    const bool pushed = Push(cpu, task);
+
+    if (pushed)
+    {
+        cpu->stats.spawnCount++;
+        WakeIdleWorker(cpu);
+    }
+    else
+    {
+        cpu->stats.inlineCount++;
+    }
+
+    idtRestoreInterrupts(enabled);
+
+    // with nowhere to put it, the task runs now - which is what waiting for it would do anyway.
+    if (!pushed)
+    {
+        Run(task);
+    }
+}
+
+_Use_decl_annotations_
+void taskWait(TaskGroup* group)
+{
+    while (group->pending != 0)
+    {
+        Task* task = FindWork(CurrentState());
+
+        if (task != nullptr)
+        {
+            Run(task);
+        }
+        else
+        {
+            cpu_relax();
+        }
+    }
+}
+
+_Use_decl_annotations_
+void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, ParallelForBody body, void* context)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    ForShared shared;
+    shared.body = body;
+    shared.context = context;
+    shared.grain = (grain > 0) ? grain : 1;
+
+    ForRange range;
+    range.shared = &shared;
+    range.begin = begin;
+    range.end = end;
+
+    RunRange(&range);
+}
+
+_Use_decl_annotations_
+void taskGetStats(TaskStats* stats)
+{
+    stats->spawnCount = 0;
+    stats->inlineCount = 0;
+    stats->stealCount = 0;
+    stats->wakeCount = 0;
+
+    for (uint32_t cpu = 0; cpu < CPU_MaxCount; cpu++)
+    {
+        const TaskStats* cpuStats = &g_taskCpuState[cpu].stats;
+
+        stats->spawnCount += cpuStats->spawnCount;
+        stats->inlineCount += cpuStats->inlineCount;
+        stats->stealCount += cpuStats->stealCount;
+        stats->wakeCount += cpuStats->wakeCount;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+bool Push(TaskCpuState* cpu, Task* task)
+{
+    // top only ever grows, so a stale value can only make the deque look fuller than it is.
+    const long bottom = cpu->bottom.load(memory_order::relaxed);
+    const long top = cpu->top.load(memory_order::acquire);
+
+    if (bottom - top >= TASK_DequeSize)
+    {
+        return false;
+    }
+
+    cpu->tasks[bottom & DequeMask].store(task, memory_order::relaxed);
+
+    // a thief that sees the new bottom sees the task.
+    cpu->bottom.store(bottom + 1, memory_order::release);
+
+    return true;
+}
+
+Task* Pop(TaskCpuState* cpu)
+{
+    // the new bottom has to be visible before top is read, or a thief and the owner could both
+    // take the last task.
+    const long bottom = cpu->bottom.load(memory_order::relaxed) - 1;
+    cpu->bottom.store(bottom, memory_order::seq_cst);
+
+    long top = cpu->top.load(memory_order::seq_cst);
+
+    if (top > bottom)
+    {
+        cpu->bottom.store(bottom + 1, memory_order::relaxed);
+        return nullptr;
+    }
+
+    Task* task = cpu->tasks[bottom & DequeMask].load(memory_order::relaxed);
+
+    if (top == bottom)
+    {
+        // the last task: whoever moves top past it gets it.
+        if (!cpu->top.compare_exchange(top, top + 1))
+        {
+            task = nullptr;
+        }
+
+        cpu->bottom.store(bottom + 1, memory_order::relaxed);
+    }
+
+    return task;
+}
+
+Task* Steal(TaskCpuState* victim)
+{
+    long top = victim->top.load(memory_order::acquire);
+    const long bottom = victim->bottom.load(memory_order::acquire);
+
+    if (top >= bottom)
+    {
+        return nullptr;
+    }
+
+    // the slot is read before top is claimed; if the claim fails, the task belongs to someone else.
+    Task* task = victim->tasks[top & DequeMask].load(memory_order::relaxed);
+
+    if (!victim->top.compare_exchange(top, top + 1))
+    {
+        return nullptr;
+    }
+
+    return task;
+}
+
+Task* FindWork(TaskCpuState* cpu)
+{
+    const bool enabled = idtDisableInterrupts();
+    Task* task = Pop(cpu);
+    idtRestoreInterrupts(enabled);
+
+    if (task != nullptr)
+    {
+        return task;
+    }
+
+    // start at a random victim, so thieves don't all pile onto the same one.
+    cpu->seed ^= cpu->seed << 13;
+    cpu->seed ^= cpu->seed >> 17;
+    cpu->seed ^= cpu->seed << 5;
+
+    const uint32_t start = cpu->seed % CPU_MaxCount;
+
+    for (uint32_t i = 0; i < CPU_MaxCount; i++)
+    {
+        const uint32_t index = (start + i) % CPU_MaxCount;
+        TaskCpuState* victim = &g_taskCpuState[index];
+
+        if (victim == cpu
+            || !cpuGetData(index)->online)
+        {
+            continue;
+        }
+
+        task = Steal(victim);
+        if (task != nullptr)
+        {
+            cpu->stats.stealCount++;
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+void Run(Task* task)
+{
+    // the group may be waited for (and go away) as soon as pending drops, so it's read first.
+    TaskGroup* group = task->group;
+
+    task->function(task->context);
+    _InterlockedDecrement(&group->pending);
+}
+
+void WakeIdleWorker(TaskCpuState* cpu)
+{
+    // a locked read, so the push is visible before the mask is looked at (see taskRunWorker).
+    const long sleeping = g_sleepingMask.fetch_or(0);
+
+    unsigned long index;
+    if (!_BitScanForward(&index, (unsigned long)sleeping))
+    {
+        return;
+    }
+
+    // only the processor that clears the bit sends the IPI.
+    const long bit = (long)(1u << index);
+    if ((g_sleepingMask.fetch_and(~bit) & bit) != 0)
+    {
+        idleWake(index, IDT_TaskWakeVector);
+        cpu->stats.wakeCount++;
+    }
+}
+
+void RunRange(void* context)
+{
+    const ForRange* range = (const ForRange*)context;
+    const ForShared* shared = range->shared;
+    uint32_t begin = range->begin;
+    uint32_t end = range->end;
+
+    TaskGroup group;
+    taskGroupSetup(&group);
+
+    // keep the first half and offer the second to other processors, until what's left fits in
+    // one piece. Thieves take the oldest (biggest) halves, and split them the same way.
+    ForRange halves[MaxSplits];
+    uint32_t splits = 0;
+
+    while (end - begin > shared->grain
+        && splits < MaxSplits)
+    {
+        const uint32_t middle = begin + (end - begin) / 2;
+
+        ForRange* half = &halves[splits++];
+        half->shared = shared;
+        half->begin = middle;
+        half->end = end;
+
+        taskSetup(&half->task, RunRange, half);
+        taskSpawn(&group, &half->task);
+
+        end = middle;
+    }
+
+    shared->body(shared->context, begin, end);
+    taskWait(&group);
+}
+
+void WakeHandler(InterruptFrame* frame, void* context)
+{
+    // the point was to end the wait; there's nothing else to do.
+    (void)frame;
+    (void)context;
+
+    lapicEndOfInterrupt();
+}
+
+NOS_END_EXTERN_C
@@ -0,0 +1,722 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of kernel threads.
+//!
+//! \details
+//! A thread that isn't running has everything it needs on its own stack: ThreadSwitchStacks
+//! pushes the callee-saved registers and the return address is already there, so the only thing
+//! kept in the thread itself is the stack pointer.
+//!
+//! An exited thread can't free the stack it's still running on. The thread that is switched to
+//! next does it instead, right after the switch (see FinishSwitch).
+//!
+//! Time slices are measured with the TSC. One timer per processor stays armed while a thread other
+//! than the idle thread is running; when it fires it checks how long the current thread has been
+//! running, and only asks for a switch if that's a whole slice - so switching threads doesn't
+//! cost a timer update.
+//!
+//! A thread stays on the processor that created it, and only that processor touches its run
+//! queues. Waking a thread from another processor pushes it onto its processor's remote wake list
+//! and sends an IPI; the handler makes it ready there.
+//-------------------------------------------------------------------------------------------------
+#include "thread.h"
+#include "idt.h"
+#include "idle.h"
+#include "apic.h"
+#include "katomic.h"
+#include "rcu.h"
+#include "ktimer.h"
+#include "ktime.h"
+#include "cpu.h"
+#include "physmem.h"
+#include "pool.h"
+#include "spinlock.h"
+#include "platform.h"
+#include "kstddef.h"
+#include "kstdint.h"
+#include "intrin.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// typedefs
+//-------------------------------------------------------------------------------------------------
+enum ThreadState : uint32_t
+{
+    TS_Ready,           //!< In the run queue.
+    TS_Running,         //!< Running on a processor.
+    TS_Blocked,         //!< Waiting for threadWake.
+    TS_Exited,          //!< Waiting for its stack to be freed.
+};
+
+struct tag_Thread
+{
+    uintptr_t stackPointer;     //!< The saved stack pointer, while the thread isn't running.
+    Thread* next;               //!< The next thread in the same run queue.
+    Thread* prev;               //!< The previous thread in the same run queue.
+    void* stack;                //!< The base of the stack, or null for a processor's first thread.
+    ThreadFunction function;
+    void* context;
+    uint32_t state;
+    uint32_t id;
+    uint32_t priority;          //!< The base priority.
+    uint32_t boost;             //!< Added to the base priority, for threads which block.
+    uint32_t queue;             //!< The run queue the thread is in, while it's ready.
+    uint32_t cpu;               //!< The processor the thread runs on.
+    uint64_t sliceStart;        //!< When the current time slice started.
+    Thread* wakeNext;           //!< The next thread in its processor's remote wake list.
+    katomic<bool> wakePending;  //!< Set while the thread is in the remote wake list.
+};
+
+//! \brief  A processor's scheduling state. Apart from remoteWakes, only ever touched by its own
+//!         processor, with interrupts disabled.
+typedef struct alignas(NOS_CACHE_LINE_SIZE) tag_ThreadCpuState
+{
+    Thread* current;            //!< The running thread.
+    Thread* previous;           //!< The thread switched away from, until FinishSwitch runs.
+    Thread* idle;               //!< Runs when nothing else is ready. Never in a run queue.
+    uint32_t readyMask;         //!< Bit n is set if run queue n isn't empty.
+    bool needResched;           //!< Set when the current thread should be switched away from.
+    uint32_t switchCount;
+    uint32_t preemptCount;
+    Timer sliceTimer;
+    Thread* heads[THREAD_PriorityCount];
+    Thread* tails[THREAD_PriorityCount];
+
+    //! Threads woken by other processors, for the IPI handler to make ready. Pushed to by any
+    //! processor.
+    katomic<Thread*> remoteWakes;
+} ThreadCpuState;
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    StackSize = THREAD_StackPages * NOS_PAGE_SIZE,
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static GrowablePool<Thread> g_threadPool;
+static TicketLock g_threadPoolLock;     //!< Guards g_threadPool and g_nextThreadId.
+static ThreadCpuState g_threadCpuState[CPU_MaxCount];
+static uint32_t g_nextThreadId;
+static uint32_t g_createdCount;
+static uint32_t g_exitedCount;
+static bool g_preemptive;
+static uint64_t g_sliceCycles;
+
+
+//-------------------------------------------------------------------------------------------------
+// inline/static functions
+//-------------------------------------------------------------------------------------------------
+// defined in threadswitch.asm
+void ThreadSwitchStacks(_Out_ uintptr_t* saveStackPointer, uintptr_t stackPointer);
+
+static inline ThreadCpuState* CurrentState()
+{
+    return &g_threadCpuState[cpuCurrentIndex()];
+}
+
+static inline uint32_t EffectivePriority(_In_ const Thread* thread)
+{
+    const uint32_t priority = thread->priority + thread->boost;
+    return (priority < THREAD_PriorityCount) ? priority : (THREAD_PriorityCount - 1);
+}
+
+static Thread* AllocateThread(void);
+static void FreeThread(_Inout_ Thread* thread);
+static void Enqueue(_Inout_ ThreadCpuState* cpu, _Inout_ Thread* thread);
+static void Unlink(_Inout_ ThreadCpuState* cpu, _Inout_ Thread* thread);
+static Thread* Dequeue(_Inout_ ThreadCpuState* cpu);
+static bool HasReadyAtOrAbove(_In_ const ThreadCpuState* cpu, uint32_t priority);
+static void MakeReady(_Inout_ ThreadCpuState* cpu, _Inout_ Thread* thread);
+static void WakeRemote(_Inout_ Thread* thread);
+static void RemoteWakeHandler(_Inout_ InterruptFrame* frame, _In_opt_ void* context);
+static void Schedule(_Inout_ ThreadCpuState* cpu);
+static void SliceExpired(_Inout_ Timer* timer, _In_opt_ void* context);
+static void FinishSwitch(_Inout_ ThreadCpuState* cpu);
+static void ThreadEntry(void);
+static void IdleMain(_In_opt_ void* context);
+
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool threadInitialize()
+{
+    ThreadCpuState* cpu = CurrentState();
+
+    // the caller is already running on a stack of its own, so only the bookkeeping is needed.
+    Thread* boot = AllocateThread();
+    if (boot == nullptr)
+    {
+        return false;
+    }
+
+    boot->stackPointer = 0;
+    boot->next = nullptr;
+    boot->prev = nullptr;
+    boot->stack = nullptr;
+    boot->function = nullptr;
+    boot->context = nullptr;
+    boot->state = TS_Running;
+    boot->priority = THREAD_DefaultPriority;
+    boot->boost = 0;
+    boot->queue = 0;
+    boot->cpu = cpuCurrentIndex();
+    boot->sliceStart = __rdtsc();
+    boot->wakeNext = nullptr;
+    boot->wakePending.store(false, memory_order::relaxed);
+    cpu->current = boot;
+
+    timerSetup(&cpu->sliceTimer, SliceExpired, cpu);
+
+    // the idle thread is created like any other, then taken back out of the run queue.
+    if (threadCreate(IdleMain, nullptr) == nullptr)
+    {
+        cpu->current = nullptr;
+        FreeThread(boot);
+        return false;
+    }
+
+    const bool enabled = idtDisableInterrupts();
+    cpu->idle = Dequeue(cpu);
+    idtRestoreInterrupts(enabled);
+
+    idtRegisterHandler(IDT_ThreadWakeVector, RemoteWakeHandler, nullptr);
+    return true;
+}
+
+void threadEnablePreemption()
+{
+    g_sliceCycles = ktimeNsToCycles((uint64_t)THREAD_SliceMs * 1000000);
+
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = CurrentState();
+
+    g_preemptive = true;
+    cpu->current->sliceStart = __rdtsc();
+
+    if (cpu->current != cpu->idle)
+    {
+        timerArm(&cpu->sliceTimer, (uint64_t)THREAD_SliceMs * 1000000);
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+Thread* threadCreate(ThreadFunction function, void* context)
+{
+    Thread* thread = AllocateThread();
+    if (thread == nullptr)
+    {
+        return nullptr;
+    }
+
+    uint8_t* stack = (uint8_t*)pmAllocatePages(THREAD_StackPages, nullptr);
+    if (stack == nullptr)
+    {
+        FreeThread(thread);
+        return nullptr;
+    }
+
+    // make the stack look like ThreadEntry's caller called ThreadSwitchStacks: the callee-saved
+    // registers, then a return address into ThreadEntry. The slot above that is where
+    // ThreadEntry expects its own return address, which it never uses.
+    uintptr_t* top = (uintptr_t*)(stack + StackSize);
+    *--top = 0;
+    *--top = (uintptr_t)ThreadEntry;
+    *--top = 0;     // ebp
+    *--top = 0;     // ebx
+    *--top = 0;     // esi
+    *--top = 0;     // edi
+
+    thread->stackPointer = (uintptr_t)top;
+    thread->stack = stack;
+    thread->function = function;
+    thread->context = context;
+    thread->priority = THREAD_DefaultPriority;
+    thread->boost = 0;
+    thread->cpu = cpuCurrentIndex();
+    thread->wakeNext = nullptr;
+    thread->wakePending.store(false, memory_order::relaxed);
+
+    const bool enabled = idtDisableInterrupts();
+
+    g_createdCount++;
+    Enqueue(CurrentState(), thread);
+
+    idtRestoreInterrupts(enabled);
+    return thread;
+}
+
+void threadYield()
+{
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = CurrentState();
+
+    if (cpu->current == cpu->idle)
+    {
+        if (cpu->readyMask != 0)
+        {
+            Schedule(cpu);
+        }
+    }
+    else if (HasReadyAtOrAbove(cpu, EffectivePriority(cpu->current)))
+    {
+        Enqueue(cpu, cpu->current);
+        Schedule(cpu);
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+void threadExit()
+{
+    _disable();
+    ThreadCpuState* cpu = CurrentState();
+
+    //TODO: kassert(cpu->current->stack != nullptr && cpu->current != cpu->idle);
+    cpu->current->state = TS_Exited;
+    Schedule(cpu);
+
+    // never resumed.
+    for (;;)
+    {
+        __halt();
+    }
+}
+
+void threadBlock()
+{
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = CurrentState();
+
+    //TODO: kassert(cpu->current != cpu->idle);
+    cpu->current->state = TS_Blocked;
+    Schedule(cpu);
+
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+void threadWake(Thread* thread)
+{
+    // threads never move, so the caller can't be moved onto or off the thread's processor
+    // between the check and the wakeup.
+    if (thread->cpu != cpuCurrentIndex())
+    {
+        WakeRemote(thread);
+        return;
+    }
+
+    const bool enabled = idtDisableInterrupts();
+    MakeReady(CurrentState(), thread);
+
+    // switching here would pull the rug out from under an interrupt handler, or from code that
+    // disabled interrupts to do something atomically.
+    idtRestoreInterrupts(enabled);
+
+    if (enabled
+        && !idtInInterrupt())
+    {
+        threadPreemptIfNeeded();
+    }
+}
+
+_Use_decl_annotations_
+void threadSetPriority(Thread* thread, uint32_t priority)
+{
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = CurrentState();
+
+    //TODO: kassert(priority < THREAD_PriorityCount);
+    thread->priority = priority;
+
+    if (thread->state == TS_Ready)
+    {
+        Unlink(cpu, thread);
+        Enqueue(cpu, thread);
+    }
+
+    if (cpu->current != cpu->idle
+        && HasReadyAtOrAbove(cpu, EffectivePriority(cpu->current) + 1))
+    {
+        cpu->needResched = true;
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+_Use_decl_annotations_
+uint32_t threadGetPriority(const Thread* thread)
+{
+    return thread->priority;
+}
+
+void threadPreemptIfNeeded()
+{
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = CurrentState();
+
+    // a held-off switch stays requested, for the first interrupt after preemption is enabled.
+    if (cpu->needResched
+        && !cpuPreemptionDisabled())
+    {
+        cpu->needResched = false;
+
+        // the idle thread only runs when nothing is ready, so it never goes back in a queue.
+        if (cpu->current == cpu->idle)
+        {
+            if (cpu->readyMask != 0)
+            {
+                Schedule(cpu);
+            }
+        }
+        else if (HasReadyAtOrAbove(cpu, EffectivePriority(cpu->current)))
+        {
+            cpu->preemptCount++;
+            Enqueue(cpu, cpu->current);
+            Schedule(cpu);
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+Thread* threadCurrent()
+{
+    return CurrentState()->current;
+}
+
+_Use_decl_annotations_
+bool threadIsRunning(const Thread* thread)
+{
+    return (thread->state == TS_Running);
+}
+
+_Use_decl_annotations_
+uint32_t threadId(const Thread* thread)
+{
+    return thread->id;
+}
+
+_Use_decl_annotations_
+void threadGetStats(ThreadStats* stats)
+{
+    const bool enabled = idtDisableInterrupts();
+
+    stats->createdCount = g_createdCount;
+    stats->exitedCount = g_exitedCount;
+    stats->switchCount = 0;
+    stats->preemptCount = 0;
+
+    for (uint32_t i = 0; i < CPU_MaxCount; i++)
+    {
+        stats->switchCount += g_threadCpuState[i].switchCount;
+        stats->preemptCount += g_threadCpuState[i].preemptCount;
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+
+//-------------------------------------------------------------------------------------------------
+// static function implementations
+//-------------------------------------------------------------------------------------------------
+Thread* AllocateThread()
+{
+    // threads are created with interrupts enabled and freed on the switch path, from any
+    // processor, so the pool is only touched under its lock.
+    const bool enabled = ticketLockAcquireIrqSave(&g_threadPoolLock);
+
+    Thread* thread = g_threadPool.Allocate();
+    if (thread != nullptr)
+    {
+        thread->id = g_nextThreadId++;
+    }
+
+    ticketLockReleaseIrqRestore(&g_threadPoolLock, enabled);
+    return thread;
+}
+
+_Use_decl_annotations_
+void FreeThread(Thread* thread)
+{
+    const bool enabled = ticketLockAcquireIrqSave(&g_threadPoolLock);
+    g_threadPool.Free(thread);
+    ticketLockReleaseIrqRestore(&g_threadPoolLock, enabled);
+}
+
+void Enqueue(ThreadCpuState* cpu, Thread* thread)
+{
+    const uint32_t queue = EffectivePriority(thread);
+
+    thread->state = TS_Ready;
+    thread->queue = queue;
+    thread->next = nullptr;
+    thread->prev = cpu->tails[queue];
+
+    if (cpu->tails[queue] != nullptr)
+    {
+        cpu->tails[queue]->next = thread;
+    }
+    else
+    {
+        cpu->heads[queue] = thread;
+        cpu->readyMask |= (1u << queue);
+    }
+
+    cpu->tails[queue] = thread;
+}
+
+void Unlink(ThreadCpuState* cpu, Thread* thread)
+{
+    const uint32_t queue = thread->queue;
+
+    if (thread->prev != nullptr)
+    {
+        thread->prev->next = thread->next;
+    }
+    else
+    {
+        cpu->heads[queue] = thread->next;
+    }
+
+    if (thread->next != nullptr)
+    {
+        thread->next->prev = thread->prev;
+    }
+    else
+    {
+        cpu->tails[queue] = thread->prev;
+    }
+
+    if (cpu->heads[queue] == nullptr)
+    {
+        cpu->readyMask &= ~(1u << queue);
+    }
+
+    thread->next = nullptr;
+    thread->prev = nullptr;
+}
+
+Thread* Dequeue(ThreadCpuState* cpu)
+{
+    unsigned long queue;
+    if (!_BitScanReverse(&queue, cpu->readyMask))
+    {
+        return nullptr;
+    }
+
+    Thread* thread = cpu->heads[queue];
+    Unlink(cpu, thread);
+    return thread;
+}
+
+bool HasReadyAtOrAbove(const ThreadCpuState* cpu, uint32_t priority)
+{
+    return (priority < THREAD_PriorityCount)
+        && (cpu->readyMask >> priority) != 0;
+}
+
+void MakeReady(ThreadCpuState* cpu, Thread* thread)
+{
+    if (thread->state != TS_Blocked)
+    {
+        return;
+    }
+
+    if (thread->boost < THREAD_MaxBoost)
+    {
+        thread->boost++;
+    }
+
+    Enqueue(cpu, thread);
+
+    if (cpu->current == cpu->idle
+        || EffectivePriority(thread) > EffectivePriority(cpu->current))
+    {
+        cpu->needResched = true;
+    }
+}
+
+void WakeRemote(Thread* thread)
+{
+    // a thread that's already in the list gets made ready (if it's still blocked by then) for
+    // this wakeup too, so it's only pushed once.
+    if (thread->wakePending.exchange(true))
+    {
+        return;
+    }
+
+    ThreadCpuState* home = &g_threadCpuState[thread->cpu];
+    Thread* head = home->remoteWakes.load(memory_order::relaxed);
+
+    do
+    {
+        thread->wakeNext = head;
+    } while (!home->remoteWakes.compare_exchange(head, thread));
+
+    // a non-empty list already has an IPI on the way, which will find this thread too.
+    if (head == nullptr)
+    {
+        lapicSendIpi(cpuGetData(thread->cpu)->apicId, IDT_ThreadWakeVector);
+    }
+}
+
+void RemoteWakeHandler(InterruptFrame* frame, void* context)
+{
+    (void)frame;
+    (void)context;
+
+    ThreadCpuState* cpu = CurrentState();
+    Thread* thread = cpu->remoteWakes.exchange(nullptr);
+
+    while (thread != nullptr)
+    {
+        Thread* next = thread->wakeNext;
+
+        // cleared first, so a wakeup that comes while this one is handled isn't dropped.
+        thread->wakePending.store(false, memory_order::seq_cst);
+        MakeReady(cpu, thread);
+        thread = next;
+    }
+
+    // a switch to a thread made ready here happens on the way out of the interrupt.
+    lapicEndOfInterrupt();
+}
+
+void Schedule(ThreadCpuState* cpu)
+{
+    // the caller has already put the current thread wherever it belongs (back in the run queue,
+    // or nowhere), so it's switched away from unless it's the only thing left to run.
+    Thread* previous = cpu->current;
+    Thread* next = Dequeue(cpu);
+
+    if (next == nullptr)
+    {
+        next = cpu->idle;
+    }
+
+    next->state = TS_Running;
+    next->sliceStart = __rdtsc();
+    cpu->needResched = false;
+
+    if (next == previous)
+    {
+        return;
+    }
+
+    cpu->current = next;
+    cpu->previous = previous;
+    cpu->switchCount++;
+
+    // an idle processor shouldn't be woken up just to find nothing else to run.
+    if (g_preemptive)
+    {
+        if (next == cpu->idle)
+        {
+            timerCancel(&cpu->sliceTimer);
+        }
+        else if (!timerIsArmed(&cpu->sliceTimer))
+        {
+            timerArm(&cpu->sliceTimer, (uint64_t)THREAD_SliceMs * 1000000);
+        }
+    }
+
+    // a thread can't block or be preempted inside an RCU read-side critical section.
+    rcuQuiescentState();
+    ThreadSwitchStacks(&previous->stackPointer, next->stackPointer);
+
+    // running as previous again - on this processor, but possibly much later.
+    FinishSwitch(CurrentState());
+}
+
+void FinishSwitch(ThreadCpuState* cpu)
+{
+    Thread* previous = cpu->previous;
+    cpu->previous = nullptr;
+
+    if (previous != nullptr
+        && previous->state == TS_Exited)
+    {
+        pmFree(previous->stack, THREAD_StackPages);
+        FreeThread(previous);
+        g_exitedCount++;
+    }
+}
+
+void SliceExpired(Timer* timer, void* context)
+{
+    const bool enabled = idtDisableInterrupts();
+    ThreadCpuState* cpu = (ThreadCpuState*)context;
+    Thread* current = cpu->current;
+
+    if (current != cpu->idle)
+    {
+        const uint64_t elapsed = __rdtsc() - current->sliceStart;
+
+        if (elapsed >= g_sliceCycles)
+        {
+            // a thread that keeps using whole slices isn't waiting on anything, so it loses the
+            // boost it got for blocking.
+            if (current->boost > 0)
+            {
+                current->boost--;
+            }
+
+            current->sliceStart = __rdtsc();
+            cpu->needResched = true;
+            timerArm(timer, (uint64_t)THREAD_SliceMs * 1000000);
+        }
+        else
+        {
+            timerArm(timer, ktimeCyclesToNs(g_sliceCycles - elapsed));
+        }
+    }
+
+    idtRestoreInterrupts(enabled);
+}
+
+void ThreadEntry()
+{
+    // a new thread starts inside Schedule, with interrupts disabled.
+    ThreadCpuState* cpu = CurrentState();
+    FinishSwitch(cpu);
+
+    Thread* self = cpu->current;
+    _enable();
+
+    self->function(self->context);
+    threadExit();
+}
+
+void IdleMain(void* context)
+{
+    (void)context;
+
+    for (;;)
+    {
+        _disable();
+
+        if (CurrentState()->readyMask != 0)
+        {
+            Schedule(CurrentState());
+            _enable();
+        }
+        else
+        {
+            // threads are only woken by this processor, from interrupts, so the wait can't miss
+            // one.
+            idleWait();
+        }
+    }
+}
+
+NOS_END_EXTERN_C
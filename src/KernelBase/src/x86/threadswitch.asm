@@ -0,0 +1,32 @@
+.686P
+.model  flat, c
+
+.code
+
+; void ThreadSwitchStacks(uintptr_t* saveStackPointer, uintptr_t stackPointer)
+;
+; Saves the callee-saved registers on the current stack, stores the stack pointer through
+; saveStackPointer, and resumes the thread whose stack pointer is stackPointer. The caller has
+; already saved eax, ecx and edx if it needed them, so they aren't saved here.
+;
+; A new thread's stack is set up to look like it called this (see threadCreate).
+ThreadSwitchStacks proc
+    mov     eax, [esp+4]
+    mov     edx, [esp+8]
+
+    push    ebp
+    push    ebx
+    push    esi
+    push    edi
+    mov     [eax], esp
+
+    mov     esp, edx
+    pop     edi
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret
+ThreadSwitchStacks endp
+
+
+end
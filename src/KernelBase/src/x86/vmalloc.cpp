@@ -0,0 +1,186 @@
+//-------------------------------------------------------------------------------------------------
+//! \file
+//! \brief  Implementation of the virtually contiguous allocator.
+//-------------------------------------------------------------------------------------------------
+#include "vmalloc.h"
+#include "vmrange.h"
+#include "paging.h"
+#include "physmem.h"
+#include "percpu.h"
+#include "kstddef.h"
+#include "kstdint.h"
+
+NOS_EXTERN_C
+
+//-------------------------------------------------------------------------------------------------
+// constants
+//-------------------------------------------------------------------------------------------------
+enum // constants
+{
+    PageSize = NOS_PAGE_SIZE,   //!< The size of a single page of memory.
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// data
+//-------------------------------------------------------------------------------------------------
+static VirtualRangeAllocator g_vmallocRanges;
+
+PERCPU_COUNTER(vmAllocations);
+PERCPU_COUNTER(vmFrees);
+
+//-------------------------------------------------------------------------------------------------
+// interface implementation
+//-------------------------------------------------------------------------------------------------
+bool vmallocInitialize()
+{
+    return g_vmallocRanges.Initialize(VM_VmallocBase, VM_VmallocSize);
+}
+
+_Use_decl_annotations_
+void* vmAllocate(size_t cb)
+{
+    if (cb == 0
+        || cb > VM_VmallocSize)
+    {
+        return nullptr;
+    }
+
+    const uint32_t pageCount = (uint32_t)((cb + PageSize - 1) / PageSize);
+    const uintptr_t base = g_vmallocRanges.Allocate(pageCount);
+
+    if (base == 0)
+    {
+        return nullptr;
+    }
+
+    // take frames one at a time, hinting at the frame after the last one so runs of contiguous
+    // frames are mapped with a single vmMap call.
+    uintptr_t runVirtual = base;
+    uintptr_t runPhysical = 0;
+    uint32_t runLength = 0;
+    uint32_t mappedPages = 0;
+
+    for (uint32_t i = 0; i < pageCount; i++)
+    {
+        uintptr_t frame = pmAllocateFrame(runPhysical + runLength * PageSize);
+
+        if (frame == 0)
+        {
+            break;
+        }
+
+        if (runLength > 0
+            && frame != runPhysical + runLength * PageSize)
+        {
+            if (!vmMap((void*)runVirtual, runPhysical, runLength, VMF_KernelData))
+            {
+                pmFree((void*)runPhysical, runLength);
+                pmFree((void*)frame, 1);
+                runLength = 0;
+                break;
+            }
+
+            mappedPages += runLength;
+            runVirtual += runLength * PageSize;
+            runLength = 0;
+        }
+
+        if (runLength == 0)
+        {
+            runPhysical = frame;
+        }
+
+        runLength++;
+    }
+
+    if (runLength > 0)
+    {
+        if (vmMap((void*)runVirtual, runPhysical, runLength, VMF_KernelData))
+        {
+            mappedPages += runLength;
+        }
+        else
+        {
+            pmFree((void*)runPhysical, runLength);
+        }
+    }
+
+    if (mappedPages < pageCount)
+    {
+        vmUnmapAndFree((void*)base, mappedPages);
+        g_vmallocRanges.Free(base);
+        return nullptr;
+    }
+
+    percpuIncrement(&vmAllocations);
+    return (void*)base;
+}
+
+_Use_decl_annotations_
+void vmFree(void* ptr)
+{
+    const uintptr_t base = (uintptr_t)ptr;
+
+    if (ptr == nullptr
+        || !g_vmallocRanges.IsReserved(base))
+    {
+        return;
+    }
+
+    // the range stays reserved until no processor can reach the pages through it, so it can't
+    // be handed out again while a stale TLB entry still points at the old frames.
+    vmUnmapAndFree(ptr, g_vmallocRanges.RangePages(base));
+    g_vmallocRanges.Free(base);
+    percpuIncrement(&vmFrees);
+}
+
+_Use_decl_annotations_
+void* vmMapIo(uintptr_t physicalAddress, size_t cb)
+{
+    const uintptr_t offset = physicalAddress % PageSize;
+
+    if (cb == 0
+        || cb > VM_VmallocSize - offset)
+    {
+        return nullptr;
+    }
+
+    const uint32_t pageCount = (uint32_t)((offset + cb + PageSize - 1) / PageSize);
+    const uintptr_t base = g_vmallocRanges.Allocate(pageCount);
+
+    if (base == 0)
+    {
+        return nullptr;
+    }
+
+    if (!vmMap((void*)base, physicalAddress - offset, pageCount, VMF_Device))
+    {
+        g_vmallocRanges.Free(base);
+        return nullptr;
+    }
+
+    return (void*)(base + offset);
+}
+
+_Use_decl_annotations_
+void vmUnmapIo(void* ptr)
+{
+    const uintptr_t base = (uintptr_t)ptr & ~(uintptr_t)(PageSize - 1);
+
+    if (ptr == nullptr
+        || !g_vmallocRanges.IsReserved(base))
+    {
+        return;
+    }
+
+    vmUnmap((void*)base, g_vmallocRanges.RangePages(base));
+    g_vmallocRanges.Free(base);
+}
+
+uint32_t vmAllocatedPages()
+{
+    return g_vmallocRanges.ReservedPages();
+}
+
+NOS_END_EXTERN_C